@@ -7,4 +7,108 @@
  */
 #include <CLProtocol/CLProtocol.h>
 
+/*
+ * C-RED2 specific parameters for clpGetParam/clpSetParam. Like the CLP_DEVICE_*
+ * parameters they require a valid cookie. CLP_PARAMS has no fixed underlying type
+ * and its enumerators span -2..3, so only -8..7 are valid CLP_PARAMS values in C++;
+ * these take the bottom of that range, as far as possible from the standard ones.
+ */
+#define CLP_CRED2_TRANSPORT_COUNTERS ((CLP_PARAMS)-8)       /* get: clp_cred2_transport_counters_t */
+#define CLP_CRED2_TRANSPORT_COUNTERS_RESET ((CLP_PARAMS)-7) /* set: any 32-bit value */
+#define CLP_CRED2_FLIGHT_RECORDER ((CLP_PARAMS)-6)          /* get: text dump, see below */
+#define CLP_CRED2_CANCEL_TRANSACTION ((CLP_PARAMS)-5)       /* set: any 32-bit value, see below */
+
+/*
+ * CLP_CRED2_CANCEL_TRANSACTION may be set from any thread. The register access in
+ * progress on the cookie, synchronous or asynchronous, stops waiting for the camera
+ * within 20 ms and returns CLP_CRED2_ERR_CANCELED; the next command resyncs to the
+ * prompt. A request made while the connection is idle is discarded by the next call.
+ */
+
+/*
+ * CLP_CRED2_FLIGHT_RECORDER fills the buffer with a NUL-terminated text dump of the
+ * last transactions of the connection, one line per transaction, oldest first:
+ *   seq=<n> start_us=<t> dur_us=<d> rc=<code> cmd="<command>" cmd_len=<n> reply="<reply>" reply_len=<n>
+ * Lines that do not fit are omitted; this size always holds the complete dump.
+ */
+#define CLP_CRED2_FLIGHT_RECORDER_DUMP_SIZE 32768
+
+/* Serial transport counters of one connection, accumulated since probe or the last reset. */
+typedef struct clp_cred2_transport_counters_t {
+  CLINT64 bytes_written;       /* bytes accepted by clSerialWrite */
+  CLINT64 bytes_read;          /* bytes returned by clSerialRead */
+  CLINT64 reads;               /* clSerialRead calls */
+  CLINT64 timeouts;            /* clSerialRead/clSerialWrite calls that returned CL_ERR_TIMEOUT */
+  CLINT64 errors;              /* other error returns from the serial interface */
+  CLINT64 prompt_resyncs;      /* replies that ended without the CLI prompt */
+  CLINT64 commands;            /* CLI commands issued */
+  CLINT64 drained_bytes;       /* stale bytes found in the input before a command */
+  CLINT64 resyncs;             /* empty-line prompt handshakes after stale input or a misaligned reply */
+  CLINT64 misaligned_replies;  /* replies that echoed a different command */
+  CLINT64 watchdog_recoveries; /* recoveries started by the watchdog */
+  CLINT64 watchdog_failures;   /* recoveries that did not get the CLI back in time */
+  CLINT64 settings_replayed;   /* shadowed settings written back after a reboot */
+  CLINT64 events;              /* camera event lines queued for clpGetEventData */
+  CLINT64 events_dropped;      /* camera event lines dropped because the queue was full */
+  CLINT64 cache_invalidations; /* cached register values dropped because a camera event changed them */
+  CLINT64 coalesced_reads;     /* clpReadRegister calls answered by another thread's read of the register */
+} clp_cred2_transport_counters_t;
+
+/*
+ * Asynchronous register access. Requests are queued per connection and run in
+ * submission order by a worker thread that the first submit starts. They share
+ * the connection with clpReadRegister/clpWriteRegister, which wait for the
+ * transaction in progress. A write that would return CL_ERR_PENDING_WRITE is
+ * waited out by the worker.
+ *
+ * Every accepted request completes exactly once: through its callback, which
+ * runs on the worker thread (or on the thread that cancels the request), or,
+ * when no callback is given, through the queue read by clpCred2PollCompletion.
+ * Read buffers must stay valid until completion; write data is copied.
+ *
+ * A callback may call clpDisconnect on its own cookie, or clpCloseLib. The
+ * requests still queued then complete as canceled before that call returns,
+ * and the worker exits once the callback returns instead of being waited for.
+ */
+#define CLP_CRED2_ERR_CANCELED ((CLINT32)-21000) /* request or transaction canceled */
+#define CLP_CRED2_MAX_ASYNC_WRITE_SIZE 256
+#define CLP_CRED2_ERROR_TEXT_SIZE 128
+
+typedef CLUINT32 clp_cred2_request_t; /* 0 is never a valid request */
+
+typedef struct clp_cred2_completion_t {
+  clp_cred2_request_t request;
+  CLUINT32 cookie;
+  CLINT64 address;
+  CLINT32 status;                               /* CL_ERR_* result of the register access */
+  CLINT32 is_write;
+  CLINT8 *buffer;                               /* read: the caller's buffer, now filled; write: NULL */
+  CLINT64 buffer_size;
+  void *user_data;
+  CLINT8 error_text[CLP_CRED2_ERROR_TEXT_SIZE]; /* last-error text when status is not CL_ERR_NO_ERR */
+} clp_cred2_completion_t;
+
+typedef void(CLPROTOCOL *clp_cred2_completion_fn)(const clp_cred2_completion_t *pCompletion);
+
+/* Queues a register read. pCallback may be NULL to complete through clpCred2PollCompletion. */
+CLPROTOCOLEXPORT CLINT32 CLPROTOCOL
+clpCred2SubmitRead(ISerial *pSerial, const CLUINT32 Cookie, const CLINT64 Address, CLINT8 *pBuffer,
+                   const CLINT64 BufferSize, const CLUINT32 TimeOut, clp_cred2_completion_fn pCallback,
+                   void *pUserData, clp_cred2_request_t *pRequest);
+
+/* Queues a register write of at most CLP_CRED2_MAX_ASYNC_WRITE_SIZE bytes. */
+CLPROTOCOLEXPORT CLINT32 CLPROTOCOL
+clpCred2SubmitWrite(ISerial *pSerial, const CLUINT32 Cookie, const CLINT64 Address, const CLINT8 *pBuffer,
+                    const CLINT64 BufferSize, const CLUINT32 TimeOut, clp_cred2_completion_fn pCallback,
+                    void *pUserData, clp_cred2_request_t *pRequest);
+
+/* Takes the oldest completion of a request submitted without callback; CL_ERR_TIMEOUT when none arrives in time. */
+CLPROTOCOLEXPORT CLINT32 CLPROTOCOL
+clpCred2PollCompletion(clp_cred2_completion_t *pCompletion, const CLUINT32 TimeOut);
+
+/* Cancels a request that has not started: it completes with CLP_CRED2_ERR_CANCELED before this returns.
+ * A request already running gives CL_ERR_IN_USE; an unknown or finished one CL_ERR_INVALID_REFERENCE. */
+CLPROTOCOLEXPORT CLINT32 CLPROTOCOL
+clpCred2Cancel(const clp_cred2_request_t Request);
+
 #endif
@@ -18,6 +18,7 @@ static const char k_embedded_cred2_xml[] = R"CLPXML(
     <pFeature>UserSetControl</pFeature>
     <pFeature>EventsControl</pFeature>
     <pFeature>C-RED2</pFeature>
+    <pFeature>Statistics</pFeature>
   </Category>
 
   <Port Name="Device">
@@ -35,6 +36,10 @@ static const char k_embedded_cred2_xml[] = R"CLPXML(
     <pFeature>DeviceHardwareVersion</pFeature>
     <pFeature>DeviceStatus</pFeature>
     <pFeature>DeviceStatusDetailed</pFeature>
+    <pFeature>DeviceStatusState</pFeature>
+    <pFeature>DeviceStatusErrorFlags</pFeature>
+    <pFeature>DeviceStatusCoolingState</pFeature>
+    <pFeature>DeviceStatusUptime</pFeature>
     <pFeature>DeviceShutdown</pFeature>
     <pFeature>ContinueAfterError</pFeature>
     <pFeature>DeviceIndicatorSelector</pFeature>
@@ -141,6 +146,69 @@ static const char k_embedded_cred2_xml[] = R"CLPXML(
     <pValue>DeviceStatusDetailedReg</pValue>
   </String>
 
+  <IntReg Name="DeviceStatusStateReg">
+    <Address>0x02C0</Address>
+    <Length>4</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Enumeration Name="DeviceStatusState">
+    <Description>CLI: status detailed raw (state field; parsed once per refresh, cached 250 ms)</Description>
+    <pValue>DeviceStatusStateReg</pValue>
+    <EnumEntry Name="Unknown"><Value>0</Value></EnumEntry>
+    <EnumEntry Name="Starting"><Value>1</Value></EnumEntry>
+    <EnumEntry Name="Configuring"><Value>2</Value></EnumEntry>
+    <EnumEntry Name="PoorVacuum"><Value>3</Value></EnumEntry>
+    <EnumEntry Name="Faulty"><Value>4</Value></EnumEntry>
+    <EnumEntry Name="Cooling"><Value>5</Value></EnumEntry>
+    <EnumEntry Name="Standby"><Value>6</Value></EnumEntry>
+    <EnumEntry Name="Operational"><Value>7</Value></EnumEntry>
+    <EnumEntry Name="Ready"><Value>8</Value></EnumEntry>
+  </Enumeration>
+
+  <IntReg Name="DeviceStatusErrorFlagsReg">
+    <Address>0x02C4</Address>
+    <Length>4</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="DeviceStatusErrorFlags">
+    <Description>CLI: status detailed raw (error flags field)</Description>
+    <pValue>DeviceStatusErrorFlagsReg</pValue>
+    <Representation>HexNumber</Representation>
+  </Integer>
+
+  <IntReg Name="DeviceStatusCoolingStateReg">
+    <Address>0x02C8</Address>
+    <Length>4</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Enumeration Name="DeviceStatusCoolingState">
+    <Description>CLI: status detailed raw (cooling field)</Description>
+    <pValue>DeviceStatusCoolingStateReg</pValue>
+    <EnumEntry Name="Unknown"><Value>0</Value></EnumEntry>
+    <EnumEntry Name="Off"><Value>1</Value></EnumEntry>
+    <EnumEntry Name="Cooling"><Value>2</Value></EnumEntry>
+    <EnumEntry Name="Regulated"><Value>3</Value></EnumEntry>
+  </Enumeration>
+
+  <IntReg Name="DeviceStatusUptimeReg">
+    <Address>0x02CC</Address>
+    <Length>4</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="DeviceStatusUptime">
+    <Description>CLI: status detailed raw (uptime field)</Description>
+    <Unit>s</Unit>
+    <pValue>DeviceStatusUptimeReg</pValue>
+  </Integer>
+
   <IntReg Name="DeviceShutdownReg">
     <Address>0x0300</Address>
     <Length>4</Length>
@@ -212,6 +280,9 @@ static const char k_embedded_cred2_xml[] = R"CLPXML(
     <pFeature>TriggerMode</pFeature>
     <pFeature>TriggerDelay</pFeature>
     <pFeature>TriggerSourceFormat</pFeature>
+    <pFeature>ExposureTimingFrameRate</pFeature>
+    <pFeature>ExposureTimingExposureTime</pFeature>
+    <pFeature>ExposureTimingCommit</pFeature>
   </Category>
 
   <FloatReg Name="AcquisitionFrameRateReg">
@@ -219,6 +290,7 @@ static const char k_embedded_cred2_xml[] = R"CLPXML(
     <Length>4</Length>
     <AccessMode>RW</AccessMode>
     <pPort>Device</pPort>
+    <pInvalidator>ExposureTimingCommitReg</pInvalidator>
   </FloatReg>
   <Float Name="AcquisitionFrameRate">
     <Description>CLI: fps raw / set fps</Description>
@@ -255,6 +327,7 @@ static const char k_embedded_cred2_xml[] = R"CLPXML(
     <Length>4</Length>
     <AccessMode>RW</AccessMode>
     <pPort>Device</pPort>
+    <pInvalidator>ExposureTimingCommitReg</pInvalidator>
   </FloatReg>
   <Float Name="ExposureTime">
     <Description>CLI: tint raw / set tint</Description>
@@ -347,6 +420,41 @@ static const char k_embedded_cred2_xml[] = R"CLPXML(
     <EnumEntry Name="CMOS"><Value>1</Value></EnumEntry>
   </Enumeration>
 
+  <FloatReg Name="ExposureTimingFrameRateReg">
+    <Address>0x1040</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+  </FloatReg>
+  <Float Name="ExposureTimingFrameRate">
+    <Description>Host-side: target fps applied by ExposureTimingCommit</Description>
+    <Unit>Hz</Unit>
+    <pValue>ExposureTimingFrameRateReg</pValue>
+  </Float>
+
+  <FloatReg Name="ExposureTimingExposureTimeReg">
+    <Address>0x1044</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+  </FloatReg>
+  <Float Name="ExposureTimingExposureTime">
+    <Description>Host-side: target tint applied by ExposureTimingCommit</Description>
+    <Unit>us</Unit>
+    <pValue>ExposureTimingExposureTimeReg</pValue>
+  </Float>
+
+  <IntReg Name="ExposureTimingCommitReg">
+    <Address>0x1048</Address>
+    <Length>4</Length>
+    <AccessMode>WO</AccessMode>
+    <pPort>Device</pPort>
+  </IntReg>
+  <Command Name="ExposureTimingCommit">
+    <Description>CLI: set fps and set tint in one pipelined write; fps goes first when the target tint exceeds the current maxtint</Description>
+    <pValue>ExposureTimingCommitReg</pValue>
+  </Command>
+
   <Category Name="AnalogControl">
     <pFeature>VrefAdjustEnable</pFeature>
     <pFeature>TcdsAdjustEnable</pFeature>
@@ -395,6 +503,10 @@ static const char k_embedded_cred2_xml[] = R"CLPXML(
     <pFeature>OffsetY</pFeature>
     <pFeature>Width</pFeature>
     <pFeature>Height</pFeature>
+    <pFeature>RoiStagedEnable</pFeature>
+    <pFeature>RoiStagedOffsetX</pFeature>
+    <pFeature>RoiStagedOffsetY</pFeature>
+    <pFeature>RoiCommit</pFeature>
     <pFeature>RawImagesEnable</pFeature>
     <pFeature>ImroReadBetweenReset</pFeature>
     <pFeature>BiasCorrectionEnable</pFeature>
@@ -408,6 +520,7 @@ static const char k_embedded_cred2_xml[] = R"CLPXML(
     <Length>4</Length>
     <AccessMode>RW</AccessMode>
     <pPort>Device</pPort>
+    <pInvalidator>RoiCommitReg</pInvalidator>
   </IntReg>
   <Boolean Name="CropEnable">
     <Description>CLI: cropping on|off</Description>
@@ -419,6 +532,7 @@ static const char k_embedded_cred2_xml[] = R"CLPXML(
     <Length>4</Length>
     <AccessMode>RW</AccessMode>
     <pPort>Device</pPort>
+    <pInvalidator>RoiCommitReg</pInvalidator>
   </IntReg>
   <Integer Name="OffsetX">
     <Description>CLI: cropping columns (0-639, step 32)</Description>
@@ -434,6 +548,7 @@ static const char k_embedded_cred2_xml[] = R"CLPXML(
     <Length>4</Length>
     <AccessMode>RW</AccessMode>
     <pPort>Device</pPort>
+    <pInvalidator>RoiCommitReg</pInvalidator>
   </IntReg>
   <Integer Name="OffsetY">
     <Description>CLI: cropping rows (0-511, step 4)</Description>
@@ -449,9 +564,15 @@ static const char k_embedded_cred2_xml[] = R"CLPXML(
     <Length>4</Length>
     <AccessMode>RO</AccessMode>
     <pPort>Device</pPort>
+    <pInvalidator>CropEnableReg</pInvalidator>
+    <pInvalidator>OffsetXReg</pInvalidator>
+    <pInvalidator>OffsetYReg</pInvalidator>
+    <pInvalidator>DeviceFactoryResetReg</pInvalidator>
+    <pInvalidator>UserSetLoadReg</pInvalidator>
+    <pInvalidator>RoiCommitReg</pInvalidator>
   </IntReg>
   <Integer Name="Width">
-    <Description>Derived from cropping or fixed sensor width</Description>
+    <Description>Derived from cropping columns when CropEnable is on, else the sensor width (640)</Description>
     <Unit>px</Unit>
     <Min>1</Min>
     <Max>640</Max>
@@ -463,15 +584,73 @@ static const char k_embedded_cred2_xml[] = R"CLPXML(
     <Length>4</Length>
     <AccessMode>RO</AccessMode>
     <pPort>Device</pPort>
+    <pInvalidator>CropEnableReg</pInvalidator>
+    <pInvalidator>OffsetXReg</pInvalidator>
+    <pInvalidator>OffsetYReg</pInvalidator>
+    <pInvalidator>DeviceFactoryResetReg</pInvalidator>
+    <pInvalidator>UserSetLoadReg</pInvalidator>
+    <pInvalidator>RoiCommitReg</pInvalidator>
   </IntReg>
   <Integer Name="Height">
-    <Description>Derived from cropping or fixed sensor height</Description>
+    <Description>Derived from cropping rows when CropEnable is on, else the sensor height (512)</Description>
     <Unit>px</Unit>
     <Min>1</Min>
     <Max>512</Max>
     <pValue>HeightReg</pValue>
   </Integer>
 
+  <IntReg Name="RoiStagedEnableReg">
+    <Address>0x1240</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+  </IntReg>
+  <Boolean Name="RoiStagedEnable">
+    <Description>Host-side: cropping on|off applied by RoiCommit</Description>
+    <pValue>RoiStagedEnableReg</pValue>
+  </Boolean>
+
+  <IntReg Name="RoiStagedOffsetXReg">
+    <Address>0x1244</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+  </IntReg>
+  <Integer Name="RoiStagedOffsetX">
+    <Description>Host-side: cropping columns applied by RoiCommit (0-639, step 32)</Description>
+    <Unit>px</Unit>
+    <Min>0</Min>
+    <Max>639</Max>
+    <Inc>32</Inc>
+    <pValue>RoiStagedOffsetXReg</pValue>
+  </Integer>
+
+  <IntReg Name="RoiStagedOffsetYReg">
+    <Address>0x1248</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+  </IntReg>
+  <Integer Name="RoiStagedOffsetY">
+    <Description>Host-side: cropping rows applied by RoiCommit (0-511, step 4)</Description>
+    <Unit>px</Unit>
+    <Min>0</Min>
+    <Max>511</Max>
+    <Inc>4</Inc>
+    <pValue>RoiStagedOffsetYReg</pValue>
+  </Integer>
+
+  <IntReg Name="RoiCommitReg">
+    <Address>0x124C</Address>
+    <Length>4</Length>
+    <AccessMode>WO</AccessMode>
+    <pPort>Device</pPort>
+  </IntReg>
+  <Command Name="RoiCommit">
+    <Description>CLI: set cropping columns, set cropping rows, set cropping on|off in one pipelined write (enable last, disable first)</Description>
+    <pValue>RoiCommitReg</pValue>
+  </Command>
+
   <IntReg Name="RawImagesEnableReg">
     <Address>0x1214</Address>
     <Length>4</Length>
@@ -840,6 +1019,452 @@ static const char k_embedded_cred2_xml[] = R"CLPXML(
     <pValue>LicenseListReg</pValue>
   </String>
 
+  <Category Name="Statistics">
+    <pFeature>StatisticsCommandSelector</pFeature>
+    <pFeature>StatisticsPhaseSelector</pFeature>
+    <pFeature>StatisticsCount</pFeature>
+    <pFeature>StatisticsLatencyMean</pFeature>
+    <pFeature>StatisticsLatencyP50</pFeature>
+    <pFeature>StatisticsLatencyP99</pFeature>
+    <pFeature>StatisticsLatencyMax</pFeature>
+    <pFeature>TransportBytesWritten</pFeature>
+    <pFeature>TransportBytesRead</pFeature>
+    <pFeature>TransportReads</pFeature>
+    <pFeature>TransportTimeouts</pFeature>
+    <pFeature>TransportErrors</pFeature>
+    <pFeature>TransportPromptResyncs</pFeature>
+    <pFeature>TransportCommands</pFeature>
+    <pFeature>TransportDrainedBytes</pFeature>
+    <pFeature>TransportResyncs</pFeature>
+    <pFeature>TransportMisalignedReplies</pFeature>
+    <pFeature>TransportWatchdogRecoveries</pFeature>
+    <pFeature>TransportWatchdogFailures</pFeature>
+    <pFeature>TransportSettingsReplayed</pFeature>
+    <pFeature>TransportEvents</pFeature>
+    <pFeature>TransportEventsDropped</pFeature>
+    <pFeature>TransportCacheInvalidations</pFeature>
+    <pFeature>TransportCoalescedReads</pFeature>
+    <pFeature>TransportCountersReset</pFeature>
+    <pFeature>TransportAcknowledgeFlush</pFeature>
+    <pFeature>TransportWatchdogEnable</pFeature>
+    <pFeature>TransportReaderEnable</pFeature>
+    <pFeature>TransportEventCacheEnable</pFeature>
+  </Category>
+
+  <IntReg Name="StatisticsCommandSelectorReg">
+    <Address>0x4000</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+  </IntReg>
+  <Enumeration Name="StatisticsCommandSelector">
+    <Description>Host-side: CLI command verb (first word of the command, or set plus the setting name for setters) the statistics refer to</Description>
+    <pValue>StatisticsCommandSelectorReg</pValue>
+    <EnumEntry Name="Other"><Value>0</Value></EnumEntry>
+    <EnumEntry Name="CameraType"><Value>1</Value></EnumEntry>
+    <EnumEntry Name="HwUid"><Value>2</Value></EnumEntry>
+    <EnumEntry Name="Version"><Value>3</Value></EnumEntry>
+    <EnumEntry Name="Status"><Value>4</Value></EnumEntry>
+    <EnumEntry Name="Led"><Value>5</Value></EnumEntry>
+    <EnumEntry Name="Fps"><Value>6</Value></EnumEntry>
+    <EnumEntry Name="MinFps"><Value>7</Value></EnumEntry>
+    <EnumEntry Name="MaxFps"><Value>8</Value></EnumEntry>
+    <EnumEntry Name="Tint"><Value>9</Value></EnumEntry>
+    <EnumEntry Name="MinTint"><Value>10</Value></EnumEntry>
+    <EnumEntry Name="MaxTint"><Value>11</Value></EnumEntry>
+    <EnumEntry Name="MaxTintItr"><Value>12</Value></EnumEntry>
+    <EnumEntry Name="TintGranularity"><Value>13</Value></EnumEntry>
+    <EnumEntry Name="ExtSynchro"><Value>14</Value></EnumEntry>
+    <EnumEntry Name="TlsyDel"><Value>15</Value></EnumEntry>
+    <EnumEntry Name="Synchronization"><Value>16</Value></EnumEntry>
+    <EnumEntry Name="VrefAdjust"><Value>17</Value></EnumEntry>
+    <EnumEntry Name="TcdsAdjust"><Value>18</Value></EnumEntry>
+    <EnumEntry Name="Sensibility"><Value>19</Value></EnumEntry>
+    <EnumEntry Name="Cropping"><Value>20</Value></EnumEntry>
+    <EnumEntry Name="RawImages"><Value>21</Value></EnumEntry>
+    <EnumEntry Name="NbReadWoReset"><Value>22</Value></EnumEntry>
+    <EnumEntry Name="Bias"><Value>23</Value></EnumEntry>
+    <EnumEntry Name="Flat"><Value>24</Value></EnumEntry>
+    <EnumEntry Name="BadPixel"><Value>25</Value></EnumEntry>
+    <EnumEntry Name="ImageTags"><Value>26</Value></EnumEntry>
+    <EnumEntry Name="Temperatures"><Value>27</Value></EnumEntry>
+    <EnumEntry Name="Events"><Value>28</Value></EnumEntry>
+    <EnumEntry Name="Power"><Value>29</Value></EnumEntry>
+    <EnumEntry Name="Fan"><Value>30</Value></EnumEntry>
+    <EnumEntry Name="Voltage"><Value>31</Value></EnumEntry>
+    <EnumEntry Name="IpAddress"><Value>32</Value></EnumEntry>
+    <EnumEntry Name="Telnet"><Value>33</Value></EnumEntry>
+    <EnumEntry Name="RemoteMaintenance"><Value>34</Value></EnumEntry>
+    <EnumEntry Name="Licenses"><Value>35</Value></EnumEntry>
+    <EnumEntry Name="Set"><Value>36</Value></EnumEntry>
+    <EnumEntry Name="Shutdown"><Value>37</Value></EnumEntry>
+    <EnumEntry Name="Continue"><Value>38</Value></EnumEntry>
+    <EnumEntry Name="RestoreFactory"><Value>39</Value></EnumEntry>
+    <EnumEntry Name="Save"><Value>40</Value></EnumEntry>
+    <EnumEntry Name="SetLed"><Value>41</Value></EnumEntry>
+    <EnumEntry Name="SetFps"><Value>42</Value></EnumEntry>
+    <EnumEntry Name="SetTint"><Value>43</Value></EnumEntry>
+    <EnumEntry Name="SetTintGranularity"><Value>44</Value></EnumEntry>
+    <EnumEntry Name="SetExtSynchro"><Value>45</Value></EnumEntry>
+    <EnumEntry Name="SetTlsyDel"><Value>46</Value></EnumEntry>
+    <EnumEntry Name="SetSynchronization"><Value>47</Value></EnumEntry>
+    <EnumEntry Name="SetVrefAdjust"><Value>48</Value></EnumEntry>
+    <EnumEntry Name="SetTcdsAdjust"><Value>49</Value></EnumEntry>
+    <EnumEntry Name="SetSensibility"><Value>50</Value></EnumEntry>
+    <EnumEntry Name="SetCropping"><Value>51</Value></EnumEntry>
+    <EnumEntry Name="SetRawImages"><Value>52</Value></EnumEntry>
+    <EnumEntry Name="SetNbReadWoReset"><Value>53</Value></EnumEntry>
+    <EnumEntry Name="SetBias"><Value>54</Value></EnumEntry>
+    <EnumEntry Name="SetFlat"><Value>55</Value></EnumEntry>
+    <EnumEntry Name="SetBadPixel"><Value>56</Value></EnumEntry>
+    <EnumEntry Name="SetImageTags"><Value>57</Value></EnumEntry>
+    <EnumEntry Name="SetPreset"><Value>58</Value></EnumEntry>
+    <EnumEntry Name="SetEvents"><Value>59</Value></EnumEntry>
+    <EnumEntry Name="SetFan"><Value>60</Value></EnumEntry>
+    <EnumEntry Name="SetVoltage"><Value>61</Value></EnumEntry>
+    <EnumEntry Name="SetIp"><Value>62</Value></EnumEntry>
+    <EnumEntry Name="SetTelnet"><Value>63</Value></EnumEntry>
+    <EnumEntry Name="SetRemoteMaintenance"><Value>64</Value></EnumEntry>
+    <EnumEntry Name="SetPassword"><Value>65</Value></EnumEntry>
+  </Enumeration>
+
+  <IntReg Name="StatisticsPhaseSelectorReg">
+    <Address>0x4004</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+  </IntReg>
+  <Enumeration Name="StatisticsPhaseSelector">
+    <Description>Host-side: transaction phase timed from the start of the serial write</Description>
+    <pValue>StatisticsPhaseSelectorReg</pValue>
+    <EnumEntry Name="Send"><Value>0</Value></EnumEntry>
+    <EnumEntry Name="FirstByte"><Value>1</Value></EnumEntry>
+    <EnumEntry Name="PromptSeen"><Value>2</Value></EnumEntry>
+  </Enumeration>
+
+  <IntReg Name="StatisticsCountReg">
+    <Address>0x4008</Address>
+    <Length>4</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="StatisticsCount">
+    <Description>Host-side: number of samples for the selected command and phase</Description>
+    <pValue>StatisticsCountReg</pValue>
+  </Integer>
+
+  <IntReg Name="StatisticsLatencyMeanReg">
+    <Address>0x400C</Address>
+    <Length>4</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="StatisticsLatencyMean">
+    <Description>Host-side: mean latency</Description>
+    <Unit>us</Unit>
+    <pValue>StatisticsLatencyMeanReg</pValue>
+  </Integer>
+
+  <IntReg Name="StatisticsLatencyP50Reg">
+    <Address>0x4010</Address>
+    <Length>4</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="StatisticsLatencyP50">
+    <Description>Host-side: median latency (log2 bucket upper bound)</Description>
+    <Unit>us</Unit>
+    <pValue>StatisticsLatencyP50Reg</pValue>
+  </Integer>
+
+  <IntReg Name="StatisticsLatencyP99Reg">
+    <Address>0x4014</Address>
+    <Length>4</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="StatisticsLatencyP99">
+    <Description>Host-side: 99th percentile latency (log2 bucket upper bound)</Description>
+    <Unit>us</Unit>
+    <pValue>StatisticsLatencyP99Reg</pValue>
+  </Integer>
+
+  <IntReg Name="StatisticsLatencyMaxReg">
+    <Address>0x4018</Address>
+    <Length>4</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="StatisticsLatencyMax">
+    <Description>Host-side: maximum latency</Description>
+    <Unit>us</Unit>
+    <pValue>StatisticsLatencyMaxReg</pValue>
+  </Integer>
+
+  <IntReg Name="TransportBytesWrittenReg">
+    <Address>0x4100</Address>
+    <Length>8</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="TransportBytesWritten">
+    <Description>Host-side: bytes written to the serial port</Description>
+    <pValue>TransportBytesWrittenReg</pValue>
+  </Integer>
+
+  <IntReg Name="TransportBytesReadReg">
+    <Address>0x4108</Address>
+    <Length>8</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="TransportBytesRead">
+    <Description>Host-side: bytes read from the serial port</Description>
+    <pValue>TransportBytesReadReg</pValue>
+  </Integer>
+
+  <IntReg Name="TransportReadsReg">
+    <Address>0x4110</Address>
+    <Length>8</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="TransportReads">
+    <Description>Host-side: serial read calls</Description>
+    <pValue>TransportReadsReg</pValue>
+  </Integer>
+
+  <IntReg Name="TransportTimeoutsReg">
+    <Address>0x4118</Address>
+    <Length>8</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="TransportTimeouts">
+    <Description>Host-side: serial reads/writes that timed out</Description>
+    <pValue>TransportTimeoutsReg</pValue>
+  </Integer>
+
+  <IntReg Name="TransportErrorsReg">
+    <Address>0x4120</Address>
+    <Length>8</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="TransportErrors">
+    <Description>Host-side: serial reads/writes that failed</Description>
+    <pValue>TransportErrorsReg</pValue>
+  </Integer>
+
+  <IntReg Name="TransportPromptResyncsReg">
+    <Address>0x4128</Address>
+    <Length>8</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="TransportPromptResyncs">
+    <Description>Host-side: replies that ended without the fli-cli&gt; prompt</Description>
+    <pValue>TransportPromptResyncsReg</pValue>
+  </Integer>
+
+  <IntReg Name="TransportCommandsReg">
+    <Address>0x4130</Address>
+    <Length>8</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="TransportCommands">
+    <Description>Host-side: CLI commands issued</Description>
+    <pValue>TransportCommandsReg</pValue>
+  </Integer>
+
+  <IntReg Name="TransportDrainedBytesReg">
+    <Address>0x4148</Address>
+    <Length>8</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="TransportDrainedBytes">
+    <Description>Host-side: stale input bytes drained before a command</Description>
+    <pValue>TransportDrainedBytesReg</pValue>
+  </Integer>
+
+  <IntReg Name="TransportResyncsReg">
+    <Address>0x4150</Address>
+    <Length>8</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="TransportResyncs">
+    <Description>Host-side: prompt handshakes after stale input or a misaligned reply</Description>
+    <pValue>TransportResyncsReg</pValue>
+  </Integer>
+
+  <IntReg Name="TransportMisalignedRepliesReg">
+    <Address>0x4158</Address>
+    <Length>8</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="TransportMisalignedReplies">
+    <Description>Host-side: replies that echoed a different command</Description>
+    <pValue>TransportMisalignedRepliesReg</pValue>
+  </Integer>
+
+  <IntReg Name="TransportWatchdogRecoveriesReg">
+    <Address>0x4168</Address>
+    <Length>8</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="TransportWatchdogRecoveries">
+    <Description>Host-side: recoveries started by the watchdog</Description>
+    <pValue>TransportWatchdogRecoveriesReg</pValue>
+  </Integer>
+
+  <IntReg Name="TransportWatchdogFailuresReg">
+    <Address>0x4170</Address>
+    <Length>8</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="TransportWatchdogFailures">
+    <Description>Host-side: watchdog recoveries that did not get the CLI back in time</Description>
+    <pValue>TransportWatchdogFailuresReg</pValue>
+  </Integer>
+
+  <IntReg Name="TransportSettingsReplayedReg">
+    <Address>0x4178</Address>
+    <Length>8</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="TransportSettingsReplayed">
+    <Description>Host-side: settings written back by the watchdog after a camera reboot</Description>
+    <pValue>TransportSettingsReplayedReg</pValue>
+  </Integer>
+
+  <IntReg Name="TransportEventsReg">
+    <Address>0x4180</Address>
+    <Length>8</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="TransportEvents">
+    <Description>Host-side: camera event lines queued for clpGetEventData</Description>
+    <pValue>TransportEventsReg</pValue>
+  </Integer>
+
+  <IntReg Name="TransportEventsDroppedReg">
+    <Address>0x4188</Address>
+    <Length>8</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="TransportEventsDropped">
+    <Description>Host-side: camera event lines dropped because the event queue was full</Description>
+    <pValue>TransportEventsDroppedReg</pValue>
+  </Integer>
+
+  <IntReg Name="TransportCacheInvalidationsReg">
+    <Address>0x4198</Address>
+    <Length>8</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="TransportCacheInvalidations">
+    <Description>Host-side: cached register values dropped because a camera event changed them</Description>
+    <pValue>TransportCacheInvalidationsReg</pValue>
+  </Integer>
+
+  <IntReg Name="TransportCoalescedReadsReg">
+    <Address>0x41A0</Address>
+    <Length>8</Length>
+    <AccessMode>RO</AccessMode>
+    <pPort>Device</pPort>
+    <Cachable>NoCache</Cachable>
+  </IntReg>
+  <Integer Name="TransportCoalescedReads">
+    <Description>Host-side: register reads answered by another thread's read of the same register</Description>
+    <pValue>TransportCoalescedReadsReg</pValue>
+  </Integer>
+
+  <IntReg Name="TransportCountersResetReg">
+    <Address>0x4140</Address>
+    <Length>4</Length>
+    <AccessMode>WO</AccessMode>
+    <pPort>Device</pPort>
+  </IntReg>
+  <Command Name="TransportCountersReset">
+    <Description>Host-side: reset the transport counters</Description>
+    <pValue>TransportCountersResetReg</pValue>
+  </Command>
+
+  <IntReg Name="TransportAcknowledgeFlushReg">
+    <Address>0x4144</Address>
+    <Length>4</Length>
+    <AccessMode>WO</AccessMode>
+    <pPort>Device</pPort>
+  </IntReg>
+  <Command Name="TransportAcknowledgeFlush">
+    <Description>Host-side: read the outstanding setter replies now; fails if the camera refused one</Description>
+    <pValue>TransportAcknowledgeFlushReg</pValue>
+  </Command>
+
+  <IntReg Name="TransportWatchdogEnableReg">
+    <Address>0x4160</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+  </IntReg>
+  <Boolean Name="TransportWatchdogEnable">
+    <Description>Host-side: recover the CLI after repeated timeouts, a faulty status or a reboot</Description>
+    <pValue>TransportWatchdogEnableReg</pValue>
+  </Boolean>
+
+  <IntReg Name="TransportReaderEnableReg">
+    <Address>0x4164</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+  </IntReg>
+  <Boolean Name="TransportReaderEnable">
+    <Description>Host-side: read the port from a background thread that separates events from command replies</Description>
+    <pValue>TransportReaderEnableReg</pValue>
+  </Boolean>
+
+  <IntReg Name="TransportEventCacheEnableReg">
+    <Address>0x4190</Address>
+    <Length>4</Length>
+    <AccessMode>RW</AccessMode>
+    <pPort>Device</pPort>
+  </IntReg>
+  <Boolean Name="TransportEventCacheEnable">
+    <Description>Host-side: keep the DeviceStatus cache until a camera event changes it instead of for 250 ms</Description>
+    <pValue>TransportEventCacheEnableReg</pValue>
+  </Boolean>
+
 </RegisterDescription>
 )CLPXML";
 
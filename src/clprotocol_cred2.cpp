@@ -2,21 +2,49 @@
 #include "clprotocol_cred2_xml.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstdarg>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <CLProtocol/ISerial.h>
 
-static std::string g_last_error = "not implemented";
+// Vector paths for the reply tokenizer. SSE2 is baseline on x86-64; AVX2 is
+// used when the compiler targets it, or picked at runtime by GCC/Clang on x86.
+// Other targets use the scalar scanner, as does a build with CLP_DISABLE_SIMD.
+#if !defined(CLP_DISABLE_SIMD) && \
+    (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define CLP_HAVE_SSE2 1
+#include <emmintrin.h>
+#if defined(__AVX2__) || ((defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__))
+#define CLP_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <locale.h>  // newlocale/strtod_l, _create_locale/_strtod_l on Windows
+#if defined(__APPLE__)
+#include <xlocale.h>
+#endif
+
+static thread_local std::string g_last_error = "not implemented";
 static char *g_xml = NULL;
 static CLUINT32 g_xml_len = 0;
-static clp_logger_t g_logger = NULL;
-static CLP_LOG_LEVEL_VALUE g_log_level = CLP_LOG_NOTSET;
+static std::atomic<clp_logger_t> g_logger(NULL);
+static std::atomic<int> g_log_level(CLP_LOG_NOTSET);
 
 #ifndef CLP_LIB_SUFFIX
 #define CLP_LIB_SUFFIX "cred2"
@@ -45,13 +73,514 @@ static const CLINT8 k_xml_version[] = "XMLVersion.1.0.0";
 
 static bool g_initialized = false;
 static CLUINT32 g_next_cookie = 1;
-static bool g_stop_probe_requested = false;
+static std::atomic<bool> g_stop_probe_requested(false);
+
+// Command verbs tracked by the latency statistics. The index is the value of the
+// StatisticsCommandSelector enumeration in C-RED2_GenApi.xml; index 0 collects
+// anything not listed here. Setters are tracked per setting ("set fps"), with
+// "set" left for any setter without an entry of its own.
+static constexpr const char *k_command_verbs[] = {
+    "other", "cameratype", "hwuid", "version", "status", "led", "fps", "minfps", "maxfps", "tint",
+    "mintint", "maxtint", "maxtintitr", "tintgranularity", "extsynchro", "tlsydel",
+    "synchronization", "vrefadjust", "tcdsadjust", "sensibility", "cropping", "rawimages",
+    "nbreadworeset", "bias", "flat", "badpixel", "imagetags", "temperatures", "events", "power",
+    "fan", "voltage", "ipaddress", "telnet", "remotemaintenance", "licenses", "set", "shutdown",
+    "continue", "restorefactory", "save",
+    "set led", "set fps", "set tint", "set tintgranularity", "set extsynchro", "set tlsydel",
+    "set synchronization", "set vrefadjust", "set tcdsadjust", "set sensibility", "set cropping",
+    "set rawimages", "set nbreadworeset", "set bias", "set flat", "set badpixel", "set imagetags",
+    "set preset", "set events", "set fan", "set voltage", "set ip", "set telnet",
+    "set remotemaintenance", "set password",
+};
+static constexpr size_t k_command_verb_count = sizeof(k_command_verbs) / sizeof(k_command_verbs[0]);
+
+static constexpr bool clp_verb_matches(const char *cmd, const char *verb) {
+  return *verb == '\0' ? (*cmd == ' ' || *cmd == '\n' || *cmd == '\0')
+                       : (*cmd == *verb && clp_verb_matches(cmd + 1, verb + 1));
+}
+
+static constexpr size_t clp_verb_length(const char *verb) {
+  return *verb == '\0' ? 0 : 1 + clp_verb_length(verb + 1);
+}
+
+// Statistics index of the longest verb that cmd starts with, resolved at compile
+// time for the command table below.
+static constexpr size_t clp_command_verb_index(const char *cmd, size_t idx = 1, size_t best = 0) {
+  return idx >= k_command_verb_count
+             ? best
+             : clp_command_verb_index(
+                   cmd, idx + 1,
+                   clp_verb_matches(cmd, k_command_verbs[idx]) &&
+                           (best == 0 || clp_verb_length(k_command_verbs[idx]) > clp_verb_length(k_command_verbs[best]))
+                       ? idx
+                       : best);
+}
+
+// Every CLI command the driver sends. Queries and bare commands are encoded
+// with their "raw" suffix and newline terminator; setters hold the "set <name> "
+// prefix and get their argument and terminator appended at runtime.
+#define CLP_COMMAND_TABLE(X) \
+  X(CAMERATYPE, CLP_QUERY, "cameratype")                                   \
+  X(HWUID, CLP_QUERY, "hwuid")                                             \
+  X(VERSION_FIRMWARE, CLP_QUERY, "version firmware")                       \
+  X(VERSION_FIRMWARE_DETAILED, CLP_QUERY, "version firmware detailed")     \
+  X(VERSION_FIRMWARE_BUILD, CLP_QUERY, "version firmware build")           \
+  X(VERSION_FPGA, CLP_QUERY, "version fpga")                               \
+  X(VERSION_HARDWARE, CLP_QUERY, "version hardware")                       \
+  X(STATUS, CLP_QUERY, "status")                                           \
+  X(STATUS_DETAILED, CLP_QUERY, "status detailed")                         \
+  X(LED, CLP_QUERY, "led")                                                 \
+  X(FPS, CLP_QUERY, "fps")                                                 \
+  X(MINFPS, CLP_QUERY, "minfps")                                           \
+  X(MAXFPS, CLP_QUERY, "maxfps")                                           \
+  X(TINT, CLP_QUERY, "tint")                                               \
+  X(MINTINT, CLP_QUERY, "mintint")                                         \
+  X(MAXTINT, CLP_QUERY, "maxtint")                                         \
+  X(MAXTINTITR, CLP_QUERY, "maxtintitr")                                   \
+  X(TINTGRANULARITY, CLP_QUERY, "tintgranularity")                         \
+  X(EXTSYNCHRO, CLP_QUERY, "extsynchro")                                   \
+  X(TLSYDEL, CLP_QUERY, "tlsydel")                                         \
+  X(SYNCHRONIZATION, CLP_QUERY, "synchronization")                         \
+  X(VREFADJUST, CLP_QUERY, "vrefadjust")                                   \
+  X(TCDSADJUST, CLP_QUERY, "tcdsadjust")                                   \
+  X(SENSIBILITY, CLP_QUERY, "sensibility")                                 \
+  X(CROPPING, CLP_QUERY, "cropping")                                       \
+  X(CROPPING_COLUMNS, CLP_QUERY, "cropping columns")                       \
+  X(CROPPING_ROWS, CLP_QUERY, "cropping rows")                             \
+  X(RAWIMAGES, CLP_QUERY, "rawimages")                                     \
+  X(NBREADWORESET, CLP_QUERY, "nbreadworeset")                             \
+  X(BIAS, CLP_QUERY, "bias")                                               \
+  X(FLAT, CLP_QUERY, "flat")                                               \
+  X(BADPIXEL, CLP_QUERY, "badpixel")                                       \
+  X(IMAGETAGS, CLP_QUERY, "imagetags")                                     \
+  X(EVENTS, CLP_QUERY, "events")                                           \
+  X(FAN_MODE, CLP_QUERY, "fan mode")                                       \
+  X(FAN_SPEED, CLP_QUERY, "fan speed")                                     \
+  X(VOLTAGE_VREF, CLP_QUERY, "voltage vref")                               \
+  X(IPADDRESS, CLP_QUERY, "ipaddress")                                     \
+  X(TELNET, CLP_QUERY, "telnet")                                           \
+  X(REMOTEMAINTENANCE, CLP_QUERY, "remotemaintenance")                     \
+  X(LICENSES, CLP_PLAIN, "licenses")                                       \
+  X(TEMPERATURES, CLP_QUERY, "temperatures")                               \
+  X(TEMPERATURES_MOTHERBOARD, CLP_QUERY, "temperatures motherboard")       \
+  X(TEMPERATURES_FRONTEND, CLP_QUERY, "temperatures frontend")             \
+  X(TEMPERATURES_POWERBOARD, CLP_QUERY, "temperatures powerboard")         \
+  X(TEMPERATURES_SNAKE, CLP_QUERY, "temperatures snake")                   \
+  X(TEMPERATURES_SNAKE_SETPOINT, CLP_QUERY, "temperatures snake setpoint") \
+  X(TEMPERATURES_PELTIER, CLP_QUERY, "temperatures peltier")               \
+  X(TEMPERATURES_HEATSINK, CLP_QUERY, "temperatures heatsink")             \
+  X(POWER, CLP_QUERY, "power")                                             \
+  X(POWER_SNAKE, CLP_QUERY, "power snake")                                 \
+  X(POWER_PELTIER, CLP_QUERY, "power peltier")                             \
+  X(SHUTDOWN, CLP_PLAIN, "shutdown")                                       \
+  X(CONTINUE, CLP_PLAIN, "continue")                                       \
+  X(RESTOREFACTORY, CLP_PLAIN, "restorefactory")                           \
+  X(SET_LED, CLP_SETTER, "led")                                            \
+  X(SET_FPS, CLP_SETTER, "fps")                                            \
+  X(SET_TINT, CLP_SETTER, "tint")                                          \
+  X(SET_TINTGRANULARITY, CLP_SETTER, "tintgranularity")                    \
+  X(SET_EXTSYNCHRO, CLP_SETTER, "extsynchro")                              \
+  X(SET_TLSYDEL, CLP_SETTER, "tlsydel")                                    \
+  X(SET_SYNCHRONIZATION, CLP_SETTER, "synchronization")                    \
+  X(SET_VREFADJUST, CLP_SETTER, "vrefadjust")                              \
+  X(SET_TCDSADJUST, CLP_SETTER, "tcdsadjust")                              \
+  X(SET_SENSIBILITY, CLP_SETTER, "sensibility")                            \
+  X(SET_CROPPING, CLP_SETTER, "cropping")                                  \
+  X(SET_CROPPING_COLUMNS, CLP_SETTER, "cropping columns")                  \
+  X(SET_CROPPING_ROWS, CLP_SETTER, "cropping rows")                        \
+  X(SET_RAWIMAGES, CLP_SETTER, "rawimages")                                \
+  X(SET_NBREADWORESET, CLP_SETTER, "nbreadworeset")                        \
+  X(SET_BIAS, CLP_SETTER, "bias")                                          \
+  X(SET_FLAT, CLP_SETTER, "flat")                                          \
+  X(SET_BADPIXEL, CLP_SETTER, "badpixel")                                  \
+  X(SET_IMAGETAGS, CLP_SETTER, "imagetags")                                \
+  X(SET_PRESET, CLP_SETTER, "preset")                                      \
+  X(SAVE, CLP_PLAIN, "save")                                               \
+  X(SET_EVENTS, CLP_SETTER, "events")                                      \
+  X(SET_FAN_MODE, CLP_SETTER, "fan mode")                                  \
+  X(SET_FAN_SPEED, CLP_SETTER, "fan speed")                                \
+  X(SET_VOLTAGE_VREF, CLP_SETTER, "voltage vref")                          \
+  X(SET_IP_ADDRESS, CLP_SETTER, "ip address")                              \
+  X(SET_IP_NETMASK, CLP_SETTER, "ip netmask")                              \
+  X(SET_IP_GATEWAY, CLP_SETTER, "ip gateway")                              \
+  X(SET_IP_DNS, CLP_SETTER, "ip dns")                                      \
+  X(SET_IP_ALTERNATE_DNS, CLP_SETTER, "ip alternate-dns")                  \
+  X(SET_IP_MODE, CLP_SETTER, "ip mode")                                    \
+  X(SET_TELNET, CLP_SETTER, "telnet")                                      \
+  X(SET_REMOTEMAINTENANCE, CLP_SETTER, "remotemaintenance")                \
+  X(SET_PASSWORD, CLP_SETTER, "password")
+
+enum CommandId {
+#define CLP_COMMAND_ID(name, kind, text) CLP_CMD_##name,
+  CLP_COMMAND_TABLE(CLP_COMMAND_ID)
+#undef CLP_COMMAND_ID
+  CLP_CMD_COUNT
+};
+
+struct CommandTemplate {
+  const char *bytes;  // size bytes of command text, followed by '\n' unless takes_argument
+  size_t size;
+  size_t verb;
+  bool takes_argument;
+};
+
+#define CLP_QUERY(text) {text " raw\n", sizeof(text " raw") - 1, clp_command_verb_index(text), false}
+#define CLP_PLAIN(text) {text "\n", sizeof(text) - 1, clp_command_verb_index(text), false}
+#define CLP_SETTER(text) {"set " text " ", sizeof("set " text " ") - 1, clp_command_verb_index("set " text), true}
+
+static constexpr CommandTemplate k_commands[CLP_CMD_COUNT] = {
+#define CLP_COMMAND_TEMPLATE(name, kind, text) kind(text),
+    CLP_COMMAND_TABLE(CLP_COMMAND_TEMPLATE)
+#undef CLP_COMMAND_TEMPLATE
+};
+
+#undef CLP_QUERY
+#undef CLP_PLAIN
+#undef CLP_SETTER
+
+static_assert(clp_command_verb_index("fps raw") == 6 && clp_command_verb_index("set fps 30") == 42 &&
+                  clp_command_verb_index("set cropping columns 0-319") == 51 &&
+                  clp_command_verb_index("set password x") == 65,
+              "command verbs must match the StatisticsCommandSelector enumeration");
+
+// Phases of a transaction timed from the start of clSerialWrite.
+enum LatencyPhase {
+  CLP_PHASE_SEND = 0,
+  CLP_PHASE_FIRST_BYTE = 1,
+  CLP_PHASE_PROMPT = 2,
+  CLP_PHASE_COUNT = 3
+};
+
+// Bucket i counts samples in [2^i, 2^(i+1)) microseconds; bucket 0 also holds 0 us.
+static const size_t k_latency_buckets = 32;
+
+struct LatencyHistogram {
+  CLUINT32 buckets[k_latency_buckets];
+  uint64_t count;
+  uint64_t sum_us;
+  uint64_t max_us;
+};
+
+struct CommandStats {
+  LatencyHistogram phases[k_command_verb_count][CLP_PHASE_COUNT];
+};
+
+// Transport counters are bumped on the serial path and read from any thread, so
+// they use relaxed atomics instead of the connection's other (unsynchronized) state.
+struct TransportCounters {
+  std::atomic<uint64_t> bytes_written;
+  std::atomic<uint64_t> bytes_read;
+  std::atomic<uint64_t> reads;
+  std::atomic<uint64_t> timeouts;
+  std::atomic<uint64_t> errors;
+  std::atomic<uint64_t> prompt_resyncs;
+  std::atomic<uint64_t> commands;
+  std::atomic<uint64_t> drained_bytes;
+  std::atomic<uint64_t> resyncs;
+  std::atomic<uint64_t> misaligned_replies;
+  std::atomic<uint64_t> watchdog_recoveries;
+  std::atomic<uint64_t> watchdog_failures;
+  std::atomic<uint64_t> settings_replayed;
+  std::atomic<uint64_t> events;
+  std::atomic<uint64_t> events_dropped;
+  std::atomic<uint64_t> cache_invalidations;
+  std::atomic<uint64_t> coalesced_reads;
+};
+
+// Fixed ring of the most recent transactions per connection. Recording is a
+// bounded memcpy into preallocated slots; the text dump is only built on demand
+// (CLP_CRED2_FLIGHT_RECORDER) or when a transaction times out.
+static const size_t k_flight_recorder_entries = 32;
+static const size_t k_flight_command_size = 48;
+static const size_t k_flight_reply_size = 64;
+static const size_t k_flight_line_size = 768;  // one formatted record, bytes escaped
+
+struct FlightRecord {
+  uint64_t start_us;
+  CLUINT32 duration_us;
+  CLINT32 result;
+  CLUINT32 command_len;
+  CLUINT32 reply_len;
+  char command[k_flight_command_size];
+  char reply[k_flight_reply_size];
+};
+
+struct FlightRecorder {
+  FlightRecord records[k_flight_recorder_entries];
+  uint64_t total;
+};
+
+// Per-connection scratch space for the command path. A steady-state register
+// access builds the command in place, reads the reply into a fixed buffer and
+// parses it through views into that buffer, without touching the heap.
+static const size_t k_command_buffer_size = 256;
+static const size_t k_response_buffer_size = 4096;
+
+struct TextView {
+  const char *data;
+  size_t size;
+};
+
+struct CommandBuffer {
+  char data[k_command_buffer_size];  // one byte stays free for the '\n' terminator
+  size_t size;
+  size_t verb;
+  bool overflow;
+};
+
+struct ResponseBuffer {
+  char data[k_response_buffer_size];  // always NUL-terminated at size
+  size_t size;
+};
+
+// Setters that have been written but whose replies have not been read yet,
+// kept '\n'-separated in the order they were sent. Their replies are collected
+// before the next command that needs an answer.
+static const size_t k_max_pending_acks = 8;
+
+struct PendingAcks {
+  char data[k_command_buffer_size];
+  size_t size;
+  size_t count;
+  size_t verbs[k_max_pending_acks];     // statistics index of each setter
+  uint64_t sent_us[k_max_pending_acks];  // when each setter's write started
+};
+
+// When the replies to the pending setters were read: the first byte and the
+// prompt of each, 0 until seen. The offsets track how far the response buffer
+// has been scanned, so the replies can arrive over several reads.
+struct ReplyTimes {
+  uint64_t first_byte_us[k_max_pending_acks];
+  uint64_t prompt_us[k_max_pending_acks];
+  size_t prompts;
+  size_t reply_start;  // offset just past the last prompt
+  size_t searched;     // response size at the previous scan
+};
 
 struct DeviceState {
   CLUINT32 user_set_selector;
   CLUINT32 temperature_selector;
   CLUINT32 power_selector;
   CLUINT32 indicator_selector;
+  CLUINT32 stats_command_selector;
+  CLUINT32 stats_phase_selector;
+  CLINT32 roi_enable;  // staged by 0x1240-0x1248, applied by the 0x124C commit
+  CLINT32 roi_offset_x;
+  CLINT32 roi_offset_y;
+  float timing_fps;  // staged by 0x1040/0x1044, applied by the 0x1048 commit
+  float timing_tint;
+};
+
+// Fields of "status detailed", parsed once per refresh and served to the
+// DeviceStatus* registers until the cache ages out.
+static const uint64_t k_status_cache_ttl_us = 250000;
+
+enum StatusState {
+  CLP_STATUS_UNKNOWN,
+  CLP_STATUS_STARTING,
+  CLP_STATUS_CONFIGURING,
+  CLP_STATUS_POOR_VACUUM,
+  CLP_STATUS_FAULTY,
+  CLP_STATUS_COOLING,
+  CLP_STATUS_STANDBY,
+  CLP_STATUS_OPERATIONAL,
+  CLP_STATUS_READY,
+};
+
+enum CoolingState {
+  CLP_COOLING_UNKNOWN,
+  CLP_COOLING_OFF,
+  CLP_COOLING_ACTIVE,
+  CLP_COOLING_REGULATED,
+};
+
+struct StatusCache {
+  bool valid;
+  uint64_t refreshed_us;
+  CLINT32 state;
+  CLINT32 error_flags;
+  CLINT32 cooling_state;
+  CLINT32 uptime_s;
+};
+
+// Image size as reported by Width/Height, derived from the cropping state.
+// Dropped whenever a write may change cropping and rebuilt on the next read.
+static const CLINT32 k_sensor_width = 640;
+static const CLINT32 k_sensor_height = 512;
+
+struct GeometryCache {
+  bool valid;
+  CLINT32 width;
+  CLINT32 height;
+};
+
+// Frame-rate and exposure bounds, fetched in one batched query and kept until
+// a write that can move them. maxtint follows fps and maxfps follows tint, so
+// each half is dropped separately.
+struct TimingLimits {
+  bool fps_valid;
+  bool tint_valid;
+  float min_fps;
+  float max_fps;
+  float min_tint;
+  float max_tint;
+};
+
+// A save, restorefactory, set preset or shutdown still running on the camera.
+// Its reply accumulates in ConnectionState::response across
+// clpContinueWriteRegister calls until the prompt arrives or budget_us runs out;
+// nothing else may use the connection meanwhile.
+static const uint64_t k_save_budget_us = 10000000;
+static const uint64_t k_preset_budget_us = 10000000;
+static const uint64_t k_restorefactory_budget_us = 30000000;
+static const uint64_t k_shutdown_budget_us = 30000000;
+
+struct LongWrite {
+  bool active;
+  uint64_t started_us;
+  uint64_t budget_us;
+  ReplyTimes times;
+};
+
+// Setters the camera accepted, the last one per setting ("set <name>"), oldest
+// first. The watchdog writes them back after the camera has rebooted.
+static const size_t k_shadow_entries = 32;
+static const size_t k_shadow_command_size = 64;
+
+struct ShadowSetting {
+  char data[k_shadow_command_size];
+  size_t size;
+  size_t key_size;  // "set <name>" without the value
+};
+
+struct SettingShadow {
+  ShadowSetting entries[k_shadow_entries];
+  size_t count;
+};
+
+// Health watchdog, enabled per connection with TransportWatchdogEnable.
+static const size_t k_watchdog_missed_prompts = 3;
+static const uint64_t k_watchdog_budget_us = 3000000;
+static const CLUINT32 k_watchdog_step_ms = 1000;
+
+struct Watchdog {
+  bool enabled;
+  size_t missed_prompts;        // command replies in a row that ended without a prompt
+  uint64_t status_checked_us;   // StatusCache::refreshed_us last looked at
+  CLINT32 uptime_s;             // highest uptime seen since the last reboot, 0 if unknown
+};
+
+// Camera events (EventEnable). While events are on, lines that arrive outside
+// a transaction are queued here by the thread talking to the camera and taken
+// by clpGetEventData: one producer, one consumer, fixed slots. When the ring
+// is full the new event is dropped and counted.
+static const size_t k_event_ring_size = 64;  // power of two
+static const size_t k_event_text_size = 120;
+
+struct EventRecord {
+  uint64_t ts_us;
+  size_t size;
+  char text[k_event_text_size];
+};
+
+struct EventRing {
+  std::atomic<bool> enabled;   // "events on" was last written or read
+  std::atomic<size_t> head;    // next record to take (consumer)
+  std::atomic<size_t> tail;    // next record to fill (producer)
+  EventRecord records[k_event_ring_size];
+};
+
+// Background reader (TransportReaderEnable). While it runs it is the only
+// caller of clSerialRead on the connection: it splits the input into lines,
+// queues the ones that are events and hands the rest, with the prompts, to the
+// transaction that expects them, so an event arriving in the middle of a reply
+// does not end up in it. Input nobody expects is dropped as drained.
+static const size_t k_reader_line_size = 512;
+
+struct ReaderState {
+  std::thread *thread;
+  ISerial *serial;               // the port the reader was enabled with
+  std::atomic<bool> stop;
+  std::mutex mutex;              // guards everything below
+  std::condition_variable cv;    // signaled when a prompt arrives
+  size_t expecting;              // prompts still owed to commands already written
+  size_t prompts;                // prompts in reply not yet taken
+  uint64_t first_byte_us;        // arrival of reply.data[0]
+  ResponseBuffer reply;          // reply lines and prompts, oldest first
+  bool overflow;                 // reply was full and dropped bytes
+  char line[k_reader_line_size];  // the line being received
+  size_t line_size;
+};
+
+// Caches a camera event can make stale. The thread that sees the event only
+// marks them in ConnectionState::stale_caches; the next register access drops
+// them. With TransportEventCacheEnable, events on and the reader running, the
+// status cache is kept until an event says otherwise instead of for
+// k_status_cache_ttl_us.
+enum CacheMask {
+  CLP_CACHE_STATUS = 1u << 0,
+  CLP_CACHE_GEOMETRY = 1u << 1,
+  CLP_CACHE_FPS_LIMITS = 1u << 2,
+  CLP_CACHE_TINT_LIMITS = 1u << 3,
+  CLP_CACHE_ALL = (1u << 4) - 1,
+};
+
+// Asynchronous requests (clpCred2Submit*). Each connection owns a bounded FIFO
+// and a worker thread, started by the first submit, that runs the requests
+// under engine.mutex; the synchronous entry points take the same mutex around
+// the same register functions.
+static const size_t k_async_queue_depth = 32;
+static const size_t k_completion_queue_depth = 256;
+
+struct AsyncRequest {
+  clp_cred2_request_t id;  // 0 once canceled
+  ISerial *serial;
+  CLINT64 address;
+  CLINT8 *read_buffer;
+  CLINT64 size;
+  CLUINT32 timeout;
+  bool is_write;
+  clp_cred2_completion_fn callback;
+  void *user_data;
+  CLINT8 write_data[CLP_CRED2_MAX_ASYNC_WRITE_SIZE];
+};
+
+struct AsyncEngine {
+  std::mutex mutex;  // held for the whole of each transaction
+  std::mutex queue_mutex;
+  std::condition_variable queue_cv;
+  AsyncRequest queue[k_async_queue_depth];
+  size_t head;  // next request to run
+  size_t tail;  // next free slot
+  clp_cred2_request_t running;
+  std::thread *worker;
+  bool stop;
+};
+
+// Single flight: a clpReadRegister that finds a read of the same register
+// (and buffer size) still waiting for engine.mutex joins it instead of
+// sending its own command, and gets a copy of its result. A read already on
+// the wire is not joined, so every caller sees a value read after it called.
+static const size_t k_read_flights = 8;
+static const CLINT64 k_read_flight_max_size = 64;
+
+struct ReadFlight {
+  bool active;
+  bool started;      // the leader holds engine.mutex; too late to join
+  bool done;
+  ISerial *serial;
+  CLINT64 address;
+  CLINT64 size;
+  size_t followers;  // joined readers that have not copied the result yet
+  CLINT32 rc;
+  char error[160];
+  CLINT8 data[k_read_flight_max_size];
+};
+
+struct ReadFlights {
+  std::mutex mutex;
+  std::condition_variable cv;
+  ReadFlight slots[k_read_flights];
 };
 
 struct ConnectionState {
@@ -61,9 +590,38 @@ struct ConnectionState {
   DeviceState state;
   std::string device_id;
   std::string xml_id;
+  CommandStats stats;
+  TransportCounters counters;
+  FlightRecorder flight;
+  CommandBuffer command;
+  ResponseBuffer response;
+  PendingAcks pending;
+  bool stream_dirty;  // the next command resyncs to the prompt first
+  // CLP_CRED2_CANCEL_TRANSACTION bumps the generation from any thread. It ends
+  // every transaction issued before it, including one still waiting for
+  // engine.mutex: callers read the generation before they wait and store it
+  // in cancel_ticket once they hold the mutex.
+  std::atomic<uint32_t> cancel_generation;
+  uint32_t cancel_ticket;
+  std::atomic<bool> closing;           // set by clpDisconnect/clpCloseLib; cancels every transaction
+  LongWrite long_write;
+  SettingShadow shadow;
+  Watchdog watchdog;
+  EventRing events;
+  ReaderState reader;
+  bool event_cache;                       // TransportEventCacheEnable
+  std::atomic<uint32_t> stale_caches;     // CacheMask bits set by camera events
+  StatusCache status;
+  GeometryCache geometry;
+  TimingLimits limits;
+  AsyncEngine engine;
+  ReadFlights flights;
 };
 
-static std::vector<ConnectionState> g_connections;
+// Lookups hand out a reference, so a call still using a connection keeps it
+// alive after clpDisconnect has removed it from the list.
+static std::mutex g_connections_mutex;  // guards g_connections and g_next_cookie
+static std::vector<std::shared_ptr<ConnectionState> > g_connections;
 
 static CLUINT32 clp_default_supported_baudrates(void) {
   return CL_BAUDRATE_9600 | CL_BAUDRATE_19200 | CL_BAUDRATE_38400 | CL_BAUDRATE_57600 |
@@ -165,18 +723,20 @@ static bool clp_matches_device_template(const std::string &template_or_device_id
   return false;
 }
 
-static ConnectionState *clp_find_connection(const CLUINT32 cookie) {
+// Callers hold g_connections_mutex.
+static std::shared_ptr<ConnectionState> clp_find_connection(const CLUINT32 cookie) {
   if (cookie == 0) {
     return NULL;
   }
   for (size_t idx = 0; idx < g_connections.size(); ++idx) {
-    if (g_connections[idx].cookie == cookie) {
-      return &g_connections[idx];
+    if (g_connections[idx]->cookie == cookie) {
+      return g_connections[idx];
     }
   }
   return NULL;
 }
 
+// Callers hold g_connections_mutex.
 static CLUINT32 clp_allocate_cookie(void) {
   for (;;) {
     if (g_next_cookie == 0) {
@@ -189,15 +749,17 @@ static CLUINT32 clp_allocate_cookie(void) {
   }
 }
 
-static CLINT32 clp_require_cookie(const CLUINT32 cookie, ConnectionState **connection = NULL) {
-  ConnectionState *state = clp_find_connection(cookie);
+static CLINT32 clp_require_cookie(const CLUINT32 cookie, std::shared_ptr<ConnectionState> *connection) {
+  std::shared_ptr<ConnectionState> state;
+  {
+    std::lock_guard<std::mutex> lock(g_connections_mutex);
+    state = clp_find_connection(cookie);
+  }
   if (!state) {
     g_last_error = "invalid cookie";
     return CL_ERR_INVALID_COOKIE;
   }
-  if (connection) {
-    *connection = state;
-  }
+  *connection = state;
   return CL_ERR_NO_ERR;
 }
 
@@ -205,33 +767,383 @@ static bool clp_is_valid_baudrate_value(const CLUINT32 baudrate) {
   return baudrate != 0 && (baudrate & (baudrate - 1)) == 0;
 }
 
-static bool clp_debug_enabled(void) {
-  const char *val = getenv("CLP_DEBUG");
-  if (!val || val[0] == '\0') {
-    return false;
+static uint64_t clp_monotonic_us(void) {
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                                   std::chrono::steady_clock::now().time_since_epoch())
+                                   .count());
+}
+
+static void clp_histogram_record(LatencyHistogram *hist, uint64_t elapsed_us) {
+  size_t bucket = 0;
+  for (uint64_t v = elapsed_us >> 1; v != 0 && bucket + 1 < k_latency_buckets; v >>= 1) {
+    ++bucket;
   }
-  return strcmp(val, "0") != 0;
+  ++hist->buckets[bucket];
+  ++hist->count;
+  hist->sum_us += elapsed_us;
+  hist->max_us = std::max(hist->max_us, elapsed_us);
 }
 
-static void clp_debugf(const char *fmt, ...) {
-  if (!clp_debug_enabled()) {
-    return;
+// Returns the upper bound of the bucket holding the requested percentile, clamped
+// to the largest sample seen so the estimate never exceeds an observed value.
+static uint64_t clp_histogram_percentile(const LatencyHistogram &hist, unsigned percent) {
+  if (hist.count == 0) {
+    return 0;
+  }
+  const uint64_t rank = (hist.count * percent + 99) / 100;
+  uint64_t seen = 0;
+  for (size_t bucket = 0; bucket < k_latency_buckets; ++bucket) {
+    seen += hist.buckets[bucket];
+    if (seen >= rank) {
+      const uint64_t upper = (uint64_t(2) << bucket) - 1;
+      return std::min(upper, hist.max_us);
+    }
+  }
+  return hist.max_us;
+}
+
+static CLINT32 clp_saturate_u32(uint64_t value) {
+  return static_cast<CLINT32>(std::min<uint64_t>(value, 0xFFFFFFFFu));
+}
+
+static void clp_count(std::atomic<uint64_t> *counter, uint64_t amount = 1) {
+  counter->fetch_add(amount, std::memory_order_relaxed);
+}
+
+static clp_cred2_transport_counters_t clp_snapshot_counters(const TransportCounters &counters) {
+  clp_cred2_transport_counters_t out;
+  out.bytes_written = static_cast<CLINT64>(counters.bytes_written.load(std::memory_order_relaxed));
+  out.bytes_read = static_cast<CLINT64>(counters.bytes_read.load(std::memory_order_relaxed));
+  out.reads = static_cast<CLINT64>(counters.reads.load(std::memory_order_relaxed));
+  out.timeouts = static_cast<CLINT64>(counters.timeouts.load(std::memory_order_relaxed));
+  out.errors = static_cast<CLINT64>(counters.errors.load(std::memory_order_relaxed));
+  out.prompt_resyncs = static_cast<CLINT64>(counters.prompt_resyncs.load(std::memory_order_relaxed));
+  out.commands = static_cast<CLINT64>(counters.commands.load(std::memory_order_relaxed));
+  out.drained_bytes = static_cast<CLINT64>(counters.drained_bytes.load(std::memory_order_relaxed));
+  out.resyncs = static_cast<CLINT64>(counters.resyncs.load(std::memory_order_relaxed));
+  out.misaligned_replies = static_cast<CLINT64>(counters.misaligned_replies.load(std::memory_order_relaxed));
+  out.watchdog_recoveries = static_cast<CLINT64>(counters.watchdog_recoveries.load(std::memory_order_relaxed));
+  out.watchdog_failures = static_cast<CLINT64>(counters.watchdog_failures.load(std::memory_order_relaxed));
+  out.settings_replayed = static_cast<CLINT64>(counters.settings_replayed.load(std::memory_order_relaxed));
+  out.events = static_cast<CLINT64>(counters.events.load(std::memory_order_relaxed));
+  out.events_dropped = static_cast<CLINT64>(counters.events_dropped.load(std::memory_order_relaxed));
+  out.cache_invalidations = static_cast<CLINT64>(counters.cache_invalidations.load(std::memory_order_relaxed));
+  out.coalesced_reads = static_cast<CLINT64>(counters.coalesced_reads.load(std::memory_order_relaxed));
+  return out;
+}
+
+static void clp_reset_counters(TransportCounters *counters) {
+  counters->bytes_written.store(0, std::memory_order_relaxed);
+  counters->bytes_read.store(0, std::memory_order_relaxed);
+  counters->reads.store(0, std::memory_order_relaxed);
+  counters->timeouts.store(0, std::memory_order_relaxed);
+  counters->errors.store(0, std::memory_order_relaxed);
+  counters->prompt_resyncs.store(0, std::memory_order_relaxed);
+  counters->commands.store(0, std::memory_order_relaxed);
+  counters->drained_bytes.store(0, std::memory_order_relaxed);
+  counters->resyncs.store(0, std::memory_order_relaxed);
+  counters->misaligned_replies.store(0, std::memory_order_relaxed);
+  counters->watchdog_recoveries.store(0, std::memory_order_relaxed);
+  counters->watchdog_failures.store(0, std::memory_order_relaxed);
+  counters->settings_replayed.store(0, std::memory_order_relaxed);
+  counters->events.store(0, std::memory_order_relaxed);
+  counters->events_dropped.store(0, std::memory_order_relaxed);
+  counters->cache_invalidations.store(0, std::memory_order_relaxed);
+  counters->coalesced_reads.store(0, std::memory_order_relaxed);
+}
+
+// Logging: call sites test a single atomic threshold (CLP_LOG) and only then
+// format a record into a fixed ring. A sink thread started by clpInitLib drains
+// the ring to stderr (when CLP_DEBUG was set at clpInitLib) and to g_logger
+// (filtered by g_log_level). Records are single lines of key=value fields.
+static const int k_log_disabled = -1;
+static const size_t k_log_ring_size = 256;  // power of two
+static const size_t k_log_text_size = 224;
+
+struct LogRecord {
+  std::atomic<size_t> sequence;
+  int level;
+  CLUINT32 cookie;
+  uint64_t timestamp_us;
+  const char *event;
+  char text[k_log_text_size];
+};
+
+static LogRecord g_log_ring[k_log_ring_size];
+static std::atomic<size_t> g_log_head(0);
+static std::atomic<size_t> g_log_tail(0);
+static std::atomic<bool> g_log_ring_ready(false);
+static std::atomic<uint64_t> g_log_dropped(0);
+static std::atomic<int> g_log_threshold(k_log_disabled);
+static int g_stderr_log_level = k_log_disabled;
+
+static std::thread *g_log_sink = NULL;
+static std::atomic<bool> g_log_sink_running(false);
+static std::mutex g_log_sink_mutex;
+static std::condition_variable g_log_sink_cv;
+static std::atomic<bool> g_log_sink_idle(false);
+static bool g_log_sink_stop = false;
+
+#define CLP_LOG(level, cookie, event, ...)                                      \
+  do {                                                                          \
+    if ((level) <= g_log_threshold.load(std::memory_order_relaxed)) {           \
+      clp_log_record((level), (cookie), (event), __VA_ARGS__);                  \
+    }                                                                           \
+  } while (0)
+
+static void clp_log_reset_ring(void) {
+  for (size_t idx = 0; idx < k_log_ring_size; ++idx) {
+    g_log_ring[idx].sequence.store(idx, std::memory_order_relaxed);
+  }
+  g_log_head.store(0, std::memory_order_relaxed);
+  g_log_tail.store(0, std::memory_order_relaxed);
+  g_log_ring_ready.store(true, std::memory_order_release);
+}
+
+static void clp_update_log_threshold(void) {
+  int threshold = g_stderr_log_level;
+  if (g_logger.load()) {
+    threshold = std::max(threshold, g_log_level.load());
   }
+  if (threshold != k_log_disabled && !g_log_ring_ready.load(std::memory_order_acquire)) {
+    clp_log_reset_ring();
+  }
+  g_log_threshold.store(threshold, std::memory_order_relaxed);
+}
+
+static const char *clp_log_level_name(int level) {
+  if (level <= CLP_LOG_FATAL) return "fatal";
+  if (level <= CLP_LOG_ALERT) return "alert";
+  if (level <= CLP_LOG_CRIT) return "crit";
+  if (level <= CLP_LOG_ERROR) return "error";
+  if (level <= CLP_LOG_WARN) return "warn";
+  if (level <= CLP_LOG_NOTICE) return "notice";
+  if (level <= CLP_LOG_INFO) return "info";
+  return "debug";
+}
+
+static void clp_forward_to_logger(clp_logger_t logger, int level, const char *fmt, ...) {
   va_list args;
   va_start(args, fmt);
-  vfprintf(stderr, fmt, args);
-  fprintf(stderr, "\n");
+  logger(level, fmt, args);
   va_end(args);
 }
 
-static void clp_logf(CLP_LOG_LEVEL_VALUE level, const char *fmt, ...) {
-  if (!g_logger || level > g_log_level) {
-    return;
+static void clp_log_emit_text(int level, CLUINT32 cookie, uint64_t timestamp_us, const char *event,
+                              const char *text) {
+  char line[k_flight_line_size + 96];
+  std::snprintf(line, sizeof(line), "ts_us=%llu level=%s cookie=%u event=%s %s",
+                static_cast<unsigned long long>(timestamp_us), clp_log_level_name(level), cookie, event, text);
+  if (level <= g_stderr_log_level) {
+    fprintf(stderr, "%s\n", line);
   }
+  const clp_logger_t logger = g_logger.load();
+  if (logger && level <= g_log_level.load()) {
+    clp_forward_to_logger(logger, level, "%s", line);
+  }
+}
+
+static void clp_log_emit(const LogRecord &record) {
+  clp_log_emit_text(record.level, record.cookie, record.timestamp_us, record.event, record.text);
+}
+
+// Single consumer: the sink thread, or the logging thread itself while no sink runs.
+static void clp_log_drain(void) {
+  for (;;) {
+    const size_t tail = g_log_tail.load(std::memory_order_relaxed);
+    LogRecord &record = g_log_ring[tail & (k_log_ring_size - 1)];
+    if (record.sequence.load(std::memory_order_acquire) != tail + 1) {
+      break;
+    }
+    clp_log_emit(record);
+    record.sequence.store(tail + k_log_ring_size, std::memory_order_release);
+    g_log_tail.store(tail + 1, std::memory_order_relaxed);
+  }
+  const uint64_t dropped = g_log_dropped.exchange(0, std::memory_order_relaxed);
+  if (dropped != 0) {
+    LogRecord notice;
+    notice.level = CLP_LOG_WARN;
+    notice.cookie = 0;
+    notice.timestamp_us = clp_monotonic_us();
+    notice.event = "log_overflow";
+    std::snprintf(notice.text, sizeof(notice.text), "dropped=%llu",
+                  static_cast<unsigned long long>(dropped));
+    clp_log_emit(notice);
+  }
+}
+
+static void clp_log_record(int level, CLUINT32 cookie, const char *event, const char *fmt, ...) {
+  // Multi-producer slot claim on a bounded sequence ring; a full ring drops the record.
+  size_t head = g_log_head.load(std::memory_order_relaxed);
+  LogRecord *record = NULL;
+  for (;;) {
+    record = &g_log_ring[head & (k_log_ring_size - 1)];
+    const size_t sequence = record->sequence.load(std::memory_order_acquire);
+    const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(head);
+    if (diff == 0) {
+      if (g_log_head.compare_exchange_weak(head, head + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      g_log_dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      head = g_log_head.load(std::memory_order_relaxed);
+    }
+  }
+
+  record->level = level;
+  record->cookie = cookie;
+  record->timestamp_us = clp_monotonic_us();
+  record->event = event;
   va_list args;
   va_start(args, fmt);
-  g_logger(level, fmt, args);
+  std::vsnprintf(record->text, sizeof(record->text), fmt, args);
   va_end(args);
+  record->sequence.store(head + 1, std::memory_order_release);
+
+  if (!g_log_sink_running.load(std::memory_order_acquire)) {
+    std::lock_guard<std::mutex> lock(g_log_sink_mutex);
+    clp_log_drain();
+  } else if (g_log_sink_idle.load(std::memory_order_relaxed)) {
+    g_log_sink_cv.notify_one();
+  }
+}
+
+static void clp_log_sink_main(void) {
+  std::unique_lock<std::mutex> lock(g_log_sink_mutex);
+  for (;;) {
+    clp_log_drain();
+    if (g_log_sink_stop) {
+      break;
+    }
+    g_log_sink_idle.store(true, std::memory_order_relaxed);
+    g_log_sink_cv.wait_for(lock, std::chrono::milliseconds(50));
+    g_log_sink_idle.store(false, std::memory_order_relaxed);
+  }
+}
+
+static void clp_log_start(void) {
+  const char *val = getenv("CLP_DEBUG");
+  const bool debug = val && val[0] != '\0' && strcmp(val, "0") != 0;
+  g_stderr_log_level = debug ? CLP_LOG_DEBUG : k_log_disabled;
+  clp_update_log_threshold();
+  if (!g_log_sink) {
+    g_log_sink_stop = false;
+    g_log_sink = new std::thread(clp_log_sink_main);
+    g_log_sink_running.store(true, std::memory_order_release);
+  }
+}
+
+static void clp_log_stop(void) {
+  if (g_log_sink) {
+    g_log_sink_running.store(false, std::memory_order_release);
+    {
+      std::lock_guard<std::mutex> lock(g_log_sink_mutex);
+      g_log_sink_stop = true;
+    }
+    g_log_sink_cv.notify_one();
+    g_log_sink->join();
+    delete g_log_sink;
+    g_log_sink = NULL;
+  }
+  g_stderr_log_level = k_log_disabled;
+  clp_update_log_threshold();
+}
+
+static void clp_flight_record(FlightRecorder *flight, const char *cmd, size_t cmd_len, const char *reply,
+                              size_t reply_len, CLINT32 result, uint64_t start_us) {
+  FlightRecord &record = flight->records[flight->total % k_flight_recorder_entries];
+  record.start_us = start_us;
+  record.duration_us = static_cast<CLUINT32>(std::min<uint64_t>(clp_monotonic_us() - start_us, 0xFFFFFFFFu));
+  record.result = result;
+  record.command_len = static_cast<CLUINT32>(cmd_len);
+  record.reply_len = static_cast<CLUINT32>(reply_len);
+  memcpy(record.command, cmd, std::min(cmd_len, k_flight_command_size));
+  if (reply_len > 0) {  // writes and deferred setters have no reply yet
+    memcpy(record.reply, reply, std::min(reply_len, k_flight_reply_size));
+  }
+  ++flight->total;
+}
+
+static size_t clp_escape_bytes(char *out, size_t out_size, const char *in, size_t in_len) {
+  size_t used = 0;
+  for (size_t idx = 0; idx < in_len && used + 5 < out_size; ++idx) {
+    const unsigned char c = static_cast<unsigned char>(in[idx]);
+    if (c == '\r') {
+      out[used++] = '\\';
+      out[used++] = 'r';
+    } else if (c == '\n') {
+      out[used++] = '\\';
+      out[used++] = 'n';
+    } else if (c == '"' || c == '\\') {
+      out[used++] = '\\';
+      out[used++] = static_cast<char>(c);
+    } else if (c < 0x20 || c >= 0x7F) {
+      used += static_cast<size_t>(std::snprintf(out + used, out_size - used, "\\x%02X", c));
+    } else {
+      out[used++] = static_cast<char>(c);
+    }
+  }
+  out[used] = '\0';
+  return used;
+}
+
+// Formats one line per recorded transaction, oldest first. Truncated command and
+// reply bytes are marked with "..." and the original length.
+static size_t clp_flight_format(const FlightRecord &record, uint64_t seq, char *out, size_t out_size) {
+  char command[k_flight_command_size * 4 + 1];
+  char reply[k_flight_reply_size * 4 + 1];
+  clp_escape_bytes(command, sizeof(command), record.command,
+                   std::min<size_t>(record.command_len, k_flight_command_size));
+  clp_escape_bytes(reply, sizeof(reply), record.reply, std::min<size_t>(record.reply_len, k_flight_reply_size));
+  const int written = std::snprintf(
+      out, out_size, "seq=%llu start_us=%llu dur_us=%u rc=%d cmd=\"%s%s\" cmd_len=%u reply=\"%s%s\" reply_len=%u\n",
+      static_cast<unsigned long long>(seq), static_cast<unsigned long long>(record.start_us), record.duration_us,
+      record.result, command, record.command_len > k_flight_command_size ? "..." : "", record.command_len, reply,
+      record.reply_len > k_flight_reply_size ? "..." : "", record.reply_len);
+  return written < 0 ? 0 : std::min(static_cast<size_t>(written), out_size);
+}
+
+static size_t clp_flight_dump(const FlightRecorder &flight, char *out, size_t out_size) {
+  if (!out || out_size == 0) {
+    return 0;
+  }
+  out[0] = '\0';
+  const uint64_t first = flight.total > k_flight_recorder_entries ? flight.total - k_flight_recorder_entries : 0;
+  size_t used = 0;
+  for (uint64_t seq = first; seq < flight.total; ++seq) {
+    char line[k_flight_line_size];
+    const size_t len = clp_flight_format(flight.records[seq % k_flight_recorder_entries], seq, line, sizeof(line));
+    if (used + len + 1 > out_size) {
+      break;
+    }
+    memcpy(out + used, line, len);
+    used += len;
+    out[used] = '\0';
+  }
+  return used;
+}
+
+// Flight lines are longer than a log ring record, so they bypass the ring: the
+// caller becomes the consumer, drains what is queued to keep the order, and
+// emits the lines itself.
+static void clp_flight_log(const ConnectionState &connection) {
+  if (CLP_LOG_WARN > g_log_threshold.load(std::memory_order_relaxed)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(g_log_sink_mutex);
+  clp_log_drain();
+  const FlightRecorder &flight = connection.flight;
+  const uint64_t first = flight.total > k_flight_recorder_entries ? flight.total - k_flight_recorder_entries : 0;
+  for (uint64_t seq = first; seq < flight.total; ++seq) {
+    char line[k_flight_line_size];
+    size_t len = clp_flight_format(flight.records[seq % k_flight_recorder_entries], seq, line, sizeof(line));
+    if (len > 0 && line[len - 1] == '\n') {
+      line[len - 1] = '\0';
+    }
+    clp_log_emit_text(CLP_LOG_WARN, connection.cookie, clp_monotonic_us(), "flight", line);
+  }
 }
 
 static CLINT32 clp_load_embedded_xml(void) {
@@ -289,211 +1201,2157 @@ static CLINT32 clp_load_xml(void) {
     return CL_ERR_INVALID_PTR;
   }
 
-  g_xml = (char *)malloc((size_t)len + 1);
-  if (!g_xml) {
-    fclose(fp);
-    g_last_error = "out of memory";
-    return CL_ERR_OUT_OF_MEMORY;
+  g_xml = (char *)malloc((size_t)len + 1);
+  if (!g_xml) {
+    fclose(fp);
+    g_last_error = "out of memory";
+    return CL_ERR_OUT_OF_MEMORY;
+  }
+
+  if (fread(g_xml, 1, (size_t)len, fp) != (size_t)len) {
+    fclose(fp);
+    free(g_xml);
+    g_xml = NULL;
+    g_last_error = "failed to read XML file";
+    return CL_ERR_INVALID_PTR;
+  }
+
+  g_xml[len] = '\0';
+  fclose(fp);
+  g_xml_len = (CLUINT32)len + 1;
+  return CL_ERR_NO_ERR;
+}
+
+static TextView clp_view(const char *text) {
+  TextView view = {text, strlen(text)};
+  return view;
+}
+
+static size_t clp_find_bytes(const char *haystack, size_t haystack_len, const char *needle, size_t needle_len) {
+  if (needle_len == 0 || haystack_len < needle_len) {
+    return haystack_len;
+  }
+  const char *end = haystack + haystack_len - needle_len + 1;
+  for (const char *pos = haystack; pos < end; ++pos) {
+    pos = static_cast<const char *>(memchr(pos, needle[0], static_cast<size_t>(end - pos)));
+    if (!pos) {
+      break;
+    }
+    if (memcmp(pos, needle, needle_len) == 0) {
+      return static_cast<size_t>(pos - haystack);
+    }
+  }
+  return haystack_len;
+}
+
+static void clp_cmd_append_bytes(CommandBuffer *cmd, const char *text, size_t len) {
+  if (cmd->size + len >= k_command_buffer_size) {
+    cmd->overflow = true;
+    return;
+  }
+  memcpy(cmd->data + cmd->size, text, len);
+  cmd->size += len;
+}
+
+static void clp_cmd_append(CommandBuffer *cmd, const char *text) { clp_cmd_append_bytes(cmd, text, strlen(text)); }
+
+// Copies the pre-encoded template, terminator included when it has one.
+static void clp_cmd_begin(CommandBuffer *cmd, CommandId id) {
+  const CommandTemplate &tmpl = k_commands[id];
+  memcpy(cmd->data, tmpl.bytes, tmpl.takes_argument ? tmpl.size : tmpl.size + 1);
+  cmd->size = tmpl.size;
+  cmd->verb = tmpl.verb;
+  cmd->overflow = false;
+}
+
+// Starts another command after the one being built, so that several commands
+// go out in one write (see clp_send_batch).
+static void clp_cmd_next(CommandBuffer *cmd, CommandId id) {
+  const CommandTemplate &tmpl = k_commands[id];
+  clp_cmd_append_bytes(cmd, "\n", 1);
+  clp_cmd_append_bytes(cmd, tmpl.bytes, tmpl.size);
+}
+
+static void clp_cmd_append_int(CommandBuffer *cmd, CLINT32 value) {
+  char buf[12];
+  char *pos = buf + sizeof(buf);
+  uint32_t magnitude = value < 0 ? 0u - static_cast<uint32_t>(value) : static_cast<uint32_t>(value);
+  do {
+    *--pos = static_cast<char>('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude);
+  if (value < 0) {
+    *--pos = '-';
+  }
+  clp_cmd_append_bytes(cmd, pos, static_cast<size_t>(buf + sizeof(buf) - pos));
+}
+
+static const size_t k_float_text_size = 64;  // "-0." + 45 leading zeros + 9 digits, or 39 integer digits
+static size_t clp_format_float(float value, char *out);
+
+static void clp_cmd_append_float(CommandBuffer *cmd, float value) {
+  char buf[k_float_text_size];
+  clp_cmd_append_bytes(cmd, buf, clp_format_float(value, buf));
+}
+
+static const char k_cli_prompt[] = "fli-cli>";
+static const size_t k_cli_prompt_len = sizeof(k_cli_prompt) - 1;
+
+static bool clp_is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+static TextView clp_trim_response(const char *data, size_t size) {
+  size_t end = clp_find_bytes(data, size, k_cli_prompt, k_cli_prompt_len);
+  while (end > 0 && (data[end - 1] == '\r' || data[end - 1] == '\n' || data[end - 1] == ' ' || data[end - 1] == '\t')) {
+    --end;
+  }
+  size_t start = 0;
+  while (start < end && (data[start] == '\r' || data[start] == '\n' || data[start] == ' ' || data[start] == '\t')) {
+    ++start;
+  }
+  TextView view = {data + start, end - start};
+  return view;
+}
+
+// Reads wait at most this long at a time, so that a cancellation request is
+// seen within one quantum however long the caller's timeout is. A timeout of
+// T ms allows T / quantum + 1 reads that time out, and no more than T ms of
+// waiting. Past T, reads only poll, until one comes back empty, so a timeout
+// of 0 still collects what the camera has already sent.
+static const CLUINT32 k_read_quantum_ms = 20;
+
+struct ReadBudget {
+  uint64_t until_us;
+  CLUINT32 quiet_reads_left;
+};
+
+static ReadBudget clp_read_budget(CLUINT32 timeout) {
+  ReadBudget budget = {clp_monotonic_us() + static_cast<uint64_t>(timeout) * 1000, timeout / k_read_quantum_ms + 1};
+  return budget;
+}
+
+// Whether the budget allows another read, and *wait_ms its timeout.
+static bool clp_read_next(ReadBudget *budget, CLUINT32 *wait_ms) {
+  if (budget->quiet_reads_left == 0) {
+    return false;
+  }
+  const uint64_t now_us = clp_monotonic_us();
+  if (now_us >= budget->until_us) {
+    budget->quiet_reads_left = 1;  // poll until a read comes back empty
+    *wait_ms = 0;
+    return true;
+  }
+  *wait_ms = static_cast<CLUINT32>(std::min<uint64_t>(k_read_quantum_ms, (budget->until_us - now_us + 999) / 1000));
+  return true;
+}
+
+static bool clp_take_cancel(ConnectionState *connection) {
+  const uint32_t generation = connection->cancel_generation.load();
+  if (!connection->closing && generation == connection->cancel_ticket) {
+    return false;
+  }
+  connection->cancel_ticket = generation;  // reported once per cancel
+  connection->stream_dirty = true;
+  g_last_error = "transaction canceled";
+  CLP_LOG(CLP_LOG_INFO, connection->cookie, "cancel", "reply_bytes=%u", static_cast<unsigned>(connection->response.size));
+  return true;
+}
+
+static bool clp_reader_active(const ConnectionState &connection) { return connection.reader.thread != NULL; }
+
+// Tells the reader that a command about to be written is owed prompts more
+// prompts, so that the lines ahead of them are taken as its reply.
+static void clp_reader_expect(ConnectionState *connection, size_t prompts) {
+  if (!clp_reader_active(*connection)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(connection->reader.mutex);
+  connection->reader.expecting += prompts;
+}
+
+// Takes back clp_reader_expect for a command that was never written.
+static void clp_reader_unexpect(ConnectionState *connection, size_t prompts) {
+  if (!clp_reader_active(*connection)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(connection->reader.mutex);
+  connection->reader.expecting -= std::min(connection->reader.expecting, prompts);
+}
+
+// Waits until the reader holds prompts prompts or timeout ms have passed.
+static CLINT32 clp_reader_wait(ConnectionState *connection, size_t prompts, CLUINT32 timeout) {
+  ReaderState &reader = connection->reader;
+  const uint64_t until_us = clp_monotonic_us() + static_cast<uint64_t>(timeout) * 1000;
+  std::unique_lock<std::mutex> lock(reader.mutex);
+  while (reader.prompts < prompts) {
+    if (clp_take_cancel(connection)) {
+      return CLP_CRED2_ERR_CANCELED;
+    }
+    const uint64_t now_us = clp_monotonic_us();
+    if (now_us >= until_us) {
+      break;
+    }
+    reader.cv.wait_for(lock, std::chrono::microseconds(std::min<uint64_t>(k_read_quantum_ms * 1000, until_us - now_us)));
+  }
+  return CL_ERR_NO_ERR;
+}
+
+// Appends the reader's reply up to its prompts-th prompt, or all of it when
+// fewer have arrived, to connection->response. *taken receives the prompts
+// moved; *first_byte_us, when not NULL, the arrival of the first byte moved.
+// A reply that did not fit the reader's or the response buffer is an error:
+// what the reader holds is dropped and the stream resynced.
+static CLINT32 clp_reader_take(ConnectionState *connection, size_t prompts, size_t *taken_prompts,
+                               uint64_t *first_byte_us) {
+  ReaderState &reader = connection->reader;
+  ResponseBuffer &reply = connection->response;
+  std::lock_guard<std::mutex> lock(reader.mutex);
+  ResponseBuffer &source = reader.reply;
+  size_t end = 0;
+  size_t taken = 0;
+  while (taken < prompts) {
+    const size_t found = clp_find_bytes(source.data + end, source.size - end, k_cli_prompt, k_cli_prompt_len);
+    if (found == source.size - end) {
+      end = source.size;
+      break;
+    }
+    end += found + k_cli_prompt_len;
+    ++taken;
+  }
+  if (first_byte_us) {
+    *first_byte_us = end > 0 ? reader.first_byte_us : 0;
+  }
+  const size_t copied = std::min(end, k_response_buffer_size - 1 - reply.size);
+  memcpy(reply.data + reply.size, source.data, copied);
+  reply.size += copied;
+  reply.data[reply.size] = '\0';
+  *taken_prompts = taken;
+  if (reader.overflow || copied < end) {
+    source.size = 0;
+    reader.prompts = 0;
+    reader.first_byte_us = 0;
+    reader.overflow = false;
+    connection->stream_dirty = true;
+    g_last_error = "reply does not fit the response buffer";
+    return CL_ERR_BUFFER_TOO_SMALL;
+  }
+  memmove(source.data, source.data + end, source.size - end);
+  source.size -= end;
+  reader.prompts -= taken;
+  reader.first_byte_us = source.size > 0 ? clp_monotonic_us() : 0;
+  return CL_ERR_NO_ERR;
+}
+
+// Stamps with now_us the replies in the response that have not been seen yet:
+// the first byte of the reply being read and every new prompt.
+static void clp_stamp_replies(ReplyTimes *times, const ResponseBuffer &reply, uint64_t now_us) {
+  size_t from =
+      std::max(times->reply_start, times->searched > k_cli_prompt_len ? times->searched - k_cli_prompt_len : 0);
+  times->searched = reply.size;
+  while (times->prompts < k_max_pending_acks) {
+    if (times->reply_start < reply.size && times->first_byte_us[times->prompts] == 0) {
+      times->first_byte_us[times->prompts] = now_us;
+    }
+    const size_t found = clp_find_bytes(reply.data + from, reply.size - from, k_cli_prompt, k_cli_prompt_len);
+    if (found == reply.size - from) {
+      break;
+    }
+    times->prompt_us[times->prompts++] = now_us;
+    from += found + k_cli_prompt_len;
+    times->reply_start = from;
+  }
+}
+
+// Reads into connection->response until expected_prompts CLI prompts have
+// arrived or timeout ms have passed. hist, when not NULL, receives the
+// first-byte and prompt latencies measured from start_us; times, when not
+// NULL, receives when each reply arrived.
+static CLINT32 clp_read_prompts(ConnectionState *connection, ISerial *serial, CLUINT32 timeout,
+                                size_t expected_prompts, uint64_t start_us, LatencyHistogram *hist,
+                                bool *prompt_seen, ReplyTimes *times = NULL) {
+  TransportCounters &counters = connection->counters;
+  ResponseBuffer &reply = connection->response;
+  reply.size = 0;
+  reply.data[0] = '\0';
+  *prompt_seen = false;
+  bool first_byte_seen = false;
+  size_t prompts = 0;
+  size_t scanned = 0;  // replies before this offset have been counted
+  if (clp_reader_active(*connection)) {
+    const CLINT32 rc = clp_reader_wait(connection, expected_prompts, timeout);
+    uint64_t first_byte_us = 0;
+    const CLINT32 take_rc = clp_reader_take(connection, expected_prompts, &prompts, &first_byte_us);
+    if (rc != CL_ERR_NO_ERR) {
+      return rc;
+    }
+    if (take_rc != CL_ERR_NO_ERR) {
+      return take_rc;
+    }
+    if (hist && first_byte_us != 0) {
+      clp_histogram_record(&hist[CLP_PHASE_FIRST_BYTE], first_byte_us > start_us ? first_byte_us - start_us : 0);
+    }
+    if (times) {
+      clp_stamp_replies(times, reply, clp_monotonic_us());
+      if (first_byte_us != 0) {
+        times->first_byte_us[0] = first_byte_us;
+      }
+    }
+    *prompt_seen = prompts == expected_prompts;
+    if (*prompt_seen && hist) {
+      clp_histogram_record(&hist[CLP_PHASE_PROMPT], clp_monotonic_us() - start_us);
+    }
+    return CL_ERR_NO_ERR;
+  }
+  ReadBudget budget = clp_read_budget(timeout);
+  for (;;) {
+    if (clp_take_cancel(connection)) {
+      reply.data[reply.size] = '\0';
+      return CLP_CRED2_ERR_CANCELED;
+    }
+    CLUINT32 wait_ms = 0;
+    CLUINT32 read_size = static_cast<CLUINT32>(std::min<size_t>(256, k_response_buffer_size - 1 - reply.size));
+    if (read_size == 0 || !clp_read_next(&budget, &wait_ms)) {
+      break;
+    }
+    CLINT32 rc = serial->clSerialRead(reply.data + reply.size, &read_size, wait_ms);
+    clp_count(&counters.reads);
+    if (rc == CL_ERR_TIMEOUT) {
+      clp_count(&counters.timeouts);
+      --budget.quiet_reads_left;
+      continue;
+    }
+    if (rc != CL_ERR_NO_ERR) {
+      clp_count(&counters.errors);
+      reply.data[reply.size] = '\0';
+      return rc;
+    }
+    if (read_size == 0) {
+      --budget.quiet_reads_left;
+      continue;
+    }
+    clp_count(&counters.bytes_read, read_size);
+    if (!first_byte_seen) {
+      if (hist) {
+        clp_histogram_record(&hist[CLP_PHASE_FIRST_BYTE], clp_monotonic_us() - start_us);
+      }
+      first_byte_seen = true;
+    }
+    // Only the new bytes (plus a prompt-sized overlap) need to be searched.
+    size_t search_from = std::max(scanned, reply.size > k_cli_prompt_len ? reply.size - k_cli_prompt_len : 0);
+    reply.size += read_size;
+    if (times) {
+      clp_stamp_replies(times, reply, clp_monotonic_us());
+    }
+    for (;;) {
+      const size_t found =
+          clp_find_bytes(reply.data + search_from, reply.size - search_from, k_cli_prompt, k_cli_prompt_len);
+      if (found == reply.size - search_from) {
+        break;
+      }
+      search_from += found + k_cli_prompt_len;
+      scanned = search_from;
+      if (++prompts == expected_prompts) {
+        *prompt_seen = true;
+        break;
+      }
+    }
+    if (*prompt_seen) {
+      if (hist) {
+        clp_histogram_record(&hist[CLP_PHASE_PROMPT], clp_monotonic_us() - start_us);
+      }
+      break;
+    }
+  }
+  reply.data[reply.size] = '\0';
+  return CL_ERR_NO_ERR;
+}
+
+// A reply the CLI uses to refuse a command: a line that reads "Error" or starts
+// with "Error:" in any case. Status text such as "errors: 0" or "no error" is
+// not a refusal.
+static bool clp_reply_is_error(const TextView &reply) {
+  static const char k_error[] = "error";
+  const size_t len = sizeof(k_error) - 1;
+  size_t pos = 0;
+  while (pos < reply.size) {
+    while (pos < reply.size && clp_is_blank(reply.data[pos])) {
+      ++pos;
+    }
+    size_t idx = 0;
+    while (idx < len && pos + idx < reply.size && (reply.data[pos + idx] | 0x20) == k_error[idx]) {
+      ++idx;
+    }
+    if (idx == len) {
+      size_t next = pos + len;
+      while (next < reply.size && clp_is_blank(reply.data[next])) {
+        ++next;
+      }
+      if (next == reply.size || reply.data[next] == ':' || reply.data[next] == '\n') {
+        return true;
+      }
+    }
+    const char *line_end = static_cast<const char *>(memchr(reply.data + pos, '\n', reply.size - pos));
+    if (!line_end) {
+      break;
+    }
+    pos = static_cast<size_t>(line_end - reply.data) + 1;
+  }
+  return false;
+}
+
+// Splits connection->response into count prompt-terminated replies to the
+// '\n'-separated commands and checks each one. The first missing or refused
+// reply is reported in g_last_error. When answers is not NULL it receives the
+// trimmed replies.
+static CLINT32 clp_check_replies(const ConnectionState &connection, const char *commands, size_t commands_size,
+                                 size_t count, TextView *answers) {
+  const ResponseBuffer &reply = connection.response;
+  size_t reply_pos = 0;
+  size_t command_pos = 0;
+  for (size_t idx = 0; idx < count; ++idx) {
+    const size_t prompt = clp_find_bytes(reply.data + reply_pos, reply.size - reply_pos, k_cli_prompt, k_cli_prompt_len);
+    const char *line_end = static_cast<const char *>(memchr(commands + command_pos, '\n', commands_size - command_pos));
+    const size_t command_len = line_end ? static_cast<size_t>(line_end - commands) - command_pos
+                                        : commands_size - command_pos;
+    if (prompt == reply.size - reply_pos) {
+      char message[160];
+      std::snprintf(message, sizeof(message), "no reply to \"%.*s\" (%u of %u commands answered)",
+                    static_cast<int>(command_len), commands + command_pos, static_cast<unsigned>(idx),
+                    static_cast<unsigned>(count));
+      g_last_error = message;
+      return CL_ERR_TIMEOUT;
+    }
+    const TextView answer = clp_trim_response(reply.data + reply_pos, prompt);
+    if (clp_reply_is_error(answer)) {
+      char message[200];
+      std::snprintf(message, sizeof(message), "camera rejected \"%.*s\": %.*s", static_cast<int>(command_len),
+                    commands + command_pos, static_cast<int>(std::min<size_t>(answer.size, 96)), answer.data);
+      g_last_error = message;
+      return CL_ERR_PARAM_DATA_VALUE;
+    }
+    if (answers) {
+      answers[idx] = answer;
+    }
+    reply_pos += prompt + k_cli_prompt_len;
+    command_pos += command_len + 1;
+  }
+  return CL_ERR_NO_ERR;
+}
+
+static void clp_shadow_record(SettingShadow *shadow, const char *line, size_t size) {
+  size_t key_size = size;
+  while (key_size > 4 && line[key_size - 1] != ' ') {
+    --key_size;
+  }
+  if (size >= k_shadow_command_size || key_size <= 4) {
+    return;
+  }
+  --key_size;
+  size_t idx = 0;
+  while (idx < shadow->count && (shadow->entries[idx].key_size != key_size ||
+                                 memcmp(shadow->entries[idx].data, line, key_size) != 0)) {
+    ++idx;
+  }
+  if (idx == shadow->count && shadow->count == k_shadow_entries) {
+    idx = 0;  // full: forget the oldest setting
+  }
+  if (idx < shadow->count) {
+    memmove(&shadow->entries[idx], &shadow->entries[idx + 1], (shadow->count - idx - 1) * sizeof(ShadowSetting));
+    --shadow->count;
+  }
+  ShadowSetting &entry = shadow->entries[shadow->count++];
+  memcpy(entry.data, line, size);
+  entry.size = size;
+  entry.key_size = key_size;
+}
+
+// Records the setters among the '\n'-separated commands, all of which the
+// camera accepted. A factory reset leaves nothing to replay.
+static void clp_shadow_commands(ConnectionState *connection, const char *commands, size_t size) {
+  static const char k_restorefactory[] = "restorefactory";
+  size_t pos = 0;
+  while (pos < size) {
+    const char *end = static_cast<const char *>(memchr(commands + pos, '\n', size - pos));
+    const size_t line_size = end ? static_cast<size_t>(end - commands) - pos : size - pos;
+    if (line_size > 4 && memcmp(commands + pos, "set ", 4) == 0) {
+      clp_shadow_record(&connection->shadow, commands + pos, line_size);
+    } else if (line_size == sizeof(k_restorefactory) - 1 && memcmp(commands + pos, k_restorefactory, line_size) == 0) {
+      connection->shadow.count = 0;
+    }
+    pos += line_size + 1;
+  }
+}
+
+// Records the first-byte and prompt latencies of the pending setters, each
+// measured from the time it was sent.
+static void clp_record_ack_latencies(ConnectionState *connection, size_t count, const ReplyTimes &times) {
+  const PendingAcks &pending = connection->pending;
+  for (size_t idx = 0; idx < count; ++idx) {
+    LatencyHistogram *hist = connection->stats.phases[pending.verbs[idx]];
+    const uint64_t sent_us = pending.sent_us[idx];
+    if (times.first_byte_us[idx] != 0) {
+      clp_histogram_record(&hist[CLP_PHASE_FIRST_BYTE], std::max(times.first_byte_us[idx], sent_us) - sent_us);
+    }
+    if (times.prompt_us[idx] != 0) {
+      clp_histogram_record(&hist[CLP_PHASE_PROMPT], std::max(times.prompt_us[idx], sent_us) - sent_us);
+    }
+  }
+}
+
+// Reads the replies to the setters in connection->pending. A refused or missing
+// acknowledgement is returned here, by the call after the write that caused it;
+// the pending list is settled either way.
+static CLINT32 clp_collect_acks(ConnectionState *connection, ISerial *serial, CLUINT32 timeout) {
+  PendingAcks &pending = connection->pending;
+  if (pending.count == 0) {
+    return CL_ERR_NO_ERR;
+  }
+  const size_t count = pending.count;
+  pending.count = 0;
+  const uint64_t start_us = clp_monotonic_us();
+  bool prompt_seen = false;
+  ReplyTimes times = {};
+  CLINT32 rc = clp_read_prompts(connection, serial, timeout, count, start_us, NULL, &prompt_seen, &times);
+  clp_record_ack_latencies(connection, count, times);
+  const ResponseBuffer &reply = connection->response;
+  if (rc == CL_ERR_NO_ERR) {
+    rc = clp_check_replies(*connection, pending.data, pending.size, count, NULL);
+  } else if (rc != CLP_CRED2_ERR_CANCELED && rc != CL_ERR_BUFFER_TOO_SMALL) {
+    g_last_error = "serial read failed";
+  }
+  clp_flight_record(&connection->flight, pending.data, pending.size - 1, reply.data, reply.size, rc, start_us);
+  if (!prompt_seen) {
+    connection->stream_dirty = true;
+    ++connection->watchdog.missed_prompts;
+    clp_count(&connection->counters.prompt_resyncs);
+    clp_flight_log(*connection);
+  } else {
+    connection->watchdog.missed_prompts = 0;
+  }
+  if (rc == CL_ERR_NO_ERR) {
+    clp_shadow_commands(connection, pending.data, pending.size - 1);
+  }
+  CLP_LOG(CLP_LOG_DEBUG, connection->cookie, "ack", "count=%u rc=%d", static_cast<unsigned>(count), rc);
+  pending.size = 0;
+  return rc;
+}
+
+// While a reply is expected, an event is told apart from it by its leading
+// "event:" or "event ".
+static bool clp_reader_is_event(const char *line, size_t size) {
+  static const char k_event[] = "event";
+  const size_t len = sizeof(k_event) - 1;
+  if (size <= len) {
+    return false;
+  }
+  for (size_t idx = 0; idx < len; ++idx) {
+    if ((line[idx] | 0x20) != k_event[idx]) {
+      return false;
+    }
+  }
+  return line[len] == ':' || line[len] == ' ';
+}
+
+// What a camera event makes stale, by its first word (after "event:" or
+// "event "). A setting change may move the status too; maxtint follows fps and
+// maxfps follows tint. Any other event drops every cache.
+struct EventCacheRule {
+  const char *word;
+  uint32_t caches;
+};
+
+static const EventCacheRule k_event_cache_rules[] = {
+    {"status", CLP_CACHE_STATUS},
+    {"state", CLP_CACHE_STATUS},
+    {"cooling", CLP_CACHE_STATUS},
+    {"fps", CLP_CACHE_STATUS | CLP_CACHE_TINT_LIMITS},
+    {"tint", CLP_CACHE_STATUS | CLP_CACHE_FPS_LIMITS},
+};
+
+static uint32_t clp_event_caches(const char *text, size_t size) {
+  size_t pos = 0;
+  if (clp_reader_is_event(text, size)) {
+    pos = 5;  // past "event"
+    while (pos < size && (text[pos] == ' ' || text[pos] == ':')) {
+      ++pos;
+    }
+  }
+  size_t end = pos;
+  while (end < size && text[end] != ' ' && text[end] != ':' && text[end] != '=') {
+    ++end;
+  }
+  for (size_t idx = 0; idx < sizeof(k_event_cache_rules) / sizeof(k_event_cache_rules[0]); ++idx) {
+    const char *word = k_event_cache_rules[idx].word;
+    size_t len = 0;
+    while (pos + len < end && word[len] != '\0' && (text[pos + len] | 0x20) == word[len]) {
+      ++len;
+    }
+    if (pos + len == end && word[len] == '\0') {
+      return k_event_cache_rules[idx].caches;
+    }
+  }
+  return CLP_CACHE_ALL;
+}
+
+// Drops the caches that events marked stale since the last register access.
+static void clp_apply_stale_caches(ConnectionState *connection) {
+  const uint32_t stale = connection->stale_caches.exchange(0);
+  if (stale == 0) {
+    return;
+  }
+  uint64_t dropped = 0;
+  if ((stale & CLP_CACHE_STATUS) && connection->status.valid) {
+    connection->status.valid = false;
+    ++dropped;
+  }
+  if ((stale & CLP_CACHE_GEOMETRY) && connection->geometry.valid) {
+    connection->geometry.valid = false;
+    ++dropped;
+  }
+  if ((stale & CLP_CACHE_FPS_LIMITS) && connection->limits.fps_valid) {
+    connection->limits.fps_valid = false;
+    ++dropped;
+  }
+  if ((stale & CLP_CACHE_TINT_LIMITS) && connection->limits.tint_valid) {
+    connection->limits.tint_valid = false;
+    ++dropped;
+  }
+  clp_count(&connection->counters.cache_invalidations, dropped);
+  CLP_LOG(CLP_LOG_DEBUG, connection->cookie, "cache_stale", "caches=0x%x dropped=%u", static_cast<unsigned>(stale),
+          static_cast<unsigned>(dropped));
+}
+
+static bool clp_event_cache_active(const ConnectionState &connection) {
+  return connection.event_cache && connection.events.enabled && clp_reader_active(connection);
+}
+
+static void clp_push_event(ConnectionState *connection, const char *text, size_t size, uint64_t ts_us) {
+  // Even an event the queue has no room for still says what changed.
+  connection->stale_caches.fetch_or(clp_event_caches(text, size));
+  EventRing &ring = connection->events;
+  const size_t tail = ring.tail.load(std::memory_order_relaxed);
+  if (tail - ring.head.load(std::memory_order_acquire) == k_event_ring_size) {
+    clp_count(&connection->counters.events_dropped);
+    return;
+  }
+  EventRecord &record = ring.records[tail & (k_event_ring_size - 1)];
+  record.ts_us = ts_us;
+  record.size = std::min(size, k_event_text_size);
+  memcpy(record.text, text, record.size);
+  ring.tail.store(tail + 1, std::memory_order_release);
+  clp_count(&connection->counters.events);
+  CLP_LOG(CLP_LOG_DEBUG, connection->cookie, "camera_event", "text=\"%.*s\"", static_cast<int>(record.size),
+          record.text);
+}
+
+// Queues each non-empty line of unsolicited input as an event, leaving out CLI
+// prompts. Does nothing while events are off, or while the reader sorts them.
+static void clp_capture_events(ConnectionState *connection, const char *data, size_t size) {
+  if (!connection->events.enabled || clp_reader_active(*connection)) {
+    return;
+  }
+  const uint64_t ts_us = clp_monotonic_us();
+  size_t pos = 0;
+  while (pos < size) {
+    size_t end = pos;
+    while (end < size && data[end] != '\r' && data[end] != '\n') {
+      ++end;
+    }
+    size_t start = pos;
+    while (end - start >= k_cli_prompt_len && memcmp(data + start, k_cli_prompt, k_cli_prompt_len) == 0) {
+      start += k_cli_prompt_len;
+    }
+    while (start < end && (data[start] == ' ' || data[start] == '\t')) {
+      ++start;
+    }
+    if (start < end) {
+      clp_push_event(connection, data + start, end - start, ts_us);
+    }
+    pos = end + 1;
+  }
+}
+
+static void clp_reader_append(ReaderState *reader, const char *data, size_t size) {
+  ResponseBuffer &reply = reader->reply;
+  if (reply.size == 0 && size > 0) {
+    reader->first_byte_us = clp_monotonic_us();
+  }
+  const size_t copied = std::min(size, k_response_buffer_size - 1 - reply.size);
+  memcpy(reply.data + reply.size, data, copied);
+  reply.size += copied;
+  if (copied < size) {
+    reader->overflow = true;
+  }
+}
+
+// A complete line without its line ending; called with reader.mutex held.
+static void clp_reader_line(ConnectionState *connection, const char *line, size_t size) {
+  ReaderState &reader = connection->reader;
+  size_t start = 0;
+  while (start < size && (line[start] == ' ' || line[start] == '\t')) {
+    ++start;
+  }
+  const bool events = connection->events.enabled;
+  if (reader.expecting > 0 && !(events && clp_reader_is_event(line + start, size - start))) {
+    clp_reader_append(&reader, line, size);
+    clp_reader_append(&reader, "\r\n", 2);
+    return;
+  }
+  if (start == size) {
+    return;
+  }
+  if (events) {
+    clp_push_event(connection, line + start, size - start, clp_monotonic_us());
+  } else {
+    clp_count(&connection->counters.drained_bytes, size);
+  }
+}
+
+static void clp_reader_prompt(ConnectionState *connection) {
+  ReaderState &reader = connection->reader;
+  if (reader.expecting == 0) {
+    clp_count(&connection->counters.drained_bytes, k_cli_prompt_len);
+    return;
+  }
+  clp_reader_append(&reader, k_cli_prompt, k_cli_prompt_len);
+  --reader.expecting;
+  ++reader.prompts;
+  reader.cv.notify_all();
+}
+
+static void clp_reader_feed(ConnectionState *connection, const char *data, size_t size) {
+  ReaderState &reader = connection->reader;
+  for (size_t pos = 0; pos < size; ++pos) {
+    if (data[pos] == '\n') {
+      size_t line_size = reader.line_size;
+      if (line_size > 0 && reader.line[line_size - 1] == '\r') {
+        --line_size;
+      }
+      clp_reader_line(connection, reader.line, line_size);
+      reader.line_size = 0;
+      continue;
+    }
+    if (reader.line_size == k_reader_line_size) {
+      clp_reader_line(connection, reader.line, reader.line_size);
+      reader.line_size = 0;
+    }
+    reader.line[reader.line_size++] = data[pos];
+    // The prompt ends a reply without a line ending.
+    if (reader.line_size >= k_cli_prompt_len &&
+        memcmp(reader.line + reader.line_size - k_cli_prompt_len, k_cli_prompt, k_cli_prompt_len) == 0) {
+      if (reader.line_size > k_cli_prompt_len) {
+        clp_reader_line(connection, reader.line, reader.line_size - k_cli_prompt_len);
+      }
+      reader.line_size = 0;
+      clp_reader_prompt(connection);
+    }
+  }
+}
+
+static void clp_reader_main(ConnectionState *connection) {
+  ReaderState &reader = connection->reader;
+  TransportCounters &counters = connection->counters;
+  char chunk[256];
+  while (!reader.stop.load()) {
+    CLUINT32 read_size = sizeof(chunk);
+    const CLINT32 rc = reader.serial->clSerialRead(chunk, &read_size, k_read_quantum_ms);
+    if (rc == CL_ERR_TIMEOUT || (rc == CL_ERR_NO_ERR && read_size == 0)) {
+      continue;
+    }
+    if (rc != CL_ERR_NO_ERR) {
+      clp_count(&counters.errors);
+      std::this_thread::sleep_for(std::chrono::milliseconds(k_read_quantum_ms));
+      continue;
+    }
+    clp_count(&counters.reads);
+    clp_count(&counters.bytes_read, read_size);
+    std::lock_guard<std::mutex> lock(reader.mutex);
+    clp_reader_feed(connection, chunk, read_size);
+  }
+}
+
+static void clp_reader_start(ConnectionState *connection, ISerial *serial) {
+  ReaderState &reader = connection->reader;
+  reader.serial = serial;
+  reader.stop = false;
+  reader.thread = new std::thread(clp_reader_main, connection);
+  CLP_LOG(CLP_LOG_INFO, connection->cookie, "reader", "running=1");
+}
+
+// Joins the reader. Replies it still held are lost; the next command resyncs.
+static void clp_reader_stop(ConnectionState *connection) {
+  ReaderState &reader = connection->reader;
+  if (!reader.thread) {
+    return;
+  }
+  reader.stop = true;
+  reader.thread->join();
+  delete reader.thread;
+  reader.thread = NULL;
+  reader.serial = NULL;
+  reader.expecting = 0;
+  reader.prompts = 0;
+  reader.first_byte_us = 0;
+  reader.reply.size = 0;
+  reader.overflow = false;
+  reader.line_size = 0;
+  connection->stream_dirty = true;
+  CLP_LOG(CLP_LOG_INFO, connection->cookie, "reader", "running=0");
+}
+
+// Stale input (a reply that arrived after its timeout, an unsolicited message,
+// a reboot banner) would shift every later reply by one. Before a command the
+// input is drained without waiting; when anything was found, or the last reply
+// looked misaligned, an empty line is sent and its prompt awaited.
+static const int k_drain_reads = 16;
+
+static size_t clp_drain_input(ConnectionState *connection, ISerial *serial) {
+  TransportCounters &counters = connection->counters;
+  ResponseBuffer &scratch = connection->response;
+  size_t drained = 0;
+  scratch.size = 0;
+  if (clp_reader_active(*connection)) {
+    // The reader has sorted out the events already; what it holds for a
+    // reply is stale, and so is any prompt still owed.
+    ReaderState &reader = connection->reader;
+    std::lock_guard<std::mutex> lock(reader.mutex);
+    drained = reader.reply.size;
+    reader.reply.size = 0;
+    reader.prompts = 0;
+    reader.expecting = 0;
+    reader.first_byte_us = 0;
+  }
+  for (int attempt = 0; attempt < k_drain_reads && !clp_reader_active(*connection); ++attempt) {
+    if (scratch.size == k_response_buffer_size - 1) {
+      clp_capture_events(connection, scratch.data, scratch.size);
+      scratch.size = 0;
+    }
+    CLUINT32 read_size = static_cast<CLUINT32>(k_response_buffer_size - 1 - scratch.size);
+    const CLINT32 rc = serial->clSerialRead(scratch.data + scratch.size, &read_size, 0);
+    clp_count(&counters.reads);
+    if (rc != CL_ERR_NO_ERR || read_size == 0) {
+      break;
+    }
+    clp_count(&counters.bytes_read, read_size);
+    scratch.size += read_size;
+    drained += read_size;
+  }
+  clp_capture_events(connection, scratch.data, scratch.size);
+  scratch.size = 0;
+  scratch.data[0] = '\0';
+  if (drained > 0) {
+    clp_count(&counters.drained_bytes, drained);
+    CLP_LOG(CLP_LOG_WARN, connection->cookie, "drain", "bytes=%u", static_cast<unsigned>(drained));
+  }
+  return drained;
+}
+
+static CLINT32 clp_resync_prompt(ConnectionState *connection, ISerial *serial, CLUINT32 timeout) {
+  TransportCounters &counters = connection->counters;
+  clp_count(&counters.resyncs);
+  CLINT8 probe = '\n';
+  CLUINT32 write_size = 1;
+  clp_reader_expect(connection, 1);
+  CLINT32 rc = serial->clSerialWrite(&probe, &write_size, timeout);
+  if (rc != CL_ERR_NO_ERR) {
+    clp_reader_unexpect(connection, 1);
+    clp_count(rc == CL_ERR_TIMEOUT ? &counters.timeouts : &counters.errors);
+    g_last_error = "serial write failed";
+    return rc;
+  }
+  clp_count(&counters.bytes_written, write_size);
+  bool prompt_seen = false;
+  rc = clp_read_prompts(connection, serial, timeout, 1, clp_monotonic_us(), NULL, &prompt_seen);
+  if (rc != CL_ERR_NO_ERR) {
+    if (rc != CLP_CRED2_ERR_CANCELED && rc != CL_ERR_BUFFER_TOO_SMALL) {
+      g_last_error = "serial read failed";
+    }
+    return rc;
+  }
+  // Whatever arrived ahead of the probe's prompt was unsolicited; anything
+  // behind it is stale as well.
+  const ResponseBuffer &reply = connection->response;
+  const size_t before_prompt = clp_find_bytes(reply.data, reply.size, k_cli_prompt, k_cli_prompt_len);
+  clp_capture_events(connection, reply.data, before_prompt);
+  clp_drain_input(connection, serial);
+  connection->stream_dirty = !prompt_seen;
+  CLP_LOG(CLP_LOG_WARN, connection->cookie, "resync", "prompt=%d", prompt_seen ? 1 : 0);
+  return CL_ERR_NO_ERR;
+}
+
+// A reply line that reads like a CLI command: the camera echoing its input.
+static bool clp_looks_like_command(const TextView &line) {
+  return (line.size > 4 && memcmp(line.data, "set ", 4) == 0) ||
+         (line.size > 4 && memcmp(line.data + line.size - 4, " raw", 4) == 0);
+}
+
+// Sends connection->command and, when response is not NULL, reads the reply into
+// connection->response up to the CLI prompt. *response is the trimmed reply; it
+// stays valid until the next command on this connection. A pipelined batch
+// waits for one prompt per command and leaves all replies in the buffer.
+// Without a response the command is a setter: it returns once written and its
+// reply is collected by clp_collect_acks before the next command that reads.
+// A single reply that starts with the echo of another command is misaligned;
+// the stream is resynced and the command sent once more.
+static CLINT32 clp_send_command(ConnectionState *connection, ISerial *serial, CLUINT32 timeout,
+                                TextView *response, size_t expected_prompts = 1, bool may_retry = true) {
+  if (!serial) {
+    g_last_error = "serial interface is NULL";
+    return CL_ERR_INVALID_PTR;
+  }
+  CommandBuffer &command = connection->command;
+  if (command.overflow) {
+    g_last_error = "command too long";
+    return CL_ERR_INVALID_REFERENCE;
+  }
+  PendingAcks &pending = connection->pending;
+  if (response || pending.count == k_max_pending_acks || pending.size + command.size + 1 > sizeof(pending.data)) {
+    CLINT32 rc = clp_collect_acks(connection, serial, timeout);
+    if (rc != CL_ERR_NO_ERR) {
+      return rc;
+    }
+  }
+  if (pending.count == 0) {
+    if (clp_drain_input(connection, serial) > 0) {
+      connection->stream_dirty = true;
+    }
+    if (connection->stream_dirty) {
+      CLINT32 rc = clp_resync_prompt(connection, serial, timeout);
+      if (rc != CL_ERR_NO_ERR) {
+        return rc;
+      }
+    }
+  }
+
+  CLP_LOG(CLP_LOG_DEBUG, connection->cookie, "send", "cmd=\"%.*s\"", static_cast<int>(command.size), command.data);
+
+  LatencyHistogram *hist = connection->stats.phases[command.verb];
+  TransportCounters &counters = connection->counters;
+  clp_count(&counters.commands);
+  const uint64_t start_us = clp_monotonic_us();
+
+  command.data[command.size] = '\n';
+  CLUINT32 write_size = static_cast<CLUINT32>(command.size + 1);
+  // Raised before the write: the reply may arrive before clSerialWrite returns.
+  const size_t owed_prompts = response ? expected_prompts : 1;
+  clp_reader_expect(connection, owed_prompts);
+  CLINT32 rc = serial->clSerialWrite(command.data, &write_size, timeout);
+  if (rc != CL_ERR_NO_ERR) {
+    clp_reader_unexpect(connection, owed_prompts);
+    clp_count(rc == CL_ERR_TIMEOUT ? &counters.timeouts : &counters.errors);
+    clp_flight_record(&connection->flight, command.data, command.size, NULL, 0, rc, start_us);
+    if (rc == CL_ERR_TIMEOUT) {
+      clp_flight_log(*connection);
+    }
+    g_last_error = "serial write failed";
+    return rc;
+  }
+  clp_count(&counters.bytes_written, write_size);
+  clp_histogram_record(&hist[CLP_PHASE_SEND], clp_monotonic_us() - start_us);
+
+  if (!response) {
+    memcpy(pending.data + pending.size, command.data, command.size + 1);
+    pending.size += command.size + 1;
+    pending.verbs[pending.count] = command.verb;
+    pending.sent_us[pending.count] = start_us;
+    ++pending.count;
+    clp_flight_record(&connection->flight, command.data, command.size, NULL, 0, CL_ERR_NO_ERR, start_us);
+    return CL_ERR_NO_ERR;
+  }
+
+  bool prompt_seen = false;
+  rc = clp_read_prompts(connection, serial, timeout, expected_prompts, start_us, hist, &prompt_seen);
+  const ResponseBuffer &reply = connection->response;
+  if (rc != CL_ERR_NO_ERR) {
+    clp_flight_record(&connection->flight, command.data, command.size, reply.data, reply.size, rc, start_us);
+    if (rc != CLP_CRED2_ERR_CANCELED && rc != CL_ERR_BUFFER_TOO_SMALL) {
+      g_last_error = "serial read failed";
+    }
+    return rc;
+  }
+
+  clp_flight_record(&connection->flight, command.data, command.size, reply.data, reply.size,
+                    prompt_seen ? CL_ERR_NO_ERR : CL_ERR_TIMEOUT, start_us);
+  if (!prompt_seen) {
+    // The reply boundary was lost; whatever arrives next belongs to this command.
+    connection->stream_dirty = true;
+    ++connection->watchdog.missed_prompts;
+    clp_count(&counters.prompt_resyncs);
+    clp_flight_log(*connection);
+  } else {
+    connection->watchdog.missed_prompts = 0;
+  }
+
+  *response = clp_trim_response(reply.data, reply.size);
+  if (expected_prompts == 1) {
+    const char *line_end = response->data;
+    while (line_end < response->data + response->size && *line_end != '\r' && *line_end != '\n') {
+      ++line_end;
+    }
+    const TextView line = {response->data, static_cast<size_t>(line_end - response->data)};
+    if (line.size == command.size && memcmp(line.data, command.data, line.size) == 0) {
+      *response = clp_trim_response(line_end, response->size - line.size);
+    } else if (clp_looks_like_command(line)) {
+      clp_count(&counters.misaligned_replies);
+      connection->stream_dirty = true;
+      CLP_LOG(CLP_LOG_WARN, connection->cookie, "misaligned", "cmd=\"%.*s\" reply=\"%.*s\"",
+              static_cast<int>(command.size), command.data, static_cast<int>(line.size), line.data);
+      if (may_retry) {
+        return clp_send_command(connection, serial, timeout, response, expected_prompts, false);
+      }
+      char message[160];
+      std::snprintf(message, sizeof(message), "reply to \"%.*s\" answers \"%.*s\"", static_cast<int>(command.size),
+                    command.data, static_cast<int>(std::min<size_t>(line.size, 64)), line.data);
+      g_last_error = message;
+      return CL_ERR_INVALID_REFERENCE;
+    }
+  }
+  CLP_LOG(CLP_LOG_DEBUG, connection->cookie, "recv", "bytes=%u prompt=%d reply=\"%.*s\"",
+          static_cast<unsigned>(reply.size), prompt_seen ? 1 : 0, static_cast<int>(response->size),
+          response->data);
+  return CL_ERR_NO_ERR;
+}
+
+// Sends the count commands queued in connection->command (clp_cmd_begin, then
+// clp_cmd_next for each further one) as a single write, then reads one reply
+// per command. The camera runs them in order; the first refused command is
+// reported in g_last_error. When answers is not NULL it receives the count
+// trimmed replies, valid until the next command on this connection.
+static CLINT32 clp_send_batch(ConnectionState *connection, ISerial *serial, CLUINT32 timeout, size_t count,
+                              TextView *answers = NULL) {
+  TextView first;
+  CLINT32 rc = clp_send_command(connection, serial, timeout, &first, count);
+  if (rc != CL_ERR_NO_ERR) {
+    return rc;
+  }
+  const CommandBuffer &command = connection->command;
+  rc = clp_check_replies(*connection, command.data, command.size, count, answers);
+  if (rc == CL_ERR_NO_ERR) {
+    clp_shadow_commands(connection, command.data, command.size);
+  }
+  return rc;
+}
+
+static size_t clp_count_prompts(const ResponseBuffer &reply) {
+  size_t prompts = 0;
+  size_t pos = 0;
+  for (;;) {
+    const size_t found = clp_find_bytes(reply.data + pos, reply.size - pos, k_cli_prompt, k_cli_prompt_len);
+    if (found == reply.size - pos) {
+      return prompts;
+    }
+    ++prompts;
+    pos += found + k_cli_prompt_len;
+  }
+}
+
+// Reads more of the replies to connection->pending for up to timeout ms, after
+// what earlier calls already collected. Once every reply has its prompt, or the
+// long write's budget is spent, the pending list is settled and checked;
+// until then the result is CL_ERR_PENDING_WRITE.
+static CLINT32 clp_await_long_write(ConnectionState *connection, ISerial *serial, CLUINT32 timeout) {
+  PendingAcks &pending = connection->pending;
+  ResponseBuffer &reply = connection->response;
+  LongWrite &write = connection->long_write;
+  TransportCounters &counters = connection->counters;
+  if (clp_reader_active(*connection)) {
+    const size_t missing = pending.count - std::min(pending.count, clp_count_prompts(reply));
+    if (clp_reader_wait(connection, missing, timeout) == CLP_CRED2_ERR_CANCELED) {
+      write.active = false;
+      pending.count = 0;
+      pending.size = 0;
+      return CLP_CRED2_ERR_CANCELED;
+    }
+    size_t taken = 0;
+    const CLINT32 rc = clp_reader_take(connection, missing, &taken, NULL);
+    if (rc != CL_ERR_NO_ERR) {
+      write.active = false;
+      pending.count = 0;
+      pending.size = 0;
+      return rc;
+    }
+    clp_stamp_replies(&write.times, reply, clp_monotonic_us());
+  }
+  ReadBudget budget = clp_read_budget(timeout);
+  while (!clp_reader_active(*connection) && clp_count_prompts(reply) < pending.count) {
+    if (clp_take_cancel(connection)) {
+      write.active = false;
+      pending.count = 0;
+      pending.size = 0;
+      return CLP_CRED2_ERR_CANCELED;
+    }
+    CLUINT32 wait_ms = 0;
+    CLUINT32 read_size = static_cast<CLUINT32>(std::min<size_t>(256, k_response_buffer_size - 1 - reply.size));
+    if (read_size == 0 || !clp_read_next(&budget, &wait_ms)) {
+      break;
+    }
+    const CLINT32 rc = serial->clSerialRead(reply.data + reply.size, &read_size, wait_ms);
+    clp_count(&counters.reads);
+    if (rc == CL_ERR_TIMEOUT) {
+      clp_count(&counters.timeouts);
+      --budget.quiet_reads_left;
+      continue;
+    }
+    if (rc != CL_ERR_NO_ERR) {
+      clp_count(&counters.errors);
+      write.active = false;
+      pending.count = 0;
+      pending.size = 0;
+      connection->stream_dirty = true;
+      g_last_error = "serial read failed";
+      return rc;
+    }
+    clp_count(&counters.bytes_read, read_size);
+    reply.size += read_size;
+    reply.data[reply.size] = '\0';
+    clp_stamp_replies(&write.times, reply, clp_monotonic_us());
+  }
+  const bool complete = clp_count_prompts(reply) >= pending.count;
+  if (!complete && clp_monotonic_us() - write.started_us < write.budget_us) {
+    write.active = true;
+    return CL_ERR_PENDING_WRITE;
+  }
+  write.active = false;
+  clp_record_ack_latencies(connection, pending.count, write.times);
+  const CLINT32 rc = clp_check_replies(*connection, pending.data, pending.size, pending.count, NULL);
+  clp_flight_record(&connection->flight, pending.data, pending.size - 1, reply.data, reply.size, rc,
+                    write.started_us);
+  if (!complete) {
+    connection->stream_dirty = true;
+    ++connection->watchdog.missed_prompts;
+    clp_count(&counters.prompt_resyncs);
+    clp_flight_log(*connection);
+  } else {
+    connection->watchdog.missed_prompts = 0;
+  }
+  if (rc == CL_ERR_NO_ERR) {
+    clp_shadow_commands(connection, pending.data, pending.size - 1);
+  }
+  CLP_LOG(CLP_LOG_DEBUG, connection->cookie, "long_write", "rc=%d dur_us=%u", rc,
+          static_cast<unsigned>(clp_monotonic_us() - write.started_us));
+  pending.count = 0;
+  pending.size = 0;
+  return rc;
+}
+
+// Sends connection->command, then waits for its reply like clp_await_long_write.
+static CLINT32 clp_start_long_write(ConnectionState *connection, ISerial *serial, CLUINT32 timeout,
+                                    uint64_t budget_us) {
+  CLINT32 rc = clp_send_command(connection, serial, timeout, NULL);
+  if (rc != CL_ERR_NO_ERR) {
+    return rc;
+  }
+  connection->response.size = 0;
+  connection->response.data[0] = '\0';
+  connection->long_write.started_us = clp_monotonic_us();
+  connection->long_write.budget_us = budget_us;
+  connection->long_write.times = ReplyTimes();
+  return clp_await_long_write(connection, serial, timeout);
+}
+
+static CLINT32 clp_require_idle(const ConnectionState &connection) {
+  if (connection.closing) {
+    g_last_error = "connection closed";
+    return CL_ERR_INVALID_COOKIE;
+  }
+  if (connection.long_write.active) {
+    g_last_error = "a write is pending, call clpContinueWriteRegister";
+    return CL_ERR_IN_USE;
+  }
+  return CL_ERR_NO_ERR;
+}
+
+static CLINT32 clp_write_int32(CLINT8 *pBuffer, CLINT64 buffer_size, CLINT32 value) {
+  if (!pBuffer || buffer_size < 4) {
+    return CL_ERR_BUFFER_TOO_SMALL;
+  }
+  pBuffer[0] = static_cast<CLINT8>(value & 0xFF);
+  pBuffer[1] = static_cast<CLINT8>((value >> 8) & 0xFF);
+  pBuffer[2] = static_cast<CLINT8>((value >> 16) & 0xFF);
+  pBuffer[3] = static_cast<CLINT8>((value >> 24) & 0xFF);
+  CLP_LOG(CLP_LOG_DEBUG, 0, "value", "type=int32 value=%d", value);
+  return CL_ERR_NO_ERR;
+}
+
+static CLINT32 clp_write_int64(CLINT8 *pBuffer, CLINT64 buffer_size, CLINT64 value) {
+  if (!pBuffer || buffer_size < 8) {
+    return CL_ERR_BUFFER_TOO_SMALL;
+  }
+  const uint64_t bits = static_cast<uint64_t>(value);
+  for (int idx = 0; idx < 8; ++idx) {
+    pBuffer[idx] = static_cast<CLINT8>((bits >> (8 * idx)) & 0xFF);
+  }
+  return CL_ERR_NO_ERR;
+}
+
+static CLINT32 clp_write_float32(CLINT8 *pBuffer, CLINT64 buffer_size, float value) {
+  if (!pBuffer || buffer_size < 4) {
+    return CL_ERR_BUFFER_TOO_SMALL;
+  }
+  uint32_t bits = 0;
+  static_assert(sizeof(float) == sizeof(uint32_t), "float size unexpected");
+  memcpy(&bits, &value, sizeof(bits));
+  CLP_LOG(CLP_LOG_DEBUG, 0, "value", "type=float32 value=%.6f", value);
+  return clp_write_int32(pBuffer, buffer_size, static_cast<CLINT32>(bits));
+}
+
+static CLINT32 clp_read_int32(const CLINT8 *pBuffer, CLINT64 buffer_size, CLINT32 *value) {
+  if (!pBuffer || buffer_size < 4 || !value) {
+    return CL_ERR_BUFFER_TOO_SMALL;
+  }
+  uint32_t v = static_cast<uint8_t>(pBuffer[0]) |
+               (static_cast<uint8_t>(pBuffer[1]) << 8) |
+               (static_cast<uint8_t>(pBuffer[2]) << 16) |
+               (static_cast<uint8_t>(pBuffer[3]) << 24);
+  *value = static_cast<CLINT32>(v);
+  return CL_ERR_NO_ERR;
+}
+
+static CLINT32 clp_read_float32(const CLINT8 *pBuffer, CLINT64 buffer_size, float *value) {
+  CLINT32 tmp = 0;
+  CLINT32 rc = clp_read_int32(pBuffer, buffer_size, &tmp);
+  if (rc != CL_ERR_NO_ERR) {
+    return rc;
+  }
+  uint32_t bits = static_cast<uint32_t>(tmp);
+  float f = 0.0f;
+  memcpy(&f, &bits, sizeof(f));
+  *value = f;
+  return CL_ERR_NO_ERR;
+}
+
+static void clp_write_string(CLINT8 *pBuffer, CLINT64 buffer_size, const TextView &value) {
+  if (!pBuffer || buffer_size <= 0) {
+    return;
+  }
+  memset(pBuffer, 0, static_cast<size_t>(buffer_size));
+  const size_t copy_len = std::min(static_cast<size_t>(buffer_size - 1), value.size);
+  memcpy(pBuffer, value.data, copy_len);
+}
+
+// Numbers as the camera prints them: optional sign, digits with an optional
+// fraction, an optional exponent and an optional unit ("12.5 ms", "-40C",
+// "85%"). Parsing never consults the C locale and never allocates. On failure
+// *error_offset is the index of the first byte that does not fit the format.
+static const size_t k_number_max_digits = 19;  // decimal digits that always fit a uint64_t
+static const size_t k_number_fallback_size = 128;
+
+static const double k_exact_powers_of_ten[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                               1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                               1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static bool clp_is_digit(char c) { return c >= '0' && c <= '9'; }
+
+static bool clp_is_unit_char(char c) {
+  const unsigned char u = static_cast<unsigned char>(c);
+  return (u >= 'a' && u <= 'z') || (u >= 'A' && u <= 'Z') || u == '%' || u == '/' || u >= 0x80;
+}
+
+// The "C" locale for the fallback parser, created once and kept for the life of
+// the process. NULL if the platform could not create it.
+#if defined(_WIN32)
+static _locale_t clp_c_numeric_locale(void) {
+  static const _locale_t locale = _create_locale(LC_NUMERIC, "C");
+  return locale;
+}
+#else
+static locale_t clp_c_numeric_locale(void) {
+  static const locale_t locale = newlocale(LC_NUMERIC_MASK, "C", static_cast<locale_t>(0));
+  return locale;
+}
+#endif
+
+// Slow path for mantissas longer than k_number_max_digits or exponents outside
+// the exact range: strtod_l on a NUL-terminated stack copy, in the "C" locale so
+// neither the process locale nor a concurrent setlocale affects the result.
+static bool clp_parse_number_fallback(const char *data, size_t size, double *out) {
+  char buf[k_number_fallback_size];
+  if (size >= sizeof(buf)) {
+    return false;
+  }
+  if (!clp_c_numeric_locale()) {
+    return false;
+  }
+  memcpy(buf, data, size);
+  buf[size] = '\0';
+  char *end = NULL;
+#if defined(_WIN32)
+  *out = _strtod_l(buf, &end, clp_c_numeric_locale());
+#else
+  *out = strtod_l(buf, &end, clp_c_numeric_locale());
+#endif
+  return end == buf + size;
+}
+
+static bool clp_parse_number(const TextView &text, double *out, size_t *error_offset) {
+  const char *data = text.data;
+  const size_t size = text.size;
+  size_t pos = 0;
+  while (pos < size && (data[pos] == ' ' || data[pos] == '\t')) {
+    ++pos;
+  }
+  const size_t start = pos;
+  bool negative = false;
+  if (pos < size && (data[pos] == '+' || data[pos] == '-')) {
+    negative = data[pos] == '-';
+    ++pos;
+  }
+
+  uint64_t mantissa = 0;
+  size_t mantissa_digits = 0;
+  int exponent = 0;
+  bool inexact = false;  // a non-zero digit did not fit the mantissa
+  bool seen_digit = false;
+  for (; pos < size && clp_is_digit(data[pos]); ++pos) {
+    seen_digit = true;
+    const unsigned digit = static_cast<unsigned>(data[pos] - '0');
+    if (mantissa_digits < k_number_max_digits) {
+      mantissa = mantissa * 10 + digit;
+      mantissa_digits += mantissa ? 1 : 0;
+    } else {
+      ++exponent;
+      inexact = inexact || digit != 0;
+    }
+  }
+  if (pos < size && data[pos] == '.') {
+    ++pos;
+    for (; pos < size && clp_is_digit(data[pos]); ++pos) {
+      seen_digit = true;
+      const unsigned digit = static_cast<unsigned>(data[pos] - '0');
+      if (mantissa_digits < k_number_max_digits) {
+        mantissa = mantissa * 10 + digit;
+        mantissa_digits += mantissa ? 1 : 0;
+        --exponent;
+      } else {
+        inexact = inexact || digit != 0;
+      }
+    }
+  }
+  if (!seen_digit) {
+    *error_offset = pos;
+    return false;
+  }
+
+  int explicit_exponent = 0;
+  if (pos < size && (data[pos] == 'e' || data[pos] == 'E') && pos + 1 < size &&
+      (clp_is_digit(data[pos + 1]) ||
+       ((data[pos + 1] == '+' || data[pos + 1] == '-') && pos + 2 < size && clp_is_digit(data[pos + 2])))) {
+    ++pos;
+    bool exponent_negative = false;
+    if (data[pos] == '+' || data[pos] == '-') {
+      exponent_negative = data[pos] == '-';
+      ++pos;
+    }
+    for (; pos < size && clp_is_digit(data[pos]); ++pos) {
+      if (explicit_exponent < 100000) {
+        explicit_exponent = explicit_exponent * 10 + (data[pos] - '0');
+      }
+    }
+    explicit_exponent = exponent_negative ? -explicit_exponent : explicit_exponent;
+  }
+  const size_t number_end = pos;
+
+  // Anything after the number must be a single unit word.
+  while (pos < size && (data[pos] == ' ' || data[pos] == '\t')) {
+    ++pos;
+  }
+  while (pos < size && clp_is_unit_char(data[pos])) {
+    ++pos;
+  }
+  while (pos < size && (data[pos] == ' ' || data[pos] == '\t')) {
+    ++pos;
+  }
+  if (pos != size) {
+    *error_offset = pos;
+    return false;
+  }
+
+  exponent += explicit_exponent;
+  double value = 0.0;
+  if (mantissa == 0) {
+    value = 0.0;
+  } else if (!inexact && mantissa <= (static_cast<uint64_t>(1) << 53) && exponent >= -22 && exponent <= 22) {
+    // Both operands are exact doubles, so one IEEE operation rounds correctly.
+    value = static_cast<double>(mantissa);
+    value = exponent < 0 ? value / k_exact_powers_of_ten[-exponent] : value * k_exact_powers_of_ten[exponent];
+  } else if (!clp_parse_number_fallback(data + start, number_end - start, &value)) {
+    *error_offset = start + std::min(number_end - start, k_number_fallback_size - 1);
+    return false;
+  } else {
+    negative = false;  // strtod already applied the sign
+  }
+  *out = negative ? -value : value;
+  return true;
+}
+
+// Integer form of clp_parse_number: the value must be integral and fit CLINT32.
+// A fractional or out-of-range value fails at the end of its integer digits.
+static bool clp_parse_int32(const TextView &text, CLINT32 *out, size_t *error_offset) {
+  double value = 0.0;
+  if (!clp_parse_number(text, &value, error_offset)) {
+    return false;
+  }
+  if (value < -2147483648.0 || value > 2147483647.0 || value != static_cast<double>(static_cast<CLINT32>(value))) {
+    size_t pos = 0;
+    while (pos < text.size && (text.data[pos] == ' ' || text.data[pos] == '\t')) {
+      ++pos;
+    }
+    if (pos < text.size && (text.data[pos] == '+' || text.data[pos] == '-')) {
+      ++pos;
+    }
+    while (pos < text.size && clp_is_digit(text.data[pos])) {
+      ++pos;
+    }
+    *error_offset = pos;
+    return false;
+  }
+  *out = static_cast<CLINT32>(value);
+  return true;
+}
+
+// 10^exponent for any float-sized exponent. Exact within +-22, otherwise off
+// by a few ulps, which clp_format_float tolerates because it verifies.
+static double clp_pow10(int exponent) {
+  const int magnitude = exponent < 0 ? -exponent : exponent;
+  double scale = k_exact_powers_of_ten[std::min(magnitude, 22)];
+  if (magnitude > 22) {
+    scale *= k_exact_powers_of_ten[std::min(magnitude - 22, 22)];
+  }
+  if (magnitude > 44) {
+    scale *= k_exact_powers_of_ten[magnitude - 44];
+  }
+  return exponent < 0 ? 1.0 / scale : scale;
+}
+
+// Writes the shortest plain decimal (no exponent) that clp_parse_number reads
+// back as exactly value, and returns its length. Needs neither snprintf nor the
+// locale. value must be finite; out must hold k_float_text_size bytes.
+static size_t clp_format_float(float value, char *out) {
+  size_t len = 0;
+  if (value == 0.0f) {
+    out[len++] = '0';
+    return len;
+  }
+  if (value < 0.0f) {
+    out[len++] = '-';
+  }
+  const double magnitude = std::fabs(static_cast<double>(value));
+  int decimal_exponent = static_cast<int>(std::floor(std::log10(magnitude)));
+  if (magnitude < clp_pow10(decimal_exponent)) {
+    --decimal_exponent;
+  } else if (magnitude >= clp_pow10(decimal_exponent + 1)) {
+    ++decimal_exponent;
+  }
+
+  // Try 1..9 significant digits; nine always round-trip a float.
+  for (int precision = 1; precision <= 9; ++precision) {
+    int exponent = decimal_exponent;
+    uint64_t scaled = static_cast<uint64_t>(std::llround(magnitude * clp_pow10(precision - 1 - exponent)));
+    if (scaled >= static_cast<uint64_t>(clp_pow10(precision))) {
+      scaled /= 10;  // rounding carried into a new leading digit
+      ++exponent;
+    }
+    char digits[9];
+    size_t digit_count = static_cast<size_t>(precision);
+    for (size_t idx = digit_count; idx > 0; --idx) {
+      digits[idx - 1] = static_cast<char>('0' + scaled % 10);
+      scaled /= 10;
+    }
+    while (digit_count > 1 && digits[digit_count - 1] == '0') {
+      --digit_count;
+    }
+    const int point = exponent + 1;  // digits before the decimal point, may be <= 0
+
+    char candidate[k_float_text_size];
+    size_t candidate_len = 0;
+    if (point <= 0) {
+      candidate[candidate_len++] = '0';
+      candidate[candidate_len++] = '.';
+      for (int idx = point; idx < 0; ++idx) {
+        candidate[candidate_len++] = '0';
+      }
+      memcpy(candidate + candidate_len, digits, digit_count);
+      candidate_len += digit_count;
+    } else {
+      for (int idx = 0; idx < point; ++idx) {
+        candidate[candidate_len++] = static_cast<size_t>(idx) < digit_count ? digits[idx] : '0';
+      }
+      if (static_cast<size_t>(point) < digit_count) {
+        candidate[candidate_len++] = '.';
+        memcpy(candidate + candidate_len, digits + point, digit_count - static_cast<size_t>(point));
+        candidate_len += digit_count - static_cast<size_t>(point);
+      }
+    }
+
+    double parsed = 0.0;
+    size_t error_offset = 0;
+    TextView view = {candidate, candidate_len};
+    if (precision == 9 ||
+        (clp_parse_number(view, &parsed, &error_offset) && static_cast<float>(parsed) == std::fabs(value))) {
+      memcpy(out + len, candidate, candidate_len);
+      return len + candidate_len;
+    }
+  }
+  return len;
+}
+
+static void clp_set_parse_error(const char *what, const TextView &text, size_t error_offset) {
+  char message[160];
+  std::snprintf(message, sizeof(message), "failed to parse %s at offset %u of \"%.*s\"", what,
+                static_cast<unsigned>(error_offset), static_cast<int>(std::min<size_t>(text.size, 64)), text.data);
+  g_last_error = message;
+}
+
+// Fills connection->limits from minfps, maxfps, mintint and maxtint, sent as
+// one batch. A no-op while the cached limits are still valid.
+static CLINT32 clp_refresh_timing_limits(ConnectionState *connection, ISerial *serial, CLUINT32 timeout) {
+  TimingLimits &limits = connection->limits;
+  if (limits.fps_valid && limits.tint_valid) {
+    return CL_ERR_NO_ERR;
+  }
+  CommandBuffer *command = &connection->command;
+  clp_cmd_begin(command, CLP_CMD_MINFPS);
+  clp_cmd_next(command, CLP_CMD_MAXFPS);
+  clp_cmd_next(command, CLP_CMD_MINTINT);
+  clp_cmd_next(command, CLP_CMD_MAXTINT);
+  TextView answers[4];
+  CLINT32 rc = clp_send_batch(connection, serial, timeout, 4, answers);
+  if (rc != CL_ERR_NO_ERR) {
+    return rc;
+  }
+  float *const fields[4] = {&limits.min_fps, &limits.max_fps, &limits.min_tint, &limits.max_tint};
+  for (size_t idx = 0; idx < 4; ++idx) {
+    double parsed = 0.0;
+    size_t error_offset = 0;
+    if (!clp_parse_number(answers[idx], &parsed, &error_offset)) {
+      connection->stream_dirty = true;
+      clp_set_parse_error("float", answers[idx], error_offset);
+      return CL_ERR_INVALID_REFERENCE;
+    }
+    *fields[idx] = static_cast<float>(parsed);
+  }
+  limits.fps_valid = true;
+  limits.tint_valid = true;
+  return CL_ERR_NO_ERR;
+}
+
+// Rejects a value outside [min_value, max_value], naming the limit it crossed.
+static CLINT32 clp_check_range(const char *feature, float value, const char *min_name, float min_value,
+                               const char *max_name, float max_value) {
+  const bool below = value < min_value;
+  if (!below && !(value > max_value)) {
+    return CL_ERR_NO_ERR;
+  }
+  char value_text[k_float_text_size];
+  char limit_text[k_float_text_size];
+  const size_t value_len = clp_format_float(value, value_text);
+  const size_t limit_len = clp_format_float(below ? min_value : max_value, limit_text);
+  char message[160];
+  std::snprintf(message, sizeof(message), "%s %.*s is %s %s %.*s", feature, static_cast<int>(value_len), value_text,
+                below ? "below" : "above", below ? min_name : max_name, static_cast<int>(limit_len), limit_text);
+  g_last_error = message;
+  return CL_ERR_PARAM_DATA_VALUE;
+}
+
+// Keywords the camera uses in bool, enum and status replies. Decoding folds case and
+// hashes the reply in one pass, then switches on the compile-time hashes of
+// this table; a hit is confirmed against the keyword before it is returned.
+#define CLP_TOKEN_TABLE(X)      \
+  X(ON, "on")                   \
+  X(OFF, "off")                 \
+  X(ENABLE, "enable")           \
+  X(DISABLE, "disable")         \
+  X(AUTOMATIC, "automatic")     \
+  X(MANUAL, "manual")           \
+  X(LVDS, "lvds")               \
+  X(CMOS, "cmos")               \
+  X(LOW, "low")                 \
+  X(MEDIUM, "medium")           \
+  X(HIGH, "high")               \
+  X(STATE, "state")             \
+  X(STATUS, "status")           \
+  X(ERROR, "error")             \
+  X(ERRORS, "errors")           \
+  X(COOLING, "cooling")         \
+  X(UPTIME, "uptime")           \
+  X(STARTING, "starting")       \
+  X(CONFIGURING, "configuring") \
+  X(POORVACUUM, "poorvacuum")   \
+  X(FAULTY, "faulty")           \
+  X(STANDBY, "standby")         \
+  X(OPERATIONAL, "operational") \
+  X(READY, "ready")             \
+  X(STABLE, "stable")           \
+  X(REGULATED, "regulated")
+
+enum CliToken {
+  CLP_TOKEN_UNKNOWN,
+#define CLP_TOKEN_ID(name, text) CLP_TOKEN_##name,
+  CLP_TOKEN_TABLE(CLP_TOKEN_ID)
+#undef CLP_TOKEN_ID
+};
+
+static constexpr const char *k_token_text[] = {
+    "",
+#define CLP_TOKEN_TEXT(name, text) text,
+    CLP_TOKEN_TABLE(CLP_TOKEN_TEXT)
+#undef CLP_TOKEN_TEXT
+};
+
+static const size_t k_token_max_size = 11;  // "configuring", "operational"
+static constexpr uint32_t k_fnv_offset = 2166136261u;
+static constexpr uint32_t k_fnv_prime = 16777619u;
+
+static constexpr uint32_t clp_token_hash(const char *text, uint32_t hash = k_fnv_offset) {
+  return *text == '\0' ? hash : clp_token_hash(text + 1, (hash ^ static_cast<uint8_t>(*text)) * k_fnv_prime);
+}
+
+static CliToken clp_decode_token(const TextView &text) {
+  if (text.size == 0 || text.size > k_token_max_size) {
+    return CLP_TOKEN_UNKNOWN;
+  }
+  char folded[k_token_max_size];
+  uint32_t hash = k_fnv_offset;
+  for (size_t idx = 0; idx < text.size; ++idx) {
+    char c = text.data[idx];
+    if (c >= 'A' && c <= 'Z') {
+      c = static_cast<char>(c - 'A' + 'a');
+    }
+    folded[idx] = c;
+    hash = (hash ^ static_cast<uint8_t>(c)) * k_fnv_prime;
+  }
+  CliToken token = CLP_TOKEN_UNKNOWN;
+  switch (hash) {
+#define CLP_TOKEN_CASE(name, text) \
+  case clp_token_hash(text):       \
+    token = CLP_TOKEN_##name;      \
+    break;
+    CLP_TOKEN_TABLE(CLP_TOKEN_CASE)
+#undef CLP_TOKEN_CASE
+    default:
+      return CLP_TOKEN_UNKNOWN;
+  }
+  const char *keyword = k_token_text[token];
+  if (strlen(keyword) != text.size || memcmp(folded, keyword, text.size) != 0) {
+    return CLP_TOKEN_UNKNOWN;
+  }
+  return token;
+}
+
+// CLI spellings of the enumerations, indexed by their EnumEntry value.
+static const CliToken k_synchronization_tokens[] = {CLP_TOKEN_LVDS, CLP_TOKEN_CMOS};
+static const CliToken k_sensibility_tokens[] = {CLP_TOKEN_LOW, CLP_TOKEN_MEDIUM, CLP_TOKEN_HIGH};
+static const CliToken k_fan_mode_tokens[] = {CLP_TOKEN_AUTOMATIC, CLP_TOKEN_MANUAL};
+static const CliToken k_status_state_tokens[] = {
+    CLP_TOKEN_UNKNOWN, CLP_TOKEN_STARTING, CLP_TOKEN_CONFIGURING, CLP_TOKEN_POORVACUUM, CLP_TOKEN_FAULTY,
+    CLP_TOKEN_COOLING, CLP_TOKEN_STANDBY,  CLP_TOKEN_OPERATIONAL, CLP_TOKEN_READY,
+};
+
+template <size_t N>
+static bool clp_decode_enum(const TextView &text, const CliToken (&entries)[N], CLINT32 *out) {
+  const CliToken token = clp_decode_token(text);
+  for (size_t idx = 0; idx < N; ++idx) {
+    if (token != CLP_TOKEN_UNKNOWN && entries[idx] == token) {
+      *out = static_cast<CLINT32>(idx);
+      return true;
+    }
+  }
+  return false;
+}
+
+static CLINT32 clp_parse_bool(const TextView &value, CLINT32 *out) {
+  if (!out) {
+    return CL_ERR_INVALID_PTR;
+  }
+  if (value.size == 0) {
+    return CL_ERR_INVALID_REFERENCE;
+  }
+  switch (clp_decode_token(value)) {
+    case CLP_TOKEN_ON:
+    case CLP_TOKEN_ENABLE:
+      *out = 1;
+      return CL_ERR_NO_ERR;
+    case CLP_TOKEN_OFF:
+    case CLP_TOKEN_DISABLE:
+      *out = 0;
+      return CL_ERR_NO_ERR;
+    default:
+      break;
+  }
+  // Only a bare digit counts: the unit-tolerant number parser would read "1 ms" as true.
+  if (value.size == 1 && (value.data[0] == '0' || value.data[0] == '1')) {
+    *out = value.data[0] - '0';
+    return CL_ERR_NO_ERR;
+  }
+  return CL_ERR_INVALID_REFERENCE;
+}
+
+static TextView clp_trim_view(TextView view) {
+  while (view.size > 0 && clp_is_blank(view.data[0])) {
+    ++view.data;
+    --view.size;
+  }
+  while (view.size > 0 && clp_is_blank(view.data[view.size - 1])) {
+    --view.size;
+  }
+  return view;
+}
+
+// Reply tokenizer. clp_find_delimiter returns the index of the first '\r',
+// '\n', ':' or '=' at or after pos (size if none), 16 or 32 bytes at a time
+// where the CPU allows; clp_next_field builds line and key/value views on it.
+static unsigned clp_lowest_bit(uint32_t mask) {
+#if defined(_MSC_VER)
+  unsigned long index = 0;
+  _BitScanForward(&index, mask);
+  return static_cast<unsigned>(index);
+#else
+  return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+static bool clp_is_delimiter(char c) { return c == '\r' || c == '\n' || c == ':' || c == '='; }
+
+static size_t clp_find_delimiter_scalar(const char *data, size_t size, size_t pos) {
+  while (pos < size && !clp_is_delimiter(data[pos])) {
+    ++pos;
+  }
+  return pos;
+}
+
+#if defined(CLP_HAVE_SSE2)
+static size_t clp_find_delimiter_sse2(const char *data, size_t size, size_t pos) {
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i colon = _mm_set1_epi8(':');
+  const __m128i equals = _mm_set1_epi8('=');
+  for (; pos + 16 <= size; pos += 16) {
+    const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+    const __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, cr), _mm_cmpeq_epi8(chunk, lf)),
+                                      _mm_or_si128(_mm_cmpeq_epi8(chunk, colon), _mm_cmpeq_epi8(chunk, equals)));
+    const uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(hits));
+    if (mask) {
+      return pos + clp_lowest_bit(mask);
+    }
   }
+  return clp_find_delimiter_scalar(data, size, pos);
+}
+#endif
 
-  if (fread(g_xml, 1, (size_t)len, fp) != (size_t)len) {
-    fclose(fp);
-    free(g_xml);
-    g_xml = NULL;
-    g_last_error = "failed to read XML file";
-    return CL_ERR_INVALID_PTR;
+#if defined(CLP_HAVE_AVX2)
+#if defined(__GNUC__) && !defined(__AVX2__)
+__attribute__((target("avx2")))
+#endif
+static size_t clp_find_delimiter_avx2(const char *data, size_t size, size_t pos) {
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const __m256i colon = _mm256_set1_epi8(':');
+  const __m256i equals = _mm256_set1_epi8('=');
+  for (; pos + 32 <= size; pos += 32) {
+    const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos));
+    const __m256i hits =
+        _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, cr), _mm256_cmpeq_epi8(chunk, lf)),
+                        _mm256_or_si256(_mm256_cmpeq_epi8(chunk, colon), _mm256_cmpeq_epi8(chunk, equals)));
+    const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(hits));
+    if (mask) {
+      return pos + clp_lowest_bit(mask);
+    }
   }
+  return clp_find_delimiter_sse2(data, size, pos);
+}
+#endif
 
-  g_xml[len] = '\0';
-  fclose(fp);
-  g_xml_len = (CLUINT32)len + 1;
-  return CL_ERR_NO_ERR;
+enum ScanPath { CLP_SCAN_SCALAR, CLP_SCAN_SSE2, CLP_SCAN_AVX2 };
+
+static ScanPath clp_detect_scan_path(void) {
+#if defined(CLP_HAVE_AVX2) && defined(__AVX2__)
+  return CLP_SCAN_AVX2;
+#elif defined(CLP_HAVE_AVX2)
+  __builtin_cpu_init();  // runs from a static initializer, possibly before libgcc's
+  return __builtin_cpu_supports("avx2") ? CLP_SCAN_AVX2 : CLP_SCAN_SSE2;
+#elif defined(CLP_HAVE_SSE2)
+  return CLP_SCAN_SSE2;
+#else
+  return CLP_SCAN_SCALAR;
+#endif
 }
 
-static std::string clp_trim_response(const std::string &resp);
+static const ScanPath g_scan_path = clp_detect_scan_path();
 
-static CLINT32 clp_send_command(ISerial *serial, const std::string &cmd, CLUINT32 timeout,
-                                std::string *response) {
-  if (!serial) {
-    g_last_error = "serial interface is NULL";
-    return CL_ERR_INVALID_PTR;
+static size_t clp_find_delimiter(const char *data, size_t size, size_t pos) {
+  switch (g_scan_path) {
+#if defined(CLP_HAVE_AVX2)
+    case CLP_SCAN_AVX2:
+      return clp_find_delimiter_avx2(data, size, pos);
+#endif
+#if defined(CLP_HAVE_SSE2)
+    case CLP_SCAN_SSE2:
+      return clp_find_delimiter_sse2(data, size, pos);
+#endif
+    default:
+      return clp_find_delimiter_scalar(data, size, pos);
   }
+}
 
-  clp_debugf("CLP send: %s", cmd.c_str());
+// One line of a reply. key and value are set when the line contains ':' or
+// '='; they split at the first one. All views point into the reply.
+struct FieldView {
+  TextView line;
+  TextView key;
+  TextView value;
+  bool has_value;
+};
 
-  std::string payload = cmd;
-  payload.push_back('\n');
-  std::vector<CLINT8> write_buf(payload.begin(), payload.end());
-  CLUINT32 write_size = static_cast<CLUINT32>(write_buf.size());
-  CLINT32 rc = serial->clSerialWrite(write_buf.data(), &write_size, timeout);
-  if (rc != CL_ERR_NO_ERR) {
-    g_last_error = "serial write failed";
-    return rc;
+// Takes the next non-empty line off *rest; false once *rest is exhausted.
+static bool clp_next_field(TextView *rest, FieldView *field) {
+  const char *data = rest->data;
+  const size_t size = rest->size;
+  size_t pos = 0;
+  while (pos < size && (data[pos] == '\r' || data[pos] == '\n')) {
+    ++pos;
   }
-
-  if (!response) {
-    return CL_ERR_NO_ERR;
+  if (pos == size) {
+    rest->data += size;
+    rest->size = 0;
+    return false;
   }
-
-  const char *prompt = "fli-cli>";
-  std::string out;
-  for (int attempt = 0; attempt < 32; ++attempt) {
-    char buf[256];
-    CLUINT32 read_size = sizeof(buf);
-    rc = serial->clSerialRead(reinterpret_cast<CLINT8 *>(buf), &read_size, timeout);
-    if (rc == CL_ERR_TIMEOUT) {
-      if (out.find(prompt) != std::string::npos) {
-        break;
-      }
-      continue;
-    }
-    if (rc != CL_ERR_NO_ERR) {
-      g_last_error = "serial read failed";
-      return rc;
+  const size_t start = pos;
+  size_t separator = size;
+  for (;;) {
+    pos = clp_find_delimiter(data, size, pos);
+    if (pos == size || data[pos] == '\r' || data[pos] == '\n') {
+      break;
     }
-    if (read_size > 0) {
-      out.append(buf, buf + read_size);
-      if (out.find(prompt) != std::string::npos) {
-        break;
-      }
+    if (separator == size) {
+      separator = pos;
     }
+    ++pos;
+  }
+  TextView line = {data + start, pos - start};
+  field->line = clp_trim_view(line);
+  field->has_value = separator != size;
+  if (field->has_value) {
+    TextView key = {data + start, separator - start};
+    TextView value = {data + separator + 1, pos - separator - 1};
+    field->key = clp_trim_view(key);
+    field->value = clp_trim_view(value);
+  } else {
+    field->key = field->line;
+    field->value.data = data + pos;
+    field->value.size = 0;
   }
+  rest->data += pos;
+  rest->size -= pos;
+  return true;
+}
 
-  *response = out;
-  clp_debugf("CLP recv: %s", clp_trim_response(out).c_str());
-  return CL_ERR_NO_ERR;
+// First word of a key, so "error flags" and "cooling state" decode as
+// "error" and "cooling".
+static TextView clp_first_word(const TextView &text) {
+  size_t len = 0;
+  while (len < text.size && text.data[len] != ' ' && text.data[len] != '_' && text.data[len] != '\t') {
+    ++len;
+  }
+  TextView word = {text.data, len};
+  return word;
 }
 
-static std::string clp_trim_response(const std::string &resp) {
-  const char *prompt = "fli-cli>";
-  std::string out = resp;
-  size_t prompt_pos = out.find(prompt);
-  if (prompt_pos != std::string::npos) {
-    out = out.substr(0, prompt_pos);
+static bool clp_parse_flags(const TextView &text, CLINT32 *out) {
+  if (text.size > 2 && text.data[0] == '0' && (text.data[1] == 'x' || text.data[1] == 'X')) {
+    uint32_t flags = 0;
+    for (size_t idx = 2; idx < text.size; ++idx) {
+      const char c = text.data[idx];
+      uint32_t nibble = 0;
+      if (c >= '0' && c <= '9') {
+        nibble = static_cast<uint32_t>(c - '0');
+      } else if (c >= 'a' && c <= 'f') {
+        nibble = static_cast<uint32_t>(c - 'a' + 10);
+      } else if (c >= 'A' && c <= 'F') {
+        nibble = static_cast<uint32_t>(c - 'A' + 10);
+      } else {
+        return false;
+      }
+      flags = (flags << 4) | nibble;
+    }
+    *out = static_cast<CLINT32>(flags);
+    return true;
   }
+  size_t error_offset = 0;
+  return clp_parse_int32(text, out, &error_offset);
+}
 
-  while (!out.empty() && (out.back() == '\r' || out.back() == '\n' || out.back() == ' ' || out.back() == '\t')) {
-    out.pop_back();
+// Uptime as "hh:mm:ss", "mm:ss" or a number with an optional unit
+// (s, ms, min, h, d); seconds by default.
+static bool clp_parse_uptime(const TextView &text, CLINT32 *out) {
+  if (memchr(text.data, ':', text.size)) {
+    int64_t seconds = 0;
+    int64_t part = 0;
+    bool digits = false;
+    for (size_t idx = 0; idx <= text.size; ++idx) {
+      if (idx == text.size || text.data[idx] == ':') {
+        if (!digits) {
+          return false;
+        }
+        seconds = seconds * 60 + part;
+        part = 0;
+        digits = false;
+      } else if (clp_is_digit(text.data[idx]) && part < 100000000) {
+        part = part * 10 + (text.data[idx] - '0');
+        digits = true;
+      } else {
+        return false;
+      }
+    }
+    *out = static_cast<CLINT32>(std::min<int64_t>(seconds, 0x7fffffff));
+    return true;
   }
-  size_t start = 0;
-  while (start < out.size() &&
-         (out[start] == '\r' || out[start] == '\n' || out[start] == ' ' || out[start] == '\t')) {
-    ++start;
+  double value = 0.0;
+  size_t error_offset = 0;
+  if (!clp_parse_number(text, &value, &error_offset) || value < 0.0) {
+    return false;
+  }
+  size_t unit_start = text.size;
+  while (unit_start > 0 && clp_is_unit_char(text.data[unit_start - 1])) {
+    --unit_start;
   }
-  return out.substr(start);
+  TextView unit = {text.data + unit_start, text.size - unit_start};
+  if (unit.size == 2 && memcmp(unit.data, "ms", 2) == 0) {
+    value /= 1000.0;
+  } else if (unit.size == 3 && memcmp(unit.data, "min", 3) == 0) {
+    value *= 60.0;
+  } else if (unit.size == 1 && unit.data[0] == 'h') {
+    value *= 3600.0;
+  } else if (unit.size == 1 && unit.data[0] == 'd') {
+    value *= 86400.0;
+  }
+  *out = static_cast<CLINT32>(std::min(value, 2147483647.0));
+  return true;
 }
 
-static std::string clp_buffer_to_string(const CLINT8 *buffer, CLINT64 buffer_size) {
-  if (!buffer || buffer_size <= 0) {
-    return std::string();
+// A cropping window as the camera prints it: "first-last" or a single start
+// value. *last is -1 when the reply has no end.
+static bool clp_parse_span(const TextView &text, CLINT32 *first, CLINT32 *last) {
+  const char *dash = text.size > 1 ? static_cast<const char *>(memchr(text.data + 1, '-', text.size - 1)) : NULL;
+  size_t error_offset = 0;
+  if (!dash) {
+    *last = -1;
+    return clp_parse_int32(text, first, &error_offset);
   }
-  const char *ptr = reinterpret_cast<const char *>(buffer);
-  size_t len = strnlen(ptr, static_cast<size_t>(buffer_size));
-  return std::string(ptr, len);
+  TextView head = {text.data, static_cast<size_t>(dash - text.data)};
+  TextView tail = {dash + 1, text.size - head.size - 1};
+  return clp_parse_int32(clp_trim_view(head), first, &error_offset) &&
+         clp_parse_int32(clp_trim_view(tail), last, &error_offset);
 }
 
-static CLINT32 clp_write_int32(CLINT8 *pBuffer, CLINT64 buffer_size, CLINT32 value) {
-  if (!pBuffer || buffer_size < 4) {
-    return CL_ERR_BUFFER_TOO_SMALL;
-  }
-  pBuffer[0] = static_cast<CLINT8>(value & 0xFF);
-  pBuffer[1] = static_cast<CLINT8>((value >> 8) & 0xFF);
-  pBuffer[2] = static_cast<CLINT8>((value >> 16) & 0xFF);
-  pBuffer[3] = static_cast<CLINT8>((value >> 24) & 0xFF);
-  clp_debugf("CLP write int32: %d", value);
-  return CL_ERR_NO_ERR;
+// Extent of one axis: the span's length when it has an end, otherwise from
+// its start to the sensor edge.
+static CLINT32 clp_span_extent(CLINT32 first, CLINT32 last, CLINT32 sensor) {
+  const CLINT32 extent = last >= 0 ? last - first + 1 : sensor - first;
+  return std::max<CLINT32>(1, std::min(extent, sensor));
 }
 
-static CLINT32 clp_write_float32(CLINT8 *pBuffer, CLINT64 buffer_size, float value) {
-  if (!pBuffer || buffer_size < 4) {
-    return CL_ERR_BUFFER_TOO_SMALL;
+static CLINT32 clp_decode_cooling(const TextView &text) {
+  switch (clp_decode_token(text)) {
+    case CLP_TOKEN_OFF:
+      return CLP_COOLING_OFF;
+    case CLP_TOKEN_ON:
+    case CLP_TOKEN_COOLING:
+      return CLP_COOLING_ACTIVE;
+    case CLP_TOKEN_STABLE:
+    case CLP_TOKEN_REGULATED:
+      return CLP_COOLING_REGULATED;
+    default:
+      return CLP_COOLING_UNKNOWN;
   }
-  uint32_t bits = 0;
-  static_assert(sizeof(float) == sizeof(uint32_t), "float size unexpected");
-  memcpy(&bits, &value, sizeof(bits));
-  clp_debugf("CLP write float32: %.6f", value);
-  return clp_write_int32(pBuffer, buffer_size, static_cast<CLINT32>(bits));
 }
 
-static CLINT32 clp_read_int32(const CLINT8 *pBuffer, CLINT64 buffer_size, CLINT32 *value) {
-  if (!pBuffer || buffer_size < 4 || !value) {
-    return CL_ERR_BUFFER_TOO_SMALL;
+// Parses "status detailed" into *status. Recognised lines are "state",
+// "status", "error(s)", "cooling" and "uptime" keys separated by ':' or '=';
+// a bare first word is taken as the state. Unrecognised lines are ignored and
+// missing fields read as unknown/zero.
+static void clp_parse_status_detailed(const TextView &reply, StatusCache *status) {
+  status->state = CLP_STATUS_UNKNOWN;
+  status->error_flags = 0;
+  status->cooling_state = CLP_COOLING_UNKNOWN;
+  status->uptime_s = 0;
+  TextView rest = reply;
+  FieldView field;
+  while (clp_next_field(&rest, &field)) {
+    const TextView &value = field.value;
+    if (!field.has_value) {
+      if (status->state == CLP_STATUS_UNKNOWN) {
+        clp_decode_enum(field.line, k_status_state_tokens, &status->state);
+      }
+      continue;
+    }
+    switch (clp_decode_token(clp_first_word(field.key))) {
+      case CLP_TOKEN_STATE:
+      case CLP_TOKEN_STATUS:
+        clp_decode_enum(value, k_status_state_tokens, &status->state);
+        break;
+      case CLP_TOKEN_ERROR:
+      case CLP_TOKEN_ERRORS:
+        clp_parse_flags(value, &status->error_flags);
+        break;
+      case CLP_TOKEN_COOLING:
+        status->cooling_state = clp_decode_cooling(value);
+        break;
+      case CLP_TOKEN_UPTIME:
+        clp_parse_uptime(value, &status->uptime_s);
+        break;
+      default:
+        break;
+    }
   }
-  uint32_t v = static_cast<uint8_t>(pBuffer[0]) |
-               (static_cast<uint8_t>(pBuffer[1]) << 8) |
-               (static_cast<uint8_t>(pBuffer[2]) << 16) |
-               (static_cast<uint8_t>(pBuffer[3]) << 24);
-  *value = static_cast<CLINT32>(v);
-  return CL_ERR_NO_ERR;
+  status->valid = true;
+  status->refreshed_us = clp_monotonic_us();
 }
 
-static CLINT32 clp_read_float32(const CLINT8 *pBuffer, CLINT64 buffer_size, float *value) {
-  CLINT32 tmp = 0;
-  CLINT32 rc = clp_read_int32(pBuffer, buffer_size, &tmp);
-  if (rc != CL_ERR_NO_ERR) {
-    return rc;
+// Watchdog recovery: sends "continue" (a camera stopped on an error waits for
+// it), checks that the CLI prompts again, reads the status and, when the uptime
+// went backwards, writes the shadowed settings back. Each step waits at most
+// k_watchdog_step_ms and the whole recovery at most k_watchdog_budget_us.
+static CLUINT32 clp_watchdog_step_ms(uint64_t until_us) {
+  const uint64_t now_us = clp_monotonic_us();
+  if (now_us >= until_us) {
+    return 0;
   }
-  uint32_t bits = static_cast<uint32_t>(tmp);
-  float f = 0.0f;
-  memcpy(&f, &bits, sizeof(f));
-  *value = f;
-  return CL_ERR_NO_ERR;
+  return static_cast<CLUINT32>(std::min<uint64_t>(k_watchdog_step_ms, (until_us - now_us + 999) / 1000));
 }
 
-static void clp_write_string(CLINT8 *pBuffer, CLINT64 buffer_size, const std::string &value) {
-  if (!pBuffer || buffer_size <= 0) {
-    return;
+static bool clp_watchdog_recover(ConnectionState *connection, ISerial *serial, const char *reason,
+                                 std::string *refusal) {
+  Watchdog &watchdog = connection->watchdog;
+  TransportCounters &counters = connection->counters;
+  CommandBuffer &command = connection->command;
+  const uint64_t start_us = clp_monotonic_us();
+  const uint64_t until_us = start_us + k_watchdog_budget_us;
+  clp_count(&counters.watchdog_recoveries);
+  CLP_LOG(CLP_LOG_WARN, connection->cookie, "watchdog", "reason=%s", reason);
+
+  // Outstanding setter replies are read while the camera may still answer, so
+  // that a refusal among them is not lost; the rest go with whatever state the
+  // camera was in.
+  if (connection->pending.count > 0) {
+    const size_t count = connection->pending.count;
+    const CLINT32 ack_rc = clp_collect_acks(connection, serial, clp_watchdog_step_ms(until_us));
+    if (ack_rc != CL_ERR_NO_ERR) {
+      CLP_LOG(CLP_LOG_WARN, connection->cookie, "watchdog", "acks=%u rc=%d error=\"%s\"",
+              static_cast<unsigned>(count), ack_rc, g_last_error.c_str());
+    }
+    if (ack_rc == CL_ERR_PARAM_DATA_VALUE) {
+      *refusal = g_last_error;
+    }
   }
-  memset(pBuffer, 0, static_cast<size_t>(buffer_size));
-  const size_t copy_len = std::min(static_cast<size_t>(buffer_size - 1), value.size());
-  memcpy(pBuffer, value.data(), copy_len);
-}
+  connection->pending.count = 0;
+  connection->pending.size = 0;
+  connection->stream_dirty = false;
+  TextView reply;
+  clp_cmd_begin(&command, CLP_CMD_CONTINUE);
+  CLINT32 rc = clp_send_command(connection, serial, clp_watchdog_step_ms(until_us), &reply);
+  if (rc == CL_ERR_NO_ERR) {
+    rc = clp_resync_prompt(connection, serial, clp_watchdog_step_ms(until_us));
+  }
+  bool recovered = rc == CL_ERR_NO_ERR && !connection->stream_dirty;
 
-static CLINT32 clp_parse_bool(const std::string &value, CLINT32 *out) {
-  if (!out) {
-    return CL_ERR_INVALID_PTR;
+  bool rebooted = false;
+  if (recovered) {
+    clp_cmd_begin(&command, CLP_CMD_STATUS_DETAILED);
+    rc = clp_send_command(connection, serial, clp_watchdog_step_ms(until_us), &reply);
+    recovered = rc == CL_ERR_NO_ERR && !connection->stream_dirty;
   }
-  if (value.empty()) {
-    return CL_ERR_INVALID_REFERENCE;
+  if (recovered) {
+    StatusCache &status = connection->status;
+    clp_parse_status_detailed(reply, &status);
+    watchdog.status_checked_us = status.refreshed_us;
+    rebooted = status.uptime_s > 0 && status.uptime_s < watchdog.uptime_s;
+    if (status.uptime_s > 0) {
+      watchdog.uptime_s = status.uptime_s;
+    }
+    recovered = status.state != CLP_STATUS_FAULTY;
   }
-  if (value == "1" || value == "on" || value == "ON" || value == "On") {
-    *out = 1;
-    return CL_ERR_NO_ERR;
+
+  size_t replayed = 0;
+  if (recovered && rebooted) {
+    // Replaying re-records each setting; work from a copy.
+    const SettingShadow shadow = connection->shadow;
+    for (size_t idx = 0; idx < shadow.count && recovered; ++idx) {
+      const CLUINT32 step_ms = clp_watchdog_step_ms(until_us);
+      if (step_ms == 0) {
+        recovered = false;
+        break;
+      }
+      const ShadowSetting &entry = shadow.entries[idx];
+      memcpy(command.data, entry.data, entry.size);
+      command.size = entry.size;
+      command.verb = clp_command_verb_index(entry.data);
+      command.overflow = false;
+      rc = clp_send_batch(connection, serial, step_ms, 1);
+      if (rc == CL_ERR_NO_ERR) {
+        ++replayed;
+        clp_count(&counters.settings_replayed);
+      } else if (connection->stream_dirty) {
+        recovered = false;
+      } else {
+        CLP_LOG(CLP_LOG_WARN, connection->cookie, "watchdog", "refused=\"%.*s\"", static_cast<int>(entry.size),
+                entry.data);
+      }
+    }
   }
-  if (value == "0" || value == "off" || value == "OFF" || value == "Off") {
-    *out = 0;
-    return CL_ERR_NO_ERR;
+  // Whatever was cached may describe the camera before the reboot.
+  connection->geometry.valid = false;
+  connection->limits.fps_valid = false;
+  connection->limits.tint_valid = false;
+  watchdog.missed_prompts = 0;
+  if (!recovered) {
+    clp_count(&counters.watchdog_failures);
   }
-  if (value == "enable" || value == "ENABLE" || value == "Enable") {
-    *out = 1;
-    return CL_ERR_NO_ERR;
+  CLP_LOG(recovered ? CLP_LOG_INFO : CLP_LOG_ERROR, connection->cookie, "watchdog",
+          "recovered=%d rebooted=%d replayed=%u dur_us=%u", recovered ? 1 : 0, rebooted ? 1 : 0,
+          static_cast<unsigned>(replayed), static_cast<unsigned>(clp_monotonic_us() - start_us));
+  return recovered;
+}
+
+// Runs after each register access and returns its result, rc. The caller's
+// result and error text are left as they were; the recovery only helps the
+// calls that follow. The exception is a setter reply the recovery had to read
+// on the way: a refusal there fails a call that otherwise succeeded, as
+// clp_collect_acks would have.
+static CLINT32 clp_watchdog_check(ConnectionState *connection, ISerial *serial, CLINT32 rc) {
+  Watchdog &watchdog = connection->watchdog;
+  if (!watchdog.enabled || !serial || connection->long_write.active) {
+    return rc;
   }
-  if (value == "disable" || value == "DISABLE" || value == "Disable") {
-    *out = 0;
-    return CL_ERR_NO_ERR;
+  const StatusCache &status = connection->status;
+  const char *reason = NULL;
+  if (watchdog.missed_prompts >= k_watchdog_missed_prompts) {
+    reason = "timeouts";
+  } else if (status.valid && status.refreshed_us != watchdog.status_checked_us) {
+    watchdog.status_checked_us = status.refreshed_us;
+    if (status.state == CLP_STATUS_FAULTY) {
+      reason = "faulty";
+    } else if (status.uptime_s > 0 && status.uptime_s < watchdog.uptime_s) {
+      reason = "reboot";
+    } else if (status.uptime_s > 0) {
+      watchdog.uptime_s = status.uptime_s;
+    }
   }
-  char *end = NULL;
-  long parsed = strtol(value.c_str(), &end, 10);
-  if (end && *end == '\0') {
-    *out = parsed ? 1 : 0;
-    return CL_ERR_NO_ERR;
+  if (!reason) {
+    return rc;
   }
-  return CL_ERR_INVALID_REFERENCE;
+  const std::string error = g_last_error;
+  std::string refusal;
+  clp_watchdog_recover(connection, serial, reason, &refusal);
+  if (rc == CL_ERR_NO_ERR && !refusal.empty()) {
+    g_last_error = refusal;
+    return CL_ERR_PARAM_DATA_VALUE;
+  }
+  g_last_error = error;
+  return rc;
 }
 
-static std::string clp_bool_to_cli(CLINT32 value) { return value ? "on" : "off"; }
-
-static std::string clp_format_int(CLINT32 value) {
-  char buf[64];
-  std::snprintf(buf, sizeof(buf), "%d", value);
-  return std::string(buf);
-}
+static const char *clp_bool_to_cli(CLINT32 value) { return k_token_text[value ? CLP_TOKEN_ON : CLP_TOKEN_OFF]; }
 
-static std::string clp_format_float(float value) {
-  char buf[64];
-  std::snprintf(buf, sizeof(buf), "%.6f", value);
-  return std::string(buf);
-}
+static void clp_close_all(void);
 
 CLPROTOCOLEXPORT CLINT32 CLPROTOCOL
 clpInitLib(clp_logger_t logger, CLP_LOG_LEVEL_VALUE logLevel) {
@@ -504,10 +3362,10 @@ clpInitLib(clp_logger_t logger, CLP_LOG_LEVEL_VALUE logLevel) {
   g_initialized = true;
   g_logger = logger;
   g_log_level = logLevel;
-  g_connections.clear();
+  clp_log_start();
+  clp_close_all();
   g_stop_probe_requested = false;
-  clp_debugf("CLProtocol stub initialized");
-  clp_logf(CLP_LOG_INFO, "%s", "CLProtocol stub initialized");
+  CLP_LOG(CLP_LOG_INFO, 0, "init", "msg=\"CLProtocol stub initialized\"");
   return CL_ERR_NO_ERR;
 }
 
@@ -517,8 +3375,9 @@ clpCloseLib(void) {
   g_xml = NULL;
   g_xml_len = 0;
   g_initialized = false;
-  g_connections.clear();
+  clp_close_all();
   g_stop_probe_requested = false;
+  clp_log_stop();
   return CL_ERR_NO_ERR;
 }
 
@@ -555,8 +3414,7 @@ clpProbeDevice(ISerial *pSerial,
     return CL_ERR_INVALID_PTR;
   }
 
-  if (g_stop_probe_requested) {
-    g_stop_probe_requested = false;
+  if (g_stop_probe_requested.exchange(false)) {
     g_last_error = "probe stopped";
     return CL_ERR_TIMEOUT;
   }
@@ -580,6 +3438,11 @@ clpProbeDevice(ISerial *pSerial,
   if (rc != CL_ERR_NO_ERR || supported == 0) {
     supported = clp_default_supported_baudrates();
   }
+  // CLP_STOP_PROBE_DEVICE may come from another thread while the port is queried.
+  if (g_stop_probe_requested.exchange(false)) {
+    g_last_error = "probe stopped";
+    return CL_ERR_TIMEOUT;
+  }
 
   if ((supported & CL_BAUDRATE_9600) == 0) {
     g_last_error = "9600 baud unsupported";
@@ -592,18 +3455,18 @@ clpProbeDevice(ISerial *pSerial,
     return rc;
   }
 
-  ConnectionState state = {};
-  state.cookie = clp_allocate_cookie();
-  state.device_baudrate = CL_BAUDRATE_9600;
-  state.supported_baudrates = supported;
-  state.state = {0, 0, 0, 0};
-  state.device_id = full_device_id;
-  state.xml_id = clp_xml_id_for_device(full_device_id);
-  g_connections.push_back(state);
-
-  memcpy(pDeviceID, state.device_id.c_str(), needed);
+  std::shared_ptr<ConnectionState> state(new ConnectionState());
+  state->device_baudrate = CL_BAUDRATE_9600;
+  state->supported_baudrates = supported;
+  state->state = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0.0f, 0.0f};
+  state->device_id = full_device_id;
+  state->xml_id = clp_xml_id_for_device(full_device_id);
+  std::lock_guard<std::mutex> lock(g_connections_mutex);
+  state->cookie = clp_allocate_cookie();
+  memcpy(pDeviceID, state->device_id.c_str(), needed);
   *pBufferSize = needed;
-  *pCookie = state.cookie;
+  *pCookie = state->cookie;
+  g_connections.push_back(state);
   return CL_ERR_NO_ERR;
 }
 
@@ -616,7 +3479,7 @@ clpGetXMLIDs(ISerial *pSerial,
   (void)pSerial;
   (void)TimeOut;
 
-  ConnectionState *connection = NULL;
+  std::shared_ptr<ConnectionState> connection;
   CLINT32 rc = clp_require_cookie(Cookie, &connection);
   if (rc != CL_ERR_NO_ERR) {
     return rc;
@@ -648,7 +3511,7 @@ clpGetXMLDescription(ISerial *pSerial,
   (void)pSerial;
   (void)TimeOut;
 
-  ConnectionState *connection = NULL;
+  std::shared_ptr<ConnectionState> connection;
   CLINT32 rc = clp_require_cookie(Cookie, &connection);
   if (rc != CL_ERR_NO_ERR) {
     return rc;
@@ -683,18 +3546,14 @@ clpGetXMLDescription(ISerial *pSerial,
   return CL_ERR_NO_ERR;
 }
 
-CLPROTOCOLEXPORT CLINT32 CLPROTOCOL
-clpReadRegister(ISerial *pSerial,
-                const CLUINT32 Cookie,
-                const CLINT64 Address,
-                CLINT8 *pBuffer,
-                const CLINT64 BufferSize,
-                const CLUINT32 TimeOut) {
-  ConnectionState *connection = NULL;
-  CLINT32 rc = clp_require_cookie(Cookie, &connection);
-  if (rc != CL_ERR_NO_ERR) {
-    return rc;
-  }
+// Register access proper. Callers hold connection->engine.mutex, so a
+// transaction never interleaves with another one on the same connection.
+static CLINT32 clp_read_register(ConnectionState *connection,
+                                 ISerial *pSerial,
+                                 const CLINT64 Address,
+                                 CLINT8 *pBuffer,
+                                 const CLINT64 BufferSize,
+                                 const CLUINT32 TimeOut) {
   DeviceState &state = connection->state;
   if (!pSerial) {
     g_last_error = "serial interface is NULL";
@@ -704,123 +3563,171 @@ clpReadRegister(ISerial *pSerial,
     g_last_error = "buffer is NULL";
     return CL_ERR_INVALID_PTR;
   }
+  CLINT32 rc = clp_require_idle(*connection);
+  if (rc != CL_ERR_NO_ERR) {
+    return rc;
+  }
+  clp_apply_stale_caches(connection);
 
-  auto read_text = [&](const std::string &cmd, std::string *out) -> CLINT32 {
-    std::string resp;
-    CLINT32 rc = clp_send_command(pSerial, cmd, TimeOut, &resp);
+  auto read_text = [&](CommandId cmd, TextView *out) -> CLINT32 {
+    clp_cmd_begin(&connection->command, cmd);
+    CLINT32 rc = clp_send_command(connection, pSerial, TimeOut, out);
     if (rc != CL_ERR_NO_ERR) {
       return rc;
     }
-    *out = clp_trim_response(resp);
-    if (out->empty()) {
+    if (out->size == 0) {
       g_last_error = "empty response";
       return CL_ERR_INVALID_REFERENCE;
     }
     return CL_ERR_NO_ERR;
   };
 
-  auto read_int = [&](const std::string &cmd, CLINT32 *value) -> CLINT32 {
-    std::string out;
+  auto read_int = [&](CommandId cmd, CLINT32 *value) -> CLINT32 {
+    TextView out;
     CLINT32 rc = read_text(cmd, &out);
     if (rc != CL_ERR_NO_ERR) {
       return rc;
     }
-    char *end = NULL;
-    long parsed = strtol(out.c_str(), &end, 10);
-    if (!end || end == out.c_str()) {
-      g_last_error = "failed to parse int";
+    size_t error_offset = 0;
+    if (!clp_parse_int32(out, value, &error_offset)) {
+      // A reply of the wrong type most likely belongs to another command.
+      connection->stream_dirty = true;
+      clp_set_parse_error("int", out, error_offset);
       return CL_ERR_INVALID_REFERENCE;
     }
-    *value = static_cast<CLINT32>(parsed);
     return CL_ERR_NO_ERR;
   };
 
-  auto read_float = [&](const std::string &cmd, float *value) -> CLINT32 {
-    std::string out;
+  auto read_float = [&](CommandId cmd, float *value) -> CLINT32 {
+    TextView out;
     CLINT32 rc = read_text(cmd, &out);
     if (rc != CL_ERR_NO_ERR) {
       return rc;
     }
-    char *end = NULL;
-    double parsed = strtod(out.c_str(), &end);
-    if (!end || end == out.c_str()) {
-      g_last_error = "failed to parse float";
+    double parsed = 0.0;
+    size_t error_offset = 0;
+    if (!clp_parse_number(out, &parsed, &error_offset)) {
+      connection->stream_dirty = true;
+      clp_set_parse_error("float", out, error_offset);
       return CL_ERR_INVALID_REFERENCE;
     }
     *value = static_cast<float>(parsed);
     return CL_ERR_NO_ERR;
   };
 
+  auto read_span = [&](CommandId cmd, CLINT32 *first, CLINT32 *last) -> CLINT32 {
+    TextView out;
+    CLINT32 rc = read_text(cmd, &out);
+    if (rc != CL_ERR_NO_ERR) {
+      return rc;
+    }
+    if (!clp_parse_span(out, first, last)) {
+      connection->stream_dirty = true;
+      g_last_error = "failed to parse cropping window";
+      return CL_ERR_INVALID_REFERENCE;
+    }
+    return CL_ERR_NO_ERR;
+  };
+
   switch (Address) {
     case 0x0000: {
-      std::string out;
-      CLINT32 rc = read_text("cameratype raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_CAMERATYPE, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       clp_write_string(pBuffer, BufferSize, out);
       return CL_ERR_NO_ERR;
     }
     case 0x0040: {
-      std::string out;
-      CLINT32 rc = read_text("hwuid raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_HWUID, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       clp_write_string(pBuffer, BufferSize, out);
       return CL_ERR_NO_ERR;
     }
     case 0x0080: {
-      std::string out;
-      CLINT32 rc = read_text("version firmware raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_VERSION_FIRMWARE, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       clp_write_string(pBuffer, BufferSize, out);
       return CL_ERR_NO_ERR;
     }
     case 0x00C0: {
-      std::string out;
-      CLINT32 rc = read_text("version firmware detailed raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_VERSION_FIRMWARE_DETAILED, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       clp_write_string(pBuffer, BufferSize, out);
       return CL_ERR_NO_ERR;
     }
     case 0x0100: {
-      std::string out;
-      CLINT32 rc = read_text("version firmware build raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_VERSION_FIRMWARE_BUILD, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       clp_write_string(pBuffer, BufferSize, out);
       return CL_ERR_NO_ERR;
     }
     case 0x0140: {
-      std::string out;
-      CLINT32 rc = read_text("version fpga raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_VERSION_FPGA, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       clp_write_string(pBuffer, BufferSize, out);
       return CL_ERR_NO_ERR;
     }
     case 0x0180: {
-      std::string out;
-      CLINT32 rc = read_text("version hardware raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_VERSION_HARDWARE, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       clp_write_string(pBuffer, BufferSize, out);
       return CL_ERR_NO_ERR;
     }
     case 0x01C0: {
-      std::string out;
-      CLINT32 rc = read_text("status raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_STATUS, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       clp_write_string(pBuffer, BufferSize, out);
       return CL_ERR_NO_ERR;
     }
     case 0x0240: {
-      std::string out;
-      CLINT32 rc = read_text("status detailed raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_STATUS_DETAILED, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
+      clp_parse_status_detailed(out, &connection->status);
       clp_write_string(pBuffer, BufferSize, out);
       return CL_ERR_NO_ERR;
     }
+    case 0x02C0:
+    case 0x02C4:
+    case 0x02C8:
+    case 0x02CC: {
+      StatusCache &status = connection->status;
+      const bool event_driven = clp_event_cache_active(*connection);
+      if (!status.valid || (!event_driven && clp_monotonic_us() - status.refreshed_us > k_status_cache_ttl_us)) {
+        TextView out;
+        CLINT32 rc = read_text(CLP_CMD_STATUS_DETAILED, &out);
+        if (rc != CL_ERR_NO_ERR) return rc;
+        clp_parse_status_detailed(out, &status);
+      }
+      switch (Address) {
+        case 0x02C0:
+          return clp_write_int32(pBuffer, BufferSize, status.state);
+        case 0x02C4:
+          return clp_write_int32(pBuffer, BufferSize, status.error_flags);
+        case 0x02C8:
+          return clp_write_int32(pBuffer, BufferSize, status.cooling_state);
+        default:
+          if (event_driven && status.uptime_s > 0) {
+            // No event marks the passing seconds; count them from the refresh.
+            const uint64_t elapsed_s = (clp_monotonic_us() - status.refreshed_us) / 1000000;
+            return clp_write_int32(pBuffer, BufferSize, status.uptime_s + static_cast<CLINT32>(elapsed_s));
+          }
+          return clp_write_int32(pBuffer, BufferSize, status.uptime_s);
+      }
+    }
     case 0x0310:
       return clp_write_int32(pBuffer, BufferSize, static_cast<CLINT32>(state.indicator_selector));
     case 0x0314: {
       CLINT32 value = 0;
-      std::string out;
-      CLINT32 rc = read_text("led raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_LED, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       rc = clp_parse_bool(out, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
@@ -828,50 +3735,50 @@ clpReadRegister(ISerial *pSerial,
     }
     case 0x1000: {
       float value = 0.0f;
-      CLINT32 rc = read_float("fps raw", &value);
+      CLINT32 rc = read_float(CLP_CMD_FPS, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
       return clp_write_float32(pBuffer, BufferSize, value);
     }
     case 0x1004: {
       float value = 0.0f;
-      CLINT32 rc = read_float("minfps raw", &value);
+      CLINT32 rc = read_float(CLP_CMD_MINFPS, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
       return clp_write_float32(pBuffer, BufferSize, value);
     }
     case 0x1008: {
       float value = 0.0f;
-      CLINT32 rc = read_float("maxfps raw", &value);
+      CLINT32 rc = read_float(CLP_CMD_MAXFPS, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
       return clp_write_float32(pBuffer, BufferSize, value);
     }
     case 0x1010: {
       float value = 0.0f;
-      CLINT32 rc = read_float("tint raw", &value);
+      CLINT32 rc = read_float(CLP_CMD_TINT, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
       return clp_write_float32(pBuffer, BufferSize, value);
     }
     case 0x1014: {
       float value = 0.0f;
-      CLINT32 rc = read_float("mintint raw", &value);
+      CLINT32 rc = read_float(CLP_CMD_MINTINT, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
       return clp_write_float32(pBuffer, BufferSize, value);
     }
     case 0x1018: {
       float value = 0.0f;
-      CLINT32 rc = read_float("maxtint raw", &value);
+      CLINT32 rc = read_float(CLP_CMD_MAXTINT, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
       return clp_write_float32(pBuffer, BufferSize, value);
     }
     case 0x101C: {
       float value = 0.0f;
-      CLINT32 rc = read_float("maxtintitr raw", &value);
+      CLINT32 rc = read_float(CLP_CMD_MAXTINTITR, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
       return clp_write_float32(pBuffer, BufferSize, value);
     }
     case 0x1020: {
       CLINT32 value = 0;
-      std::string out;
-      CLINT32 rc = read_text("tintgranularity raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_TINTGRANULARITY, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       rc = clp_parse_bool(out, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
@@ -879,8 +3786,8 @@ clpReadRegister(ISerial *pSerial,
     }
     case 0x1030: {
       CLINT32 value = 0;
-      std::string out;
-      CLINT32 rc = read_text("extsynchro raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_EXTSYNCHRO, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       rc = clp_parse_bool(out, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
@@ -888,29 +3795,29 @@ clpReadRegister(ISerial *pSerial,
     }
     case 0x1034: {
       float value = 0.0f;
-      CLINT32 rc = read_float("tlsydel raw", &value);
+      CLINT32 rc = read_float(CLP_CMD_TLSYDEL, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
       return clp_write_float32(pBuffer, BufferSize, value);
     }
     case 0x1038: {
-      std::string out;
-      CLINT32 rc = read_text("synchronization raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_SYNCHRONIZATION, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       CLINT32 value = 0;
-      if (out == "lvds" || out == "LVDS") {
-        value = 0;
-      } else if (out == "cmos" || out == "CMOS") {
-        value = 1;
-      } else {
+      if (!clp_decode_enum(out, k_synchronization_tokens, &value)) {
         g_last_error = "unknown synchronization mode";
         return CL_ERR_INVALID_REFERENCE;
       }
       return clp_write_int32(pBuffer, BufferSize, value);
     }
+    case 0x1040:
+      return clp_write_float32(pBuffer, BufferSize, state.timing_fps);
+    case 0x1044:
+      return clp_write_float32(pBuffer, BufferSize, state.timing_tint);
     case 0x1100: {
       CLINT32 value = 0;
-      std::string out;
-      CLINT32 rc = read_text("vrefadjust raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_VREFADJUST, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       rc = clp_parse_bool(out, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
@@ -918,25 +3825,19 @@ clpReadRegister(ISerial *pSerial,
     }
     case 0x1104: {
       CLINT32 value = 0;
-      std::string out;
-      CLINT32 rc = read_text("tcdsadjust raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_TCDSADJUST, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       rc = clp_parse_bool(out, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
       return clp_write_int32(pBuffer, BufferSize, value);
     }
     case 0x1108: {
-      std::string out;
-      CLINT32 rc = read_text("sensibility raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_SENSIBILITY, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       CLINT32 value = 0;
-      if (out == "low" || out == "LOW") {
-        value = 0;
-      } else if (out == "medium" || out == "MEDIUM") {
-        value = 1;
-      } else if (out == "high" || out == "HIGH") {
-        value = 2;
-      } else {
+      if (!clp_decode_enum(out, k_sensibility_tokens, &value)) {
         g_last_error = "unknown sensibility mode";
         return CL_ERR_INVALID_REFERENCE;
       }
@@ -944,33 +3845,63 @@ clpReadRegister(ISerial *pSerial,
     }
     case 0x1200: {
       CLINT32 value = 0;
-      std::string out;
-      CLINT32 rc = read_text("cropping raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_CROPPING, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       rc = clp_parse_bool(out, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
       return clp_write_int32(pBuffer, BufferSize, value);
     }
     case 0x1204: {
-      CLINT32 value = 0;
-      CLINT32 rc = read_int("cropping columns raw", &value);
+      CLINT32 first = 0;
+      CLINT32 last = 0;
+      CLINT32 rc = read_span(CLP_CMD_CROPPING_COLUMNS, &first, &last);
       if (rc != CL_ERR_NO_ERR) return rc;
-      return clp_write_int32(pBuffer, BufferSize, value);
+      return clp_write_int32(pBuffer, BufferSize, first);
     }
     case 0x1208: {
-      CLINT32 value = 0;
-      CLINT32 rc = read_int("cropping rows raw", &value);
+      CLINT32 first = 0;
+      CLINT32 last = 0;
+      CLINT32 rc = read_span(CLP_CMD_CROPPING_ROWS, &first, &last);
       if (rc != CL_ERR_NO_ERR) return rc;
-      return clp_write_int32(pBuffer, BufferSize, value);
+      return clp_write_int32(pBuffer, BufferSize, first);
     }
     case 0x120C:
-      return clp_write_int32(pBuffer, BufferSize, 640);
-    case 0x1210:
-      return clp_write_int32(pBuffer, BufferSize, 512);
+    case 0x1210: {
+      GeometryCache &geometry = connection->geometry;
+      if (!geometry.valid) {
+        CLINT32 cropping = 0;
+        TextView out;
+        CLINT32 rc = read_text(CLP_CMD_CROPPING, &out);
+        if (rc != CL_ERR_NO_ERR) return rc;
+        rc = clp_parse_bool(out, &cropping);
+        if (rc != CL_ERR_NO_ERR) return rc;
+        geometry.width = k_sensor_width;
+        geometry.height = k_sensor_height;
+        if (cropping) {
+          CLINT32 first = 0;
+          CLINT32 last = 0;
+          rc = read_span(CLP_CMD_CROPPING_COLUMNS, &first, &last);
+          if (rc != CL_ERR_NO_ERR) return rc;
+          geometry.width = clp_span_extent(first, last, k_sensor_width);
+          rc = read_span(CLP_CMD_CROPPING_ROWS, &first, &last);
+          if (rc != CL_ERR_NO_ERR) return rc;
+          geometry.height = clp_span_extent(first, last, k_sensor_height);
+        }
+        geometry.valid = true;
+      }
+      return clp_write_int32(pBuffer, BufferSize, Address == 0x120C ? geometry.width : geometry.height);
+    }
+    case 0x1240:
+      return clp_write_int32(pBuffer, BufferSize, state.roi_enable);
+    case 0x1244:
+      return clp_write_int32(pBuffer, BufferSize, state.roi_offset_x);
+    case 0x1248:
+      return clp_write_int32(pBuffer, BufferSize, state.roi_offset_y);
     case 0x1214: {
       CLINT32 value = 0;
-      std::string out;
-      CLINT32 rc = read_text("rawimages raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_RAWIMAGES, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       rc = clp_parse_bool(out, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
@@ -978,14 +3909,14 @@ clpReadRegister(ISerial *pSerial,
     }
     case 0x1218: {
       CLINT32 value = 0;
-      CLINT32 rc = read_int("nbreadworeset raw", &value);
+      CLINT32 rc = read_int(CLP_CMD_NBREADWORESET, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
       return clp_write_int32(pBuffer, BufferSize, value);
     }
     case 0x1220: {
       CLINT32 value = 0;
-      std::string out;
-      CLINT32 rc = read_text("bias raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_BIAS, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       rc = clp_parse_bool(out, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
@@ -993,8 +3924,8 @@ clpReadRegister(ISerial *pSerial,
     }
     case 0x1224: {
       CLINT32 value = 0;
-      std::string out;
-      CLINT32 rc = read_text("flat raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_FLAT, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       rc = clp_parse_bool(out, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
@@ -1002,8 +3933,8 @@ clpReadRegister(ISerial *pSerial,
     }
     case 0x1228: {
       CLINT32 value = 0;
-      std::string out;
-      CLINT32 rc = read_text("badpixel raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_BADPIXEL, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       rc = clp_parse_bool(out, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
@@ -1011,8 +3942,8 @@ clpReadRegister(ISerial *pSerial,
     }
     case 0x1230: {
       CLINT32 value = 0;
-      std::string out;
-      CLINT32 rc = read_text("imagetags raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_IMAGETAGS, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       rc = clp_parse_bool(out, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
@@ -1022,31 +3953,31 @@ clpReadRegister(ISerial *pSerial,
       return clp_write_int32(pBuffer, BufferSize, static_cast<CLINT32>(state.temperature_selector));
     case 0x2004: {
       float value = 0.0f;
-      const char *cmd = "temperatures raw";
+      CommandId cmd = CLP_CMD_TEMPERATURES;
       switch (state.temperature_selector) {
         case 0:
-          cmd = "temperatures motherboard raw";
+          cmd = CLP_CMD_TEMPERATURES_MOTHERBOARD;
           break;
         case 1:
-          cmd = "temperatures frontend raw";
+          cmd = CLP_CMD_TEMPERATURES_FRONTEND;
           break;
         case 2:
-          cmd = "temperatures powerboard raw";
+          cmd = CLP_CMD_TEMPERATURES_POWERBOARD;
           break;
         case 3:
-          cmd = "temperatures snake raw";
+          cmd = CLP_CMD_TEMPERATURES_SNAKE;
           break;
         case 4:
-          cmd = "temperatures snake setpoint raw";
+          cmd = CLP_CMD_TEMPERATURES_SNAKE_SETPOINT;
           break;
         case 5:
-          cmd = "temperatures peltier raw";
+          cmd = CLP_CMD_TEMPERATURES_PELTIER;
           break;
         case 6:
-          cmd = "temperatures heatsink raw";
+          cmd = CLP_CMD_TEMPERATURES_HEATSINK;
           break;
         default:
-          cmd = "temperatures raw";
+          cmd = CLP_CMD_TEMPERATURES;
           break;
       }
       CLINT32 rc = read_float(cmd, &value);
@@ -1057,30 +3988,31 @@ clpReadRegister(ISerial *pSerial,
       return clp_write_int32(pBuffer, BufferSize, static_cast<CLINT32>(state.user_set_selector));
     case 0x2200: {
       CLINT32 value = 0;
-      std::string out;
-      CLINT32 rc = read_text("events raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_EVENTS, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       rc = clp_parse_bool(out, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
+      connection->events.enabled = value != 0;
       return clp_write_int32(pBuffer, BufferSize, value);
     }
     case 0x3000:
       return clp_write_int32(pBuffer, BufferSize, static_cast<CLINT32>(state.power_selector));
     case 0x3004: {
       float value = 0.0f;
-      const char *cmd = "power raw";
+      CommandId cmd = CLP_CMD_POWER;
       switch (state.power_selector) {
         case 0:
-          cmd = "power raw";
+          cmd = CLP_CMD_POWER;
           break;
         case 1:
-          cmd = "power snake raw";
+          cmd = CLP_CMD_POWER_SNAKE;
           break;
         case 2:
-          cmd = "power peltier raw";
+          cmd = CLP_CMD_POWER_PELTIER;
           break;
         default:
-          cmd = "power raw";
+          cmd = CLP_CMD_POWER;
           break;
       }
       CLINT32 rc = read_float(cmd, &value);
@@ -1088,15 +4020,11 @@ clpReadRegister(ISerial *pSerial,
       return clp_write_float32(pBuffer, BufferSize, value);
     }
     case 0x3010: {
-      std::string out;
-      CLINT32 rc = read_text("fan mode raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_FAN_MODE, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       CLINT32 value = 0;
-      if (out == "automatic" || out == "Automatic" || out == "AUTOMATIC") {
-        value = 0;
-      } else if (out == "manual" || out == "Manual" || out == "MANUAL") {
-        value = 1;
-      } else {
+      if (!clp_decode_enum(out, k_fan_mode_tokens, &value)) {
         g_last_error = "unknown fan mode";
         return CL_ERR_INVALID_REFERENCE;
       }
@@ -1104,25 +4032,25 @@ clpReadRegister(ISerial *pSerial,
     }
     case 0x3014: {
       CLINT32 value = 0;
-      CLINT32 rc = read_int("fan speed raw", &value);
+      CLINT32 rc = read_int(CLP_CMD_FAN_SPEED, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
       return clp_write_int32(pBuffer, BufferSize, value);
     }
     case 0x3020: {
       float value = 0.0f;
-      CLINT32 rc = read_float("voltage vref raw", &value);
+      CLINT32 rc = read_float(CLP_CMD_VOLTAGE_VREF, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
       return clp_write_float32(pBuffer, BufferSize, value);
     }
     case 0x3024: {
       float value = 0.0f;
-      CLINT32 rc = read_float("voltage vref raw", &value);
+      CLINT32 rc = read_float(CLP_CMD_VOLTAGE_VREF, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
       return clp_write_float32(pBuffer, BufferSize, value);
     }
     case 0x3100: {
-      std::string out;
-      CLINT32 rc = read_text("ipaddress raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_IPADDRESS, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       clp_write_string(pBuffer, BufferSize, out);
       return CL_ERR_NO_ERR;
@@ -1131,14 +4059,14 @@ clpReadRegister(ISerial *pSerial,
     case 0x3120:
     case 0x3130:
     case 0x3140:
-      clp_write_string(pBuffer, BufferSize, "");
+      clp_write_string(pBuffer, BufferSize, clp_view(""));
       return CL_ERR_NO_ERR;
     case 0x3150:
       return clp_write_int32(pBuffer, BufferSize, 0);
     case 0x3160: {
       CLINT32 value = 0;
-      std::string out;
-      CLINT32 rc = read_text("telnet raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_TELNET, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       rc = clp_parse_bool(out, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
@@ -1146,38 +4074,147 @@ clpReadRegister(ISerial *pSerial,
     }
     case 0x3164: {
       CLINT32 value = 0;
-      std::string out;
-      CLINT32 rc = read_text("remotemaintenance raw", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_REMOTEMAINTENANCE, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       rc = clp_parse_bool(out, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
       return clp_write_int32(pBuffer, BufferSize, value);
     }
     case 0x3180: {
-      std::string out;
-      CLINT32 rc = read_text("licenses", &out);
+      TextView out;
+      CLINT32 rc = read_text(CLP_CMD_LICENSES, &out);
       if (rc != CL_ERR_NO_ERR) return rc;
       clp_write_string(pBuffer, BufferSize, out);
       return CL_ERR_NO_ERR;
     }
+    case 0x4000:
+      return clp_write_int32(pBuffer, BufferSize, static_cast<CLINT32>(state.stats_command_selector));
+    case 0x4004:
+      return clp_write_int32(pBuffer, BufferSize, static_cast<CLINT32>(state.stats_phase_selector));
+    case 0x4160:
+      return clp_write_int32(pBuffer, BufferSize, connection->watchdog.enabled ? 1 : 0);
+    case 0x4164:
+      return clp_write_int32(pBuffer, BufferSize, clp_reader_active(*connection) ? 1 : 0);
+    case 0x4190:
+      return clp_write_int32(pBuffer, BufferSize, connection->event_cache ? 1 : 0);
+    case 0x4008:
+    case 0x400C:
+    case 0x4010:
+    case 0x4014:
+    case 0x4018: {
+      if (state.stats_command_selector >= k_command_verb_count || state.stats_phase_selector >= CLP_PHASE_COUNT) {
+        g_last_error = "statistics selector out of range";
+        return CL_ERR_INVALID_REFERENCE;
+      }
+      const LatencyHistogram &hist =
+          connection->stats.phases[state.stats_command_selector][state.stats_phase_selector];
+      uint64_t value = 0;
+      switch (Address) {
+        case 0x4008:
+          value = hist.count;
+          break;
+        case 0x400C:
+          value = hist.count ? hist.sum_us / hist.count : 0;
+          break;
+        case 0x4010:
+          value = clp_histogram_percentile(hist, 50);
+          break;
+        case 0x4014:
+          value = clp_histogram_percentile(hist, 99);
+          break;
+        default:
+          value = hist.max_us;
+          break;
+      }
+      return clp_write_int32(pBuffer, BufferSize, clp_saturate_u32(value));
+    }
+    case 0x4100:
+    case 0x4108:
+    case 0x4110:
+    case 0x4118:
+    case 0x4120:
+    case 0x4128:
+    case 0x4130:
+    case 0x4148:
+    case 0x4150:
+    case 0x4158:
+    case 0x4168:
+    case 0x4170:
+    case 0x4178:
+    case 0x4180:
+    case 0x4188:
+    case 0x4198:
+    case 0x41A0: {
+      const clp_cred2_transport_counters_t counters = clp_snapshot_counters(connection->counters);
+      CLINT64 value = 0;
+      switch (Address) {
+        case 0x4100:
+          value = counters.bytes_written;
+          break;
+        case 0x4108:
+          value = counters.bytes_read;
+          break;
+        case 0x4110:
+          value = counters.reads;
+          break;
+        case 0x4118:
+          value = counters.timeouts;
+          break;
+        case 0x4120:
+          value = counters.errors;
+          break;
+        case 0x4128:
+          value = counters.prompt_resyncs;
+          break;
+        case 0x4148:
+          value = counters.drained_bytes;
+          break;
+        case 0x4150:
+          value = counters.resyncs;
+          break;
+        case 0x4158:
+          value = counters.misaligned_replies;
+          break;
+        case 0x4168:
+          value = counters.watchdog_recoveries;
+          break;
+        case 0x4170:
+          value = counters.watchdog_failures;
+          break;
+        case 0x4178:
+          value = counters.settings_replayed;
+          break;
+        case 0x4180:
+          value = counters.events;
+          break;
+        case 0x4188:
+          value = counters.events_dropped;
+          break;
+        case 0x4198:
+          value = counters.cache_invalidations;
+          break;
+        case 0x41A0:
+          value = counters.coalesced_reads;
+          break;
+        default:
+          value = counters.commands;
+          break;
+      }
+      return clp_write_int64(pBuffer, BufferSize, value);
+    }
     default:
       g_last_error = "unknown register address";
       return CL_ERR_INVALID_REFERENCE;
   }
 }
 
-CLPROTOCOLEXPORT CLINT32 CLPROTOCOL
-clpWriteRegister(ISerial *pSerial,
-                 const CLUINT32 Cookie,
-                 const CLINT64 Address,
-                 const CLINT8 *pBuffer,
-                 const CLINT64 BufferSize,
-                 const CLUINT32 TimeOut) {
-  ConnectionState *connection = NULL;
-  CLINT32 rc = clp_require_cookie(Cookie, &connection);
-  if (rc != CL_ERR_NO_ERR) {
-    return rc;
-  }
+static CLINT32 clp_write_register(ConnectionState *connection,
+                                  ISerial *pSerial,
+                                  const CLINT64 Address,
+                                  const CLINT8 *pBuffer,
+                                  const CLINT64 BufferSize,
+                                  const CLUINT32 TimeOut) {
   DeviceState &state = connection->state;
   if (!pSerial) {
     g_last_error = "serial interface is NULL";
@@ -1187,22 +4224,92 @@ clpWriteRegister(ISerial *pSerial,
     g_last_error = "buffer is NULL";
     return CL_ERR_INVALID_PTR;
   }
+  CLINT32 rc = clp_require_idle(*connection);
+  if (rc != CL_ERR_NO_ERR) {
+    return rc;
+  }
+  clp_apply_stale_caches(connection);
 
-  auto send_cmd = [&](const std::string &cmd) -> CLINT32 {
-    CLINT32 rc = clp_send_command(pSerial, cmd, TimeOut, NULL);
-    if (rc != CL_ERR_NO_ERR) {
-      return rc;
+  CommandBuffer *command = &connection->command;
+  // Any write may change what "status detailed" reports.
+  connection->status.valid = false;
+  switch (Address) {
+    case 0x0308:
+    case 0x1200:
+    case 0x1204:
+    case 0x1208:
+    case 0x124C:
+    case 0x2104:
+      connection->geometry.valid = false;
+      connection->limits.fps_valid = false;
+      connection->limits.tint_valid = false;
+      break;
+    case 0x1020:
+    case 0x1030:
+      connection->limits.fps_valid = false;
+      connection->limits.tint_valid = false;
+      break;
+    default:
+      break;
+  }
+  auto send_cmd = [&](CommandId id) -> CLINT32 {
+    clp_cmd_begin(command, id);
+    return clp_send_command(connection, pSerial, TimeOut, NULL);
+  };
+  auto send_arg = [&](CommandId id, const char *argument) -> CLINT32 {
+    clp_cmd_begin(command, id);
+    clp_cmd_append(command, argument);
+    return clp_send_command(connection, pSerial, TimeOut, NULL);
+  };
+  auto send_int = [&](CommandId id, CLINT32 argument) -> CLINT32 {
+    clp_cmd_begin(command, id);
+    clp_cmd_append_int(command, argument);
+    return clp_send_command(connection, pSerial, TimeOut, NULL);
+  };
+  auto send_float = [&](CommandId id, float argument) -> CLINT32 {
+    if (!std::isfinite(argument)) {
+      g_last_error = "float value is not finite";
+      return CL_ERR_PARAM_DATA_VALUE;
+    }
+    clp_cmd_begin(command, id);
+    clp_cmd_append_float(command, argument);
+    return clp_send_command(connection, pSerial, TimeOut, NULL);
+  };
+  // Checks fps or tint against the cached limits before anything is sent. When
+  // the limits cannot be read the write goes ahead and the camera decides; the
+  // skip is logged and the limits stay invalid, so the next write asks again.
+  auto check_timing = [&](bool fps, const char *feature, float value) -> CLINT32 {
+    TimingLimits &limits = connection->limits;
+    if (!std::isfinite(value)) {
+      return CL_ERR_NO_ERR;
+    }
+    if (!(fps ? limits.fps_valid : limits.tint_valid) &&
+        clp_refresh_timing_limits(connection, pSerial, TimeOut) != CL_ERR_NO_ERR) {
+      CLP_LOG(CLP_LOG_WARN, connection->cookie, "limits", "unchecked=%s error=\"%s\"", feature,
+              g_last_error.c_str());
+      return CL_ERR_NO_ERR;
     }
-    return CL_ERR_NO_ERR;
+    if (fps) {
+      return clp_check_range(feature, value, "minfps", limits.min_fps, "maxfps", limits.max_fps);
+    }
+    return clp_check_range(feature, value, "mintint", limits.min_tint, "maxtint", limits.max_tint);
+  };
+  auto send_string = [&](CommandId id) -> CLINT32 {
+    clp_cmd_begin(command, id);
+    const char *text = reinterpret_cast<const char *>(pBuffer);
+    clp_cmd_append_bytes(command, text, strnlen(text, static_cast<size_t>(BufferSize)));
+    return clp_send_command(connection, pSerial, TimeOut, NULL);
   };
 
   switch (Address) {
     case 0x0300:
-      return send_cmd("shutdown");
+      clp_cmd_begin(command, CLP_CMD_SHUTDOWN);
+      return clp_start_long_write(connection, pSerial, TimeOut, k_shutdown_budget_us);
     case 0x0304:
-      return send_cmd("continue");
+      return send_cmd(CLP_CMD_CONTINUE);
     case 0x0308:
-      return send_cmd("restorefactory");
+      clp_cmd_begin(command, CLP_CMD_RESTOREFACTORY);
+      return clp_start_long_write(connection, pSerial, TimeOut, k_restorefactory_budget_us);
     case 0x0310: {
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
@@ -1214,138 +4321,234 @@ clpWriteRegister(ISerial *pSerial,
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = "set led " + clp_bool_to_cli(value);
-      return send_cmd(cmd);
+      return send_arg(CLP_CMD_SET_LED, clp_bool_to_cli(value));
     }
     case 0x1000: {
       float value = 0.0f;
       CLINT32 rc = clp_read_float32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = "set fps " + clp_format_float(value);
-      return send_cmd(cmd);
+      rc = check_timing(true, "AcquisitionFrameRate", value);
+      if (rc != CL_ERR_NO_ERR) return rc;
+      connection->limits.tint_valid = false;
+      return send_float(CLP_CMD_SET_FPS, value);
     }
     case 0x1010: {
       float value = 0.0f;
       CLINT32 rc = clp_read_float32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = "set tint " + clp_format_float(value);
-      return send_cmd(cmd);
+      rc = check_timing(false, "ExposureTime", value);
+      if (rc != CL_ERR_NO_ERR) return rc;
+      connection->limits.fps_valid = false;
+      return send_float(CLP_CMD_SET_TINT, value);
     }
     case 0x1020: {
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = "set tintgranularity " + clp_bool_to_cli(value);
-      return send_cmd(cmd);
+      return send_arg(CLP_CMD_SET_TINTGRANULARITY, clp_bool_to_cli(value));
     }
     case 0x1030: {
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = "set extsynchro " + clp_bool_to_cli(value);
-      return send_cmd(cmd);
+      return send_arg(CLP_CMD_SET_EXTSYNCHRO, clp_bool_to_cli(value));
     }
     case 0x1034: {
       float value = 0.0f;
       CLINT32 rc = clp_read_float32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = "set tlsydel " + clp_format_float(value);
-      return send_cmd(cmd);
+      return send_float(CLP_CMD_SET_TLSYDEL, value);
     }
     case 0x1038: {
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string mode = (value == 0) ? "lvds" : "cmos";
-      std::string cmd = "set synchronization " + mode;
-      return send_cmd(cmd);
+      const char *mode = (value == 0) ? "lvds" : "cmos";
+      return send_arg(CLP_CMD_SET_SYNCHRONIZATION, mode);
+    }
+    case 0x1040:
+    case 0x1044: {
+      float value = 0.0f;
+      CLINT32 rc = clp_read_float32(pBuffer, BufferSize, &value);
+      if (rc != CL_ERR_NO_ERR) return rc;
+      if (!std::isfinite(value)) {
+        g_last_error = "float value is not finite";
+        return CL_ERR_PARAM_DATA_VALUE;
+      }
+      if (Address == 0x1040) {
+        state.timing_fps = value;
+      } else {
+        state.timing_tint = value;
+      }
+      return CL_ERR_NO_ERR;
+    }
+    case 0x1048: {
+      // maxtint follows the frame period: a longer exposure than the current
+      // maxtint only fits once fps has come down, otherwise tint has to shrink
+      // before fps goes up.
+      // The upper tint bound is the one the target fps allows: maxtint is the
+      // frame period less a fixed readout time, which the current fps and
+      // maxtint give away.
+      const TimingLimits &limits = connection->limits;
+      CLINT32 rc = clp_refresh_timing_limits(connection, pSerial, TimeOut);
+      if (rc != CL_ERR_NO_ERR) return rc;
+      rc = clp_check_range("ExposureTimingFrameRate", state.timing_fps, "minfps", limits.min_fps, "maxfps",
+                           limits.max_fps);
+      if (rc != CL_ERR_NO_ERR) return rc;
+      TextView current;
+      clp_cmd_begin(command, CLP_CMD_FPS);
+      rc = clp_send_command(connection, pSerial, TimeOut, &current);
+      if (rc != CL_ERR_NO_ERR) return rc;
+      double current_fps = 0.0;
+      size_t error_offset = 0;
+      if (!clp_parse_number(current, &current_fps, &error_offset) || !(current_fps > 0.0)) {
+        connection->stream_dirty = true;
+        clp_set_parse_error("float", current, error_offset);
+        return CL_ERR_INVALID_REFERENCE;
+      }
+      const double readout_us = std::max(0.0, 1e6 / current_fps - limits.max_tint);
+      const float target_max_tint = static_cast<float>(1e6 / state.timing_fps - readout_us);
+      rc = clp_check_range("ExposureTimingExposureTime", state.timing_tint, "mintint", limits.min_tint,
+                           "target maxtint", target_max_tint);
+      if (rc != CL_ERR_NO_ERR) return rc;
+      const bool fps_first = state.timing_tint > limits.max_tint;
+      connection->limits.fps_valid = false;
+      connection->limits.tint_valid = false;
+      if (fps_first) {
+        clp_cmd_begin(command, CLP_CMD_SET_FPS);
+        clp_cmd_append_float(command, state.timing_fps);
+        clp_cmd_next(command, CLP_CMD_SET_TINT);
+        clp_cmd_append_float(command, state.timing_tint);
+      } else {
+        clp_cmd_begin(command, CLP_CMD_SET_TINT);
+        clp_cmd_append_float(command, state.timing_tint);
+        clp_cmd_next(command, CLP_CMD_SET_FPS);
+        clp_cmd_append_float(command, state.timing_fps);
+      }
+      return clp_send_batch(connection, pSerial, TimeOut, 2);
     }
     case 0x1100: {
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = "set vrefadjust " + clp_bool_to_cli(value);
-      return send_cmd(cmd);
+      return send_arg(CLP_CMD_SET_VREFADJUST, clp_bool_to_cli(value));
     }
     case 0x1104: {
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = "set tcdsadjust " + clp_bool_to_cli(value);
-      return send_cmd(cmd);
+      return send_arg(CLP_CMD_SET_TCDSADJUST, clp_bool_to_cli(value));
     }
     case 0x1108: {
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string mode = "low";
+      const char *mode = "low";
       if (value == 1) mode = "medium";
       if (value >= 2) mode = "high";
-      std::string cmd = "set sensibility " + mode;
-      return send_cmd(cmd);
+      return send_arg(CLP_CMD_SET_SENSIBILITY, mode);
     }
     case 0x1200: {
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = "set cropping " + clp_bool_to_cli(value);
-      return send_cmd(cmd);
+      return send_arg(CLP_CMD_SET_CROPPING, clp_bool_to_cli(value));
     }
     case 0x1204: {
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = "set cropping columns " + clp_format_int(value);
-      return send_cmd(cmd);
+      return send_int(CLP_CMD_SET_CROPPING_COLUMNS, value);
     }
     case 0x1208: {
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = "set cropping rows " + clp_format_int(value);
-      return send_cmd(cmd);
+      return send_int(CLP_CMD_SET_CROPPING_ROWS, value);
     }
     case 0x1214: {
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = "set rawimages " + clp_bool_to_cli(value);
-      return send_cmd(cmd);
+      return send_arg(CLP_CMD_SET_RAWIMAGES, clp_bool_to_cli(value));
     }
     case 0x1218: {
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = "set nbreadworeset " + clp_format_int(value);
-      return send_cmd(cmd);
+      return send_int(CLP_CMD_SET_NBREADWORESET, value);
     }
     case 0x1220: {
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = "set bias " + clp_bool_to_cli(value);
-      return send_cmd(cmd);
+      return send_arg(CLP_CMD_SET_BIAS, clp_bool_to_cli(value));
     }
     case 0x1224: {
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = "set flat " + clp_bool_to_cli(value);
-      return send_cmd(cmd);
+      return send_arg(CLP_CMD_SET_FLAT, clp_bool_to_cli(value));
     }
     case 0x1228: {
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = "set badpixel " + clp_bool_to_cli(value);
-      return send_cmd(cmd);
+      return send_arg(CLP_CMD_SET_BADPIXEL, clp_bool_to_cli(value));
     }
     case 0x1230: {
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = "set imagetags " + clp_bool_to_cli(value);
-      return send_cmd(cmd);
+      return send_arg(CLP_CMD_SET_IMAGETAGS, clp_bool_to_cli(value));
+    }
+    case 0x1240:
+    case 0x1244:
+    case 0x1248: {
+      CLINT32 value = 0;
+      CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
+      if (rc != CL_ERR_NO_ERR) return rc;
+      if (Address == 0x1240) {
+        state.roi_enable = value ? 1 : 0;
+      } else if (Address == 0x1244) {
+        state.roi_offset_x = value;
+      } else {
+        state.roi_offset_y = value;
+      }
+      return CL_ERR_NO_ERR;
+    }
+    case 0x124C: {
+      char message[96];
+      if (state.roi_offset_x < 0 || state.roi_offset_x >= k_sensor_width || state.roi_offset_x % 32 != 0) {
+        std::snprintf(message, sizeof(message), "ROI OffsetX %d must be a multiple of 32 in 0-%d",
+                      state.roi_offset_x, k_sensor_width - 1);
+        g_last_error = message;
+        return CL_ERR_PARAM_DATA_VALUE;
+      }
+      if (state.roi_offset_y < 0 || state.roi_offset_y >= k_sensor_height || state.roi_offset_y % 4 != 0) {
+        std::snprintf(message, sizeof(message), "ROI OffsetY %d must be a multiple of 4 in 0-%d",
+                      state.roi_offset_y, k_sensor_height - 1);
+        g_last_error = message;
+        return CL_ERR_PARAM_DATA_VALUE;
+      }
+      // Enabling goes last so the camera never crops to a half-updated window;
+      // disabling goes first for the same reason.
+      if (state.roi_enable) {
+        clp_cmd_begin(command, CLP_CMD_SET_CROPPING_COLUMNS);
+        clp_cmd_append_int(command, state.roi_offset_x);
+        clp_cmd_next(command, CLP_CMD_SET_CROPPING_ROWS);
+        clp_cmd_append_int(command, state.roi_offset_y);
+        clp_cmd_next(command, CLP_CMD_SET_CROPPING);
+        clp_cmd_append(command, clp_bool_to_cli(1));
+      } else {
+        clp_cmd_begin(command, CLP_CMD_SET_CROPPING);
+        clp_cmd_append(command, clp_bool_to_cli(0));
+        clp_cmd_next(command, CLP_CMD_SET_CROPPING_COLUMNS);
+        clp_cmd_append_int(command, state.roi_offset_x);
+        clp_cmd_next(command, CLP_CMD_SET_CROPPING_ROWS);
+        clp_cmd_append_int(command, state.roi_offset_y);
+      }
+      return clp_send_batch(connection, pSerial, TimeOut, 3);
     }
     case 0x2000: {
       CLINT32 value = 0;
@@ -1361,18 +4564,19 @@ clpWriteRegister(ISerial *pSerial,
       state.user_set_selector = static_cast<CLUINT32>(value);
       return CL_ERR_NO_ERR;
     }
-    case 0x2104: {
-      std::string cmd = "set preset " + clp_format_int(static_cast<CLINT32>(state.user_set_selector));
-      return send_cmd(cmd);
-    }
+    case 0x2104:
+      clp_cmd_begin(command, CLP_CMD_SET_PRESET);
+      clp_cmd_append_int(command, static_cast<CLINT32>(state.user_set_selector));
+      return clp_start_long_write(connection, pSerial, TimeOut, k_preset_budget_us);
     case 0x2108:
-      return send_cmd("save");
+      clp_cmd_begin(command, CLP_CMD_SAVE);
+      return clp_start_long_write(connection, pSerial, TimeOut, k_save_budget_us);
     case 0x2200: {
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = "set events " + clp_bool_to_cli(value);
-      return send_cmd(cmd);
+      connection->events.enabled = value != 0;
+      return send_arg(CLP_CMD_SET_EVENTS, clp_bool_to_cli(value));
     }
     case 0x3000: {
       CLINT32 value = 0;
@@ -1385,75 +4589,107 @@ clpWriteRegister(ISerial *pSerial,
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string mode = (value == 0) ? "automatic" : "manual";
-      std::string cmd = "set fan mode " + mode;
-      return send_cmd(cmd);
+      const char *mode = (value == 0) ? "automatic" : "manual";
+      return send_arg(CLP_CMD_SET_FAN_MODE, mode);
     }
     case 0x3014: {
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = "set fan speed " + clp_format_int(value);
-      return send_cmd(cmd);
+      return send_int(CLP_CMD_SET_FAN_SPEED, value);
     }
     case 0x3024: {
       float value = 0.0f;
       CLINT32 rc = clp_read_float32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = "set voltage vref " + clp_format_float(value);
-      return send_cmd(cmd);
+      return send_float(CLP_CMD_SET_VOLTAGE_VREF, value);
     }
     case 0x3100: {
-      std::string value = clp_buffer_to_string(pBuffer, BufferSize);
-      std::string cmd = "set ip address " + value;
-      return send_cmd(cmd);
+      return send_string(CLP_CMD_SET_IP_ADDRESS);
     }
     case 0x3110: {
-      std::string value = clp_buffer_to_string(pBuffer, BufferSize);
-      std::string cmd = "set ip netmask " + value;
-      return send_cmd(cmd);
+      return send_string(CLP_CMD_SET_IP_NETMASK);
     }
     case 0x3120: {
-      std::string value = clp_buffer_to_string(pBuffer, BufferSize);
-      std::string cmd = "set ip gateway " + value;
-      return send_cmd(cmd);
+      return send_string(CLP_CMD_SET_IP_GATEWAY);
     }
     case 0x3130: {
-      std::string value = clp_buffer_to_string(pBuffer, BufferSize);
-      std::string cmd = "set ip dns " + value;
-      return send_cmd(cmd);
+      return send_string(CLP_CMD_SET_IP_DNS);
     }
     case 0x3140: {
-      std::string value = clp_buffer_to_string(pBuffer, BufferSize);
-      std::string cmd = "set ip alternate-dns " + value;
-      return send_cmd(cmd);
+      return send_string(CLP_CMD_SET_IP_ALTERNATE_DNS);
     }
     case 0x3150: {
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string mode = (value == 0) ? "manual" : "automatic";
-      std::string cmd = "set ip mode " + mode;
-      return send_cmd(cmd);
+      const char *mode = (value == 0) ? "manual" : "automatic";
+      return send_arg(CLP_CMD_SET_IP_MODE, mode);
     }
     case 0x3160: {
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = std::string("set telnet ") + (value ? "enable" : "disable");
-      return send_cmd(cmd);
+      return send_arg(CLP_CMD_SET_TELNET, value ? "enable" : "disable");
     }
     case 0x3164: {
       CLINT32 value = 0;
       CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
       if (rc != CL_ERR_NO_ERR) return rc;
-      std::string cmd = "set remotemaintenance " + clp_bool_to_cli(value);
-      return send_cmd(cmd);
+      return send_arg(CLP_CMD_SET_REMOTEMAINTENANCE, clp_bool_to_cli(value));
     }
     case 0x3170: {
-      std::string value = clp_buffer_to_string(pBuffer, BufferSize);
-      std::string cmd = "set password " + value;
-      return send_cmd(cmd);
+      return send_string(CLP_CMD_SET_PASSWORD);
+    }
+    case 0x4000: {
+      CLINT32 value = 0;
+      CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
+      if (rc != CL_ERR_NO_ERR) return rc;
+      state.stats_command_selector = static_cast<CLUINT32>(value);
+      return CL_ERR_NO_ERR;
+    }
+    case 0x4004: {
+      CLINT32 value = 0;
+      CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
+      if (rc != CL_ERR_NO_ERR) return rc;
+      state.stats_phase_selector = static_cast<CLUINT32>(value);
+      return CL_ERR_NO_ERR;
+    }
+    case 0x4140:
+      clp_reset_counters(&connection->counters);
+      return CL_ERR_NO_ERR;
+    case 0x4144:
+      return clp_collect_acks(connection, pSerial, TimeOut);
+    case 0x4160: {
+      CLINT32 value = 0;
+      CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
+      if (rc != CL_ERR_NO_ERR) return rc;
+      Watchdog &watchdog = connection->watchdog;
+      watchdog.enabled = value != 0;
+      watchdog.missed_prompts = 0;
+      watchdog.status_checked_us = connection->status.refreshed_us;
+      watchdog.uptime_s = connection->status.valid ? connection->status.uptime_s : 0;
+      return CL_ERR_NO_ERR;
+    }
+    case 0x4164: {
+      CLINT32 value = 0;
+      CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
+      if (rc != CL_ERR_NO_ERR) return rc;
+      // Replies owed to earlier setters are read by whoever read them so far.
+      rc = clp_collect_acks(connection, pSerial, TimeOut);
+      if (rc != CL_ERR_NO_ERR) return rc;
+      clp_reader_stop(connection);
+      if (value != 0) {
+        clp_reader_start(connection, pSerial);
+      }
+      return CL_ERR_NO_ERR;
+    }
+    case 0x4190: {
+      CLINT32 value = 0;
+      CLINT32 rc = clp_read_int32(pBuffer, BufferSize, &value);
+      if (rc != CL_ERR_NO_ERR) return rc;
+      connection->event_cache = value != 0;
+      return CL_ERR_NO_ERR;
     }
     default:
       g_last_error = "unknown register address";
@@ -1461,22 +4697,433 @@ clpWriteRegister(ISerial *pSerial,
   }
 }
 
+static std::atomic<CLUINT32> g_next_request(1);
+static std::mutex g_completion_mutex;
+static std::condition_variable g_completion_cv;
+static clp_cred2_completion_t g_completions[k_completion_queue_depth];
+static size_t g_completion_head = 0;
+static size_t g_completion_tail = 0;
+static size_t g_completion_reserved = 0;  // slots held by poll-mode requests still in flight
+
+static void clp_async_complete(const AsyncRequest &request, CLUINT32 cookie, CLINT32 status, const char *error_text) {
+  clp_cred2_completion_t completion;
+  memset(&completion, 0, sizeof(completion));
+  completion.request = request.id;
+  completion.cookie = cookie;
+  completion.address = request.address;
+  completion.status = status;
+  completion.is_write = request.is_write ? 1 : 0;
+  completion.buffer = request.is_write ? NULL : request.read_buffer;
+  completion.buffer_size = request.size;
+  completion.user_data = request.user_data;
+  if (status != CL_ERR_NO_ERR) {
+    strncpy(completion.error_text, error_text, sizeof(completion.error_text) - 1);
+  }
+  if (request.callback) {
+    request.callback(&completion);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(g_completion_mutex);
+    g_completions[g_completion_tail++ % k_completion_queue_depth] = completion;
+    --g_completion_reserved;
+  }
+  g_completion_cv.notify_one();
+}
+
+// The worker holds a reference: a callback that disconnects its own cookie
+// leaves it running on the connection until the callback returns.
+static void clp_async_main(std::shared_ptr<ConnectionState> connection) {
+  AsyncEngine &engine = connection->engine;
+  std::unique_lock<std::mutex> queue_lock(engine.queue_mutex);
+  for (;;) {
+    engine.queue_cv.wait(queue_lock, [&engine] { return engine.stop || engine.head != engine.tail; });
+    if (engine.stop) {
+      return;
+    }
+    const AsyncRequest request = engine.queue[engine.head++ % k_async_queue_depth];
+    if (request.id == 0) {
+      continue;
+    }
+    // Taken under queue_mutex so that clp_async_stop's cancel is after it.
+    const uint32_t ticket = connection->cancel_generation.load();
+    engine.running = request.id;
+    queue_lock.unlock();
+    CLINT32 rc = CL_ERR_NO_ERR;
+    {
+      std::lock_guard<std::mutex> lock(engine.mutex);
+      connection->cancel_ticket = ticket;
+      if (request.is_write) {
+        rc = clp_write_register(connection.get(), request.serial, request.address, request.write_data, request.size,
+                                request.timeout);
+        // Nobody calls clpContinueWriteRegister for an asynchronous write.
+        while (rc == CL_ERR_PENDING_WRITE) {
+          rc = clp_await_long_write(connection.get(), request.serial, request.timeout);
+        }
+      } else {
+        rc = clp_read_register(connection.get(), request.serial, request.address, request.read_buffer, request.size,
+                               request.timeout);
+      }
+      rc = clp_watchdog_check(connection.get(), request.serial, rc);
+    }
+    clp_async_complete(request, connection->cookie, rc, g_last_error.c_str());
+    queue_lock.lock();
+    engine.running = 0;
+  }
+}
+
+// Joins the worker after its current transaction; requests that never ran
+// complete as canceled. Called from a completion callback, the worker is the
+// current thread and is detached instead.
+static void clp_async_stop(ConnectionState *connection) {
+  AsyncEngine &engine = connection->engine;
+  std::thread *worker = NULL;
+  {
+    std::lock_guard<std::mutex> lock(engine.queue_mutex);
+    engine.stop = true;
+    if (engine.running != 0) {
+      connection->cancel_generation.fetch_add(1);
+    }
+    worker = engine.worker;
+    engine.worker = NULL;
+  }
+  engine.queue_cv.notify_all();
+  if (worker) {
+    if (worker->get_id() == std::this_thread::get_id()) {
+      worker->detach();
+    } else {
+      worker->join();
+    }
+    delete worker;
+  }
+  for (; engine.head != engine.tail; ++engine.head) {
+    const AsyncRequest &request = engine.queue[engine.head % k_async_queue_depth];
+    if (request.id != 0) {
+      clp_async_complete(request, connection->cookie, CLP_CRED2_ERR_CANCELED, "connection closed");
+    }
+  }
+}
+
+// Called once the connection is out of g_connections. A synchronous call
+// still inside a transaction is canceled and waited for, so nothing touches
+// the serial port once this returns; calls that arrive later are refused.
+static void clp_close_connection(ConnectionState *connection) {
+  connection->closing = true;
+  { std::lock_guard<std::mutex> lock(connection->engine.mutex); }
+  clp_async_stop(connection);
+  clp_reader_stop(connection);
+}
+
+static void clp_close_all(void) {
+  std::vector<std::shared_ptr<ConnectionState> > connections;
+  {
+    std::lock_guard<std::mutex> lock(g_connections_mutex);
+    connections.swap(g_connections);
+  }
+  for (size_t idx = 0; idx < connections.size(); ++idx) {
+    clp_close_connection(connections[idx].get());
+  }
+  std::lock_guard<std::mutex> lock(g_completion_mutex);
+  g_completion_head = 0;
+  g_completion_tail = 0;
+  g_completion_reserved = 0;
+}
+
+static CLINT32 clp_async_submit(const CLUINT32 cookie, AsyncRequest *request, clp_cred2_request_t *pRequest) {
+  std::shared_ptr<ConnectionState> connection;
+  CLINT32 rc = clp_require_cookie(cookie, &connection);
+  if (rc != CL_ERR_NO_ERR) {
+    return rc;
+  }
+  if (!request->serial) {
+    g_last_error = "serial interface is NULL";
+    return CL_ERR_INVALID_PTR;
+  }
+  if (!request->callback) {
+    std::lock_guard<std::mutex> lock(g_completion_mutex);
+    if (g_completion_tail - g_completion_head + g_completion_reserved >= k_completion_queue_depth) {
+      g_last_error = "completion queue is full";
+      return CL_ERR_IN_USE;
+    }
+    ++g_completion_reserved;
+  }
+  AsyncEngine &engine = connection->engine;
+  {
+    std::lock_guard<std::mutex> lock(engine.queue_mutex);
+    if (connection->closing) {
+      // clp_async_stop has run or is about to; a new worker would outlive the connection.
+      g_last_error = "connection closed";
+      rc = CL_ERR_INVALID_COOKIE;
+    } else if (engine.tail - engine.head < k_async_queue_depth) {
+      CLUINT32 id = g_next_request++;
+      if (id == 0) {
+        id = g_next_request++;
+      }
+      request->id = id;
+      engine.queue[engine.tail++ % k_async_queue_depth] = *request;
+      if (!engine.worker) {
+        engine.stop = false;
+        engine.worker = new std::thread(clp_async_main, connection);
+      }
+      if (pRequest) {
+        *pRequest = id;
+      }
+    } else {
+      g_last_error = "request queue is full";
+      rc = CL_ERR_IN_USE;
+    }
+  }
+  if (rc != CL_ERR_NO_ERR) {
+    if (!request->callback) {
+      std::lock_guard<std::mutex> lock(g_completion_mutex);
+      --g_completion_reserved;
+    }
+    return rc;
+  }
+  engine.queue_cv.notify_one();
+  return CL_ERR_NO_ERR;
+}
+
+// clpReadRegister with single flight (see ReadFlight). Falls back to a read of
+// its own when every slot is taken.
+static CLINT32 clp_read_shared(ConnectionState *connection, ISerial *pSerial, const CLINT64 Address,
+                               CLINT8 *pBuffer, const CLINT64 BufferSize, const CLUINT32 TimeOut) {
+  const uint32_t ticket = connection->cancel_generation.load();
+  ReadFlights &flights = connection->flights;
+  std::unique_lock<std::mutex> flight_lock(flights.mutex);
+  ReadFlight *flight = NULL;
+  for (size_t idx = 0; idx < k_read_flights; ++idx) {
+    ReadFlight &slot = flights.slots[idx];
+    if (slot.active && !slot.started && slot.serial == pSerial && slot.address == Address &&
+        slot.size == BufferSize) {
+      ++slot.followers;
+      flights.cv.wait(flight_lock, [&slot] { return slot.done; });
+      memcpy(pBuffer, slot.data, static_cast<size_t>(BufferSize));
+      const CLINT32 rc = slot.rc;
+      if (rc != CL_ERR_NO_ERR) {
+        g_last_error = slot.error;
+      }
+      if (--slot.followers == 0) {
+        slot.active = false;
+      }
+      clp_count(&connection->counters.coalesced_reads);
+      return rc;
+    }
+    if (!slot.active && !flight) {
+      flight = &slot;
+    }
+  }
+  if (flight) {
+    flight->active = true;
+    flight->started = false;
+    flight->done = false;
+    flight->serial = pSerial;
+    flight->address = Address;
+    flight->size = BufferSize;
+    flight->followers = 0;
+  }
+  flight_lock.unlock();
+
+  CLINT32 rc = CL_ERR_NO_ERR;
+  {
+    std::lock_guard<std::mutex> lock(connection->engine.mutex);
+    if (flight) {
+      std::lock_guard<std::mutex> started_lock(flights.mutex);
+      flight->started = true;
+    }
+    connection->cancel_ticket = ticket;
+    rc = clp_read_register(connection, pSerial, Address, pBuffer, BufferSize, TimeOut);
+    rc = clp_watchdog_check(connection, pSerial, rc);
+  }
+  if (!flight) {
+    return rc;
+  }
+  flight_lock.lock();
+  flight->rc = rc;
+  memcpy(flight->data, pBuffer, static_cast<size_t>(BufferSize));
+  if (rc != CL_ERR_NO_ERR) {
+    strncpy(flight->error, g_last_error.c_str(), sizeof(flight->error) - 1);
+    flight->error[sizeof(flight->error) - 1] = '\0';
+  }
+  flight->done = true;
+  if (flight->followers == 0) {
+    flight->active = false;
+  } else {
+    flights.cv.notify_all();
+  }
+  return rc;
+}
+
+CLPROTOCOLEXPORT CLINT32 CLPROTOCOL
+clpReadRegister(ISerial *pSerial,
+                const CLUINT32 Cookie,
+                const CLINT64 Address,
+                CLINT8 *pBuffer,
+                const CLINT64 BufferSize,
+                const CLUINT32 TimeOut) {
+  std::shared_ptr<ConnectionState> connection;
+  CLINT32 rc = clp_require_cookie(Cookie, &connection);
+  if (rc != CL_ERR_NO_ERR) {
+    return rc;
+  }
+  if (pSerial && pBuffer && BufferSize > 0 && BufferSize <= k_read_flight_max_size) {
+    return clp_read_shared(connection.get(), pSerial, Address, pBuffer, BufferSize, TimeOut);
+  }
+  const uint32_t ticket = connection->cancel_generation.load();
+  std::lock_guard<std::mutex> lock(connection->engine.mutex);
+  connection->cancel_ticket = ticket;
+  rc = clp_read_register(connection.get(), pSerial, Address, pBuffer, BufferSize, TimeOut);
+  rc = clp_watchdog_check(connection.get(), pSerial, rc);
+  return rc;
+}
+
+CLPROTOCOLEXPORT CLINT32 CLPROTOCOL
+clpWriteRegister(ISerial *pSerial,
+                 const CLUINT32 Cookie,
+                 const CLINT64 Address,
+                 const CLINT8 *pBuffer,
+                 const CLINT64 BufferSize,
+                 const CLUINT32 TimeOut) {
+  std::shared_ptr<ConnectionState> connection;
+  CLINT32 rc = clp_require_cookie(Cookie, &connection);
+  if (rc != CL_ERR_NO_ERR) {
+    return rc;
+  }
+  const uint32_t ticket = connection->cancel_generation.load();
+  std::lock_guard<std::mutex> lock(connection->engine.mutex);
+  connection->cancel_ticket = ticket;
+  rc = clp_write_register(connection.get(), pSerial, Address, pBuffer, BufferSize, TimeOut);
+  rc = clp_watchdog_check(connection.get(), pSerial, rc);
+  return rc;
+}
+
+CLPROTOCOLEXPORT CLINT32 CLPROTOCOL
+clpCred2SubmitRead(ISerial *pSerial, const CLUINT32 Cookie, const CLINT64 Address, CLINT8 *pBuffer,
+                   const CLINT64 BufferSize, const CLUINT32 TimeOut, clp_cred2_completion_fn pCallback,
+                   void *pUserData, clp_cred2_request_t *pRequest) {
+  if (!pBuffer || BufferSize <= 0) {
+    g_last_error = "buffer is NULL or empty";
+    return CL_ERR_INVALID_PTR;
+  }
+  AsyncRequest request;
+  memset(&request, 0, sizeof(request));
+  request.serial = pSerial;
+  request.address = Address;
+  request.read_buffer = pBuffer;
+  request.size = BufferSize;
+  request.timeout = TimeOut;
+  request.callback = pCallback;
+  request.user_data = pUserData;
+  return clp_async_submit(Cookie, &request, pRequest);
+}
+
+CLPROTOCOLEXPORT CLINT32 CLPROTOCOL
+clpCred2SubmitWrite(ISerial *pSerial, const CLUINT32 Cookie, const CLINT64 Address, const CLINT8 *pBuffer,
+                    const CLINT64 BufferSize, const CLUINT32 TimeOut, clp_cred2_completion_fn pCallback,
+                    void *pUserData, clp_cred2_request_t *pRequest) {
+  if (!pBuffer || BufferSize <= 0) {
+    g_last_error = "buffer is NULL or empty";
+    return CL_ERR_INVALID_PTR;
+  }
+  if (BufferSize > CLP_CRED2_MAX_ASYNC_WRITE_SIZE) {
+    g_last_error = "write is larger than CLP_CRED2_MAX_ASYNC_WRITE_SIZE";
+    return CL_ERR_PARAM_DATA_SIZE;
+  }
+  AsyncRequest request;
+  memset(&request, 0, sizeof(request));
+  request.serial = pSerial;
+  request.address = Address;
+  request.size = BufferSize;
+  request.timeout = TimeOut;
+  request.is_write = true;
+  request.callback = pCallback;
+  request.user_data = pUserData;
+  memcpy(request.write_data, pBuffer, static_cast<size_t>(BufferSize));
+  return clp_async_submit(Cookie, &request, pRequest);
+}
+
+CLPROTOCOLEXPORT CLINT32 CLPROTOCOL
+clpCred2PollCompletion(clp_cred2_completion_t *pCompletion, const CLUINT32 TimeOut) {
+  if (!pCompletion) {
+    g_last_error = "completion is NULL";
+    return CL_ERR_INVALID_PTR;
+  }
+  std::unique_lock<std::mutex> lock(g_completion_mutex);
+  if (!g_completion_cv.wait_for(lock, std::chrono::milliseconds(TimeOut),
+                                [] { return g_completion_head != g_completion_tail; })) {
+    g_last_error = "no completion";
+    return CL_ERR_TIMEOUT;
+  }
+  *pCompletion = g_completions[g_completion_head++ % k_completion_queue_depth];
+  return CL_ERR_NO_ERR;
+}
+
+CLPROTOCOLEXPORT CLINT32 CLPROTOCOL
+clpCred2Cancel(const clp_cred2_request_t Request) {
+  std::vector<std::shared_ptr<ConnectionState> > connections;
+  {
+    std::lock_guard<std::mutex> lock(g_connections_mutex);
+    connections = g_connections;
+  }
+  for (size_t idx = 0; Request != 0 && idx < connections.size(); ++idx) {
+    ConnectionState *connection = connections[idx].get();
+    AsyncEngine &engine = connection->engine;
+    std::unique_lock<std::mutex> lock(engine.queue_mutex);
+    if (engine.running == Request) {
+      g_last_error = "request is in progress";
+      return CL_ERR_IN_USE;
+    }
+    for (size_t pos = engine.head; pos != engine.tail; ++pos) {
+      AsyncRequest &slot = engine.queue[pos % k_async_queue_depth];
+      if (slot.id == Request) {
+        const AsyncRequest request = slot;
+        slot.id = 0;
+        lock.unlock();
+        clp_async_complete(request, connection->cookie, CLP_CRED2_ERR_CANCELED, "request canceled");
+        return CL_ERR_NO_ERR;
+      }
+    }
+  }
+  g_last_error = "unknown or finished request";
+  return CL_ERR_INVALID_REFERENCE;
+}
+
 CLPROTOCOLEXPORT CLINT32 CLPROTOCOL
 clpContinueWriteRegister(ISerial *pSerial,
                          const CLUINT32 Cookie,
                          const BOOL8 ContinueWaiting,
                          const CLUINT32 TimeOut) {
-  (void)pSerial;
-  (void)ContinueWaiting;
-  (void)TimeOut;
-
-  CLINT32 rc = clp_require_cookie(Cookie);
+  std::shared_ptr<ConnectionState> connection;
+  CLINT32 rc = clp_require_cookie(Cookie, &connection);
   if (rc != CL_ERR_NO_ERR) {
     return rc;
   }
-
-  g_last_error = "continue write not implemented";
-  return CL_ERR_INVALID_REFERENCE;
+  const uint32_t ticket = connection->cancel_generation.load();
+  std::lock_guard<std::mutex> lock(connection->engine.mutex);
+  connection->cancel_ticket = ticket;
+  if (connection->closing) {
+    g_last_error = "connection closed";
+    return CL_ERR_INVALID_COOKIE;
+  }
+  LongWrite &write = connection->long_write;
+  if (!write.active) {
+    g_last_error = "no write is pending";
+    return CL_ERR_INVALID_REFERENCE;
+  }
+  if (!ContinueWaiting) {
+    // The camera still finishes and answers; the next command drains that reply.
+    write.active = false;
+    connection->pending.count = 0;
+    connection->pending.size = 0;
+    connection->stream_dirty = true;
+    CLP_LOG(CLP_LOG_WARN, connection->cookie, "long_write", "abandoned=1");
+    return CL_ERR_NO_ERR;
+  }
+  if (!pSerial) {
+    g_last_error = "serial interface is NULL";
+    return CL_ERR_INVALID_PTR;
+  }
+  return clp_await_long_write(connection.get(), pSerial, TimeOut);
 }
 
 CLPROTOCOLEXPORT CLINT32 CLPROTOCOL
@@ -1505,14 +5152,23 @@ clpGetErrorText(CLINT32 errorCode, CLINT8 *errorText, CLUINT32 *errorTextSize, c
 
 CLPROTOCOLEXPORT CLINT32 CLPROTOCOL
 clpDisconnect(const CLUINT32 Cookie) {
-  for (size_t idx = 0; idx < g_connections.size(); ++idx) {
-    if (g_connections[idx].cookie == Cookie) {
-      g_connections.erase(g_connections.begin() + idx);
-      return CL_ERR_NO_ERR;
+  std::shared_ptr<ConnectionState> connection;
+  {
+    std::lock_guard<std::mutex> lock(g_connections_mutex);
+    for (size_t idx = 0; idx < g_connections.size(); ++idx) {
+      if (g_connections[idx]->cookie == Cookie) {
+        connection = g_connections[idx];
+        g_connections.erase(g_connections.begin() + idx);
+        break;
+      }
     }
   }
-  g_last_error = "invalid cookie";
-  return CL_ERR_INVALID_COOKIE;
+  if (!connection) {
+    g_last_error = "invalid cookie";
+    return CL_ERR_INVALID_COOKIE;
+  }
+  clp_close_connection(connection.get());
+  return CL_ERR_NO_ERR;
 }
 
 CLPROTOCOLEXPORT CLINT32 CLPROTOCOL
@@ -1539,17 +5195,17 @@ clpGetParam(ISerial *pSerial,
     return CL_ERR_PARAM_DATA_SIZE;
   }
 
-  switch (param) {
+  switch (static_cast<CLINT32>(param)) {
     case CLP_LOG_LEVEL: {
       if (BufferSize < (CLINT64)sizeof(CLUINT32)) {
         return CL_ERR_PARAM_DATA_SIZE;
       }
-      CLUINT32 value = (CLUINT32)g_log_level;
+      CLUINT32 value = (CLUINT32)g_log_level.load();
       memcpy(pBuffer, &value, sizeof(value));
       return CL_ERR_NO_ERR;
     }
     case CLP_LOG_CALLBACK: {
-      const uintptr_t value = (uintptr_t)g_logger;
+      const uintptr_t value = (uintptr_t)g_logger.load();
       if (BufferSize < (CLINT64)sizeof(value)) {
         return CL_ERR_PARAM_DATA_SIZE;
       }
@@ -1565,7 +5221,7 @@ clpGetParam(ISerial *pSerial,
       return CL_ERR_NO_ERR;
     }
     case CLP_DEVICE_BAUDERATE: {
-      ConnectionState *connection = NULL;
+      std::shared_ptr<ConnectionState> connection;
       CLINT32 rc = clp_require_cookie(Cookie, &connection);
       if (rc != CL_ERR_NO_ERR) {
         return rc;
@@ -1577,7 +5233,7 @@ clpGetParam(ISerial *pSerial,
       return CL_ERR_NO_ERR;
     }
     case CLP_DEVICE_SUPPORTED_BAUDERATES: {
-      ConnectionState *connection = NULL;
+      std::shared_ptr<ConnectionState> connection;
       CLINT32 rc = clp_require_cookie(Cookie, &connection);
       if (rc != CL_ERR_NO_ERR) {
         return rc;
@@ -1595,6 +5251,29 @@ clpGetParam(ISerial *pSerial,
       memcpy(pBuffer, &connection->supported_baudrates, sizeof(connection->supported_baudrates));
       return CL_ERR_NO_ERR;
     }
+    case CLP_CRED2_TRANSPORT_COUNTERS: {
+      std::shared_ptr<ConnectionState> connection;
+      CLINT32 rc = clp_require_cookie(Cookie, &connection);
+      if (rc != CL_ERR_NO_ERR) {
+        return rc;
+      }
+      if (BufferSize < (CLINT64)sizeof(clp_cred2_transport_counters_t)) {
+        return CL_ERR_PARAM_DATA_SIZE;
+      }
+      const clp_cred2_transport_counters_t counters = clp_snapshot_counters(connection->counters);
+      memcpy(pBuffer, &counters, sizeof(counters));
+      return CL_ERR_NO_ERR;
+    }
+    case CLP_CRED2_FLIGHT_RECORDER: {
+      std::shared_ptr<ConnectionState> connection;
+      CLINT32 rc = clp_require_cookie(Cookie, &connection);
+      if (rc != CL_ERR_NO_ERR) {
+        return rc;
+      }
+      std::lock_guard<std::mutex> lock(connection->engine.mutex);
+      clp_flight_dump(connection->flight, reinterpret_cast<char *>(pBuffer), static_cast<size_t>(BufferSize));
+      return CL_ERR_NO_ERR;
+    }
     default:
       return CL_ERR_PARAM_NOT_SUPPORTED;
   }
@@ -1613,14 +5292,15 @@ clpSetParam(ISerial *pSerial,
     return CL_ERR_PARAM_DATA_SIZE;
   }
 
-  switch (param) {
+  switch (static_cast<CLINT32>(param)) {
     case CLP_LOG_LEVEL: {
       if (BufferSize < (CLINT64)sizeof(CLUINT32)) {
         return CL_ERR_PARAM_DATA_SIZE;
       }
       CLUINT32 value = 0;
       memcpy(&value, pBuffer, sizeof(value));
-      g_log_level = (CLP_LOG_LEVEL_VALUE)value;
+      g_log_level = static_cast<int>(value);
+      clp_update_log_threshold();
       return CL_ERR_NO_ERR;
     }
     case CLP_LOG_CALLBACK: {
@@ -1630,6 +5310,7 @@ clpSetParam(ISerial *pSerial,
       }
       memcpy(&value, pBuffer, sizeof(value));
       g_logger = (clp_logger_t)value;
+      clp_update_log_threshold();
       return CL_ERR_NO_ERR;
     }
     case CLP_STOP_PROBE_DEVICE: {
@@ -1642,7 +5323,7 @@ clpSetParam(ISerial *pSerial,
       return CL_ERR_NO_ERR;
     }
     case CLP_DEVICE_BAUDERATE: {
-      ConnectionState *connection = NULL;
+      std::shared_ptr<ConnectionState> connection;
       CLINT32 rc = clp_require_cookie(Cookie, &connection);
       if (rc != CL_ERR_NO_ERR) {
         return rc;
@@ -1677,7 +5358,28 @@ clpSetParam(ISerial *pSerial,
       return CL_ERR_NO_ERR;
     }
     case CLP_DEVICE_SUPPORTED_BAUDERATES:
+    case CLP_CRED2_TRANSPORT_COUNTERS:
+    case CLP_CRED2_FLIGHT_RECORDER:
       return CL_ERR_PARAM_READ_ONLY;
+    case CLP_CRED2_TRANSPORT_COUNTERS_RESET: {
+      std::shared_ptr<ConnectionState> connection;
+      CLINT32 rc = clp_require_cookie(Cookie, &connection);
+      if (rc != CL_ERR_NO_ERR) {
+        return rc;
+      }
+      clp_reset_counters(&connection->counters);
+      return CL_ERR_NO_ERR;
+    }
+    case CLP_CRED2_CANCEL_TRANSACTION: {
+      // Deliberately not under engine.mutex: the transaction to cancel holds it.
+      std::shared_ptr<ConnectionState> connection;
+      CLINT32 rc = clp_require_cookie(Cookie, &connection);
+      if (rc != CL_ERR_NO_ERR) {
+        return rc;
+      }
+      connection->cancel_generation.fetch_add(1);
+      return CL_ERR_NO_ERR;
+    }
     default:
       return CL_ERR_PARAM_NOT_SUPPORTED;
   }
@@ -1685,12 +5387,16 @@ clpSetParam(ISerial *pSerial,
 
 CLPROTOCOLEXPORT CLINT32 CLPROTOCOL
 clpIsParamSupported(CLP_PARAMS param) {
-  switch (param) {
+  switch (static_cast<CLINT32>(param)) {
     case CLP_LOG_LEVEL:
     case CLP_LOG_CALLBACK:
     case CLP_STOP_PROBE_DEVICE:
     case CLP_DEVICE_BAUDERATE:
     case CLP_DEVICE_SUPPORTED_BAUDERATES:
+    case CLP_CRED2_TRANSPORT_COUNTERS:
+    case CLP_CRED2_TRANSPORT_COUNTERS_RESET:
+    case CLP_CRED2_FLIGHT_RECORDER:
+    case CLP_CRED2_CANCEL_TRANSACTION:
       return CL_ERR_NO_ERR;
     default:
       return CL_ERR_PARAM_NOT_SUPPORTED;
@@ -1699,13 +5405,36 @@ clpIsParamSupported(CLP_PARAMS param) {
 
 CLPROTOCOLEXPORT CLINT32 CLPROTOCOL
 clpGetEventData(const CLUINT32 Cookie, CLINT8 *pBuffer, CLUINT32 *pBufferSize) {
-  (void)pBuffer;
-  CLINT32 rc = clp_require_cookie(Cookie);
+  std::shared_ptr<ConnectionState> connection;
+  CLINT32 rc = clp_require_cookie(Cookie, &connection);
   if (rc != CL_ERR_NO_ERR) {
     return rc;
   }
-  if (pBufferSize) {
+  if (!pBufferSize) {
+    g_last_error = "buffer size is NULL";
+    return CL_ERR_INVALID_PTR;
+  }
+  EventRing &ring = connection->events;
+  const size_t head = ring.head.load(std::memory_order_relaxed);
+  if (head == ring.tail.load(std::memory_order_acquire)) {
     *pBufferSize = 0;
+    return CL_ERR_TIMEOUT;
+  }
+  // "ts_us=<monotonic microseconds> <event line>", NUL-terminated.
+  const EventRecord &record = ring.records[head & (k_event_ring_size - 1)];
+  char prefix[32];
+  const int prefix_len = std::snprintf(prefix, sizeof(prefix), "ts_us=%llu ",
+                                       static_cast<unsigned long long>(record.ts_us));
+  const CLUINT32 needed = static_cast<CLUINT32>(prefix_len + record.size + 1);
+  if (!pBuffer || *pBufferSize < needed) {
+    *pBufferSize = needed;
+    return CL_ERR_BUFFER_TOO_SMALL;
   }
-  return CL_ERR_TIMEOUT;
+  char *out = reinterpret_cast<char *>(pBuffer);
+  memcpy(out, prefix, static_cast<size_t>(prefix_len));
+  memcpy(out + prefix_len, record.text, record.size);
+  out[needed - 1] = '\0';
+  *pBufferSize = needed;
+  ring.head.store(head + 1, std::memory_order_release);
+  return CL_ERR_NO_ERR;
 }
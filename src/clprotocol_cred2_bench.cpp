@@ -0,0 +1,382 @@
+// Micro-benchmarks for the driver's hot paths. The driver source is included
+// directly so that its internal helpers can be timed without exporting them.
+//
+// Build and run with `make bench`. Numbers are wall-clock nanoseconds per
+// operation on the host machine and are only meaningful relative to each other.
+// The polling benchmarks run the exported API against a fake camera and count
+// the commands it is sent.
+
+#include "clprotocol_cred2.cpp"
+
+#include <cinttypes>
+#include <map>
+
+namespace {
+
+static volatile uint64_t g_bench_sink = 0;
+
+template <typename Fn>
+static void bench(const char *name, size_t iterations, Fn fn) {
+  uint64_t checksum = 0;
+  for (size_t idx = 0; idx < iterations / 10; ++idx) {
+    checksum += fn(idx);
+  }
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t idx = 0; idx < iterations; ++idx) {
+    checksum += fn(idx);
+  }
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  g_bench_sink = g_bench_sink + checksum;
+  const double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  std::printf("%-44s %10.2f ns/op\n", name, ns / static_cast<double>(iterations));
+}
+
+// Command construction as it was before the command table: the prefix is
+// measured and copied at runtime, the argument goes through snprintf and the
+// statistics verb is looked up by scanning the verb list.
+static size_t runtime_verb_index(const char *cmd, size_t cmd_len) {
+  const char *space = static_cast<const char *>(memchr(cmd, ' ', cmd_len));
+  const size_t len = space ? static_cast<size_t>(space - cmd) : cmd_len;
+  for (size_t idx = 1; idx < k_command_verb_count; ++idx) {
+    if (strncmp(cmd, k_command_verbs[idx], len) == 0 && k_command_verbs[idx][len] == '\0') {
+      return idx;
+    }
+  }
+  return 0;
+}
+
+static void runtime_build(CommandBuffer *cmd, const char *prefix, const CLINT32 *argument) {
+  cmd->size = 0;
+  cmd->overflow = false;
+  clp_cmd_append(cmd, prefix);
+  if (argument) {
+    char buf[16];
+    const int len = std::snprintf(buf, sizeof(buf), "%d", *argument);
+    clp_cmd_append_bytes(cmd, buf, static_cast<size_t>(len));
+  }
+  cmd->data[cmd->size] = '\n';
+  cmd->verb = runtime_verb_index(cmd->data, cmd->size);
+}
+
+static void bench_command_construction() {
+  const size_t iterations = 2000000;
+  CommandBuffer cmd;
+
+  bench("command/query std::string", iterations, [&](size_t) -> uint64_t {
+    std::string text = std::string("temperatures snake setpoint") + " raw" + "\n";
+    return text.size() + static_cast<unsigned char>(text[0]);
+  });
+  bench("command/query runtime builder", iterations, [&](size_t) -> uint64_t {
+    runtime_build(&cmd, "temperatures snake setpoint raw", NULL);
+    return cmd.size + cmd.verb;
+  });
+  bench("command/query template", iterations, [&](size_t) -> uint64_t {
+    clp_cmd_begin(&cmd, CLP_CMD_TEMPERATURES_SNAKE_SETPOINT);
+    return cmd.size + cmd.verb;
+  });
+
+  bench("command/setter std::string", iterations, [&](size_t idx) -> uint64_t {
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), "%d", static_cast<CLINT32>(idx & 0x3ff));
+    std::string text = std::string("set cropping columns ") + buf + "\n";
+    return text.size() + static_cast<unsigned char>(text[0]);
+  });
+  bench("command/setter runtime builder", iterations, [&](size_t idx) -> uint64_t {
+    const CLINT32 value = static_cast<CLINT32>(idx & 0x3ff);
+    runtime_build(&cmd, "set cropping columns ", &value);
+    return cmd.size + cmd.verb;
+  });
+  bench("command/setter template", iterations, [&](size_t idx) -> uint64_t {
+    clp_cmd_begin(&cmd, CLP_CMD_SET_CROPPING_COLUMNS);
+    clp_cmd_append_int(&cmd, static_cast<CLINT32>(idx & 0x3ff));
+    return cmd.size + cmd.verb;
+  });
+
+  static const float tints[] = {0.000123f, 0.5f, 12.25f, 0.0000375f, 1.0f, 3.3333333f};
+  bench("command/float snprintf %.6f", iterations, [&](size_t idx) -> uint64_t {
+    char buf[64];
+    return static_cast<uint64_t>(std::snprintf(buf, sizeof(buf), "%.6f", tints[idx % 6])) + buf[0];
+  });
+  bench("command/float shortest", iterations, [&](size_t idx) -> uint64_t {
+    char buf[k_float_text_size];
+    return clp_format_float(tints[idx % 6], buf) + buf[0];
+  });
+}
+
+static void bench_number_parsing() {
+  static const char *const replies[] = {"123.0", "-40.25", "0.000125", "12.5 ms", "1.5e-3", "640",
+                                        "27.3125", "85 %", "-0.5", "3000.000000"};
+  const size_t reply_count = sizeof(replies) / sizeof(replies[0]);
+  TextView views[reply_count];
+  size_t total_bytes = 0;
+  for (size_t idx = 0; idx < reply_count; ++idx) {
+    views[idx] = clp_view(replies[idx]);
+    total_bytes += views[idx].size;
+  }
+  const size_t iterations = 4000000;
+
+  bench("number/strtod", iterations, [&](size_t idx) -> uint64_t {
+    char *end = NULL;
+    const double value = strtod(replies[idx % reply_count], &end);
+    return static_cast<uint64_t>(static_cast<int64_t>(value * 16.0)) + static_cast<uint64_t>(end - replies[idx % reply_count]);
+  });
+  bench("number/clp_parse_number", iterations, [&](size_t idx) -> uint64_t {
+    double value = 0.0;
+    size_t error_offset = 0;
+    const bool ok = clp_parse_number(views[idx % reply_count], &value, &error_offset);
+    return static_cast<uint64_t>(static_cast<int64_t>(value * 16.0)) + (ok ? 1 : 0);
+  });
+  std::printf("%-44s %10.2f bytes/reply\n", "number/average reply", static_cast<double>(total_bytes) / reply_count);
+}
+
+// Line/field splitting as a byte-at-a-time loop, for comparison with the
+// vectorized clp_next_field.
+static bool bytewise_next_field(TextView *rest, FieldView *field) {
+  const char *data = rest->data;
+  const size_t size = rest->size;
+  size_t pos = 0;
+  while (pos < size && (data[pos] == '\r' || data[pos] == '\n')) {
+    ++pos;
+  }
+  if (pos == size) {
+    rest->size = 0;
+    return false;
+  }
+  const size_t start = pos;
+  size_t separator = size;
+  for (; pos < size && data[pos] != '\r' && data[pos] != '\n'; ++pos) {
+    if (separator == size && (data[pos] == ':' || data[pos] == '=')) {
+      separator = pos;
+    }
+  }
+  TextView line = {data + start, pos - start};
+  field->line = clp_trim_view(line);
+  field->has_value = separator != size;
+  if (field->has_value) {
+    TextView key = {data + start, separator - start};
+    TextView value = {data + separator + 1, pos - separator - 1};
+    field->key = clp_trim_view(key);
+    field->value = clp_trim_view(value);
+  }
+  rest->data += pos;
+  rest->size -= pos;
+  return true;
+}
+
+static const char *scan_path_name(ScanPath path) {
+  return path == CLP_SCAN_AVX2 ? "avx2" : path == CLP_SCAN_SSE2 ? "sse2" : "scalar";
+}
+
+static void bench_reply_tokenizer() {
+  // A long multi-line reply in the shape of "status detailed" / "licenses".
+  std::string reply;
+  for (int idx = 0; reply.size() < 3500; ++idx) {
+    reply += "sensor " + std::to_string(idx) + " temperature reading    : " + std::to_string(20 + idx % 7) +
+             ".125 C\r\n";
+    reply += "license_feature_" + std::to_string(idx) + ".lic valid until 2030-01-01 for host cred2\r\n";
+  }
+  const TextView whole = {reply.data(), reply.size()};
+
+  // All scanners must agree before anything is timed.
+  for (size_t pos = 0; pos <= reply.size(); ++pos) {
+    const size_t expected = clp_find_delimiter_scalar(reply.data(), reply.size(), pos);
+    if (clp_find_delimiter(reply.data(), reply.size(), pos) != expected) {
+      std::printf("tokenizer mismatch at %u\n", static_cast<unsigned>(pos));
+      std::exit(1);
+    }
+  }
+
+  const size_t iterations = 20000;
+  std::printf("%-44s %10s (%u-byte reply)\n", "tokenizer/active path", scan_path_name(g_scan_path),
+              static_cast<unsigned>(reply.size()));
+  bench("tokenizer/byte-at-a-time", iterations, [&](size_t) -> uint64_t {
+    TextView rest = whole;
+    FieldView field;
+    uint64_t total = 0;
+    while (bytewise_next_field(&rest, &field)) {
+      total += field.value.size + field.key.size;
+    }
+    return total;
+  });
+  bench("tokenizer/clp_next_field", iterations, [&](size_t) -> uint64_t {
+    TextView rest = whole;
+    FieldView field;
+    uint64_t total = 0;
+    while (clp_next_field(&rest, &field)) {
+      total += field.value.size + field.key.size;
+    }
+    return total;
+  });
+}
+
+// Serial fake for the driver-level benchmarks, safe to read from the reader
+// thread: a write found in answers queues that reply, inject() adds
+// unsolicited input and reads wait up to their timeout for input. Each write
+// takes latency, like a command going out over the link.
+class BenchSerial : public ISerial {
+ public:
+  std::map<std::string, std::string> answers;
+  std::chrono::microseconds latency{0};
+
+  void inject(const std::string &bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    input_ += bytes;
+    cv_.notify_all();
+  }
+
+  CLINT32 CLPROTOCOL clSerialRead(CLINT8 *buffer, CLUINT32 *bufferSize, CLUINT32 timeout) override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!cv_.wait_for(lock, std::chrono::milliseconds(timeout), [this] { return !input_.empty(); })) {
+      *bufferSize = 0;
+      return CL_ERR_TIMEOUT;
+    }
+    const CLUINT32 to_copy = std::min(*bufferSize, static_cast<CLUINT32>(input_.size()));
+    memcpy(buffer, input_.data(), to_copy);
+    input_.erase(0, to_copy);
+    *bufferSize = to_copy;
+    return CL_ERR_NO_ERR;
+  }
+
+  CLINT32 CLPROTOCOL clSerialWrite(CLINT8 *buffer, CLUINT32 *bufferSize, CLUINT32) override {
+    std::this_thread::sleep_for(latency);
+    std::lock_guard<std::mutex> lock(mutex_);
+    const std::map<std::string, std::string>::const_iterator answer =
+        answers.find(std::string(reinterpret_cast<const char *>(buffer), *bufferSize));
+    if (answer != answers.end()) {
+      input_ += answer->second;
+      cv_.notify_all();
+    }
+    return CL_ERR_NO_ERR;
+  }
+
+  CLINT32 CLPROTOCOL clGetSupportedBaudRates(CLUINT32 *baudRates) override {
+    *baudRates = CL_BAUDRATE_9600 | CL_BAUDRATE_115200;
+    return CL_ERR_NO_ERR;
+  }
+
+  CLINT32 CLPROTOCOL clSetBaudRate(CLUINT32) override { return CL_ERR_NO_ERR; }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::string input_;
+};
+
+static CLINT64 bench_commands(BenchSerial *serial, CLUINT32 cookie) {
+  clp_cred2_transport_counters_t counters;
+  clpGetParam(serial, CLP_CRED2_TRANSPORT_COUNTERS, cookie, reinterpret_cast<CLINT8 *>(&counters), sizeof(counters),
+              100);
+  return counters.commands;
+}
+
+static void bench_write_flag(BenchSerial *serial, CLUINT32 cookie, CLINT64 address, CLINT32 value) {
+  CLINT8 buf[4];
+  memcpy(buf, &value, sizeof(value));
+  clpWriteRegister(serial, cookie, address, buf, sizeof(buf), 100);
+}
+
+// DeviceStatusState polled every 5 ms for about a second, with the status cache
+// held for its 250 ms TTL and then held until an event. One status event
+// arrives halfway through each run. Counts the commands sent to the camera.
+static void bench_status_polling() {
+  BenchSerial serial;
+  serial.answers["\n"] = "\r\nfli-cli>";
+  serial.answers["set events on\n"] = "\r\nfli-cli>";
+  serial.answers["status detailed raw\n"] = "state: operational\r\nuptime: 00:10:00\r\nfli-cli>";
+  clpInitLib(NULL, CLP_LOG_FATAL);
+  CLINT8 device_id[256];
+  CLUINT32 device_id_size = sizeof(device_id);
+  CLUINT32 cookie = 0;
+  clpProbeDevice(&serial, reinterpret_cast<const CLINT8 *>("FirstLightImaging#CRED2#CRED2"), device_id,
+                 &device_id_size, &cookie, 100);
+  bench_write_flag(&serial, cookie, 0x4164, 1);
+  bench_write_flag(&serial, cookie, 0x2200, 1);
+  bench_write_flag(&serial, cookie, 0x4144, 1);
+
+  for (int event_driven = 0; event_driven < 2; ++event_driven) {
+    bench_write_flag(&serial, cookie, 0x4190, event_driven);
+    const CLINT64 before = bench_commands(&serial, cookie);
+    const auto start = std::chrono::steady_clock::now();
+    for (int poll = 0; poll < 200; ++poll) {
+      if (poll == 100) {
+        serial.inject("event: status operational\r\n");
+      }
+      CLINT8 buf[4];
+      clpReadRegister(&serial, cookie, 0x02C0, buf, sizeof(buf), 1000);
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("%-44s %10.2f commands/s\n", event_driven ? "cache/status poll 200 Hz, event-driven" :
+                                                            "cache/status poll 200 Hz, 250 ms TTL",
+                static_cast<double>(bench_commands(&serial, cookie) - before) / seconds);
+  }
+  clpCloseLib();
+}
+
+// A register read the way clpReadRegister did it before single flight: every
+// caller waits for the connection and sends its own command.
+static CLINT32 plain_read(BenchSerial *serial, CLUINT32 cookie, CLINT64 address, CLINT8 *buf, CLINT64 size) {
+  std::shared_ptr<ConnectionState> connection;
+  CLINT32 rc = clp_require_cookie(cookie, &connection);
+  if (rc != CL_ERR_NO_ERR) {
+    return rc;
+  }
+  std::lock_guard<std::mutex> lock(connection->engine.mutex);
+  return clp_read_register(connection.get(), serial, address, buf, size, 1000);
+}
+
+// Four threads each read DeviceTemperature 100 times over a link with 1 ms
+// of command latency, with and without single flight.
+static void bench_read_contention() {
+  BenchSerial serial;
+  serial.answers["\n"] = "\r\nfli-cli>";
+  serial.answers["temperatures motherboard raw\n"] = "41.25\r\nfli-cli>";
+  serial.latency = std::chrono::microseconds(1000);
+  clpInitLib(NULL, CLP_LOG_FATAL);
+  CLINT8 device_id[256];
+  CLUINT32 device_id_size = sizeof(device_id);
+  CLUINT32 cookie = 0;
+  clpProbeDevice(&serial, reinterpret_cast<const CLINT8 *>("FirstLightImaging#CRED2#CRED2"), device_id,
+                 &device_id_size, &cookie, 100);
+
+  const int threads = 4;
+  const int reads = 100;
+  for (int coalesced = 0; coalesced < 2; ++coalesced) {
+    const CLINT64 before = bench_commands(&serial, cookie);
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int idx = 0; idx < threads; ++idx) {
+      workers.push_back(std::thread([&serial, cookie, coalesced] {
+        for (int read = 0; read < reads; ++read) {
+          CLINT8 buf[4];
+          if (coalesced) {
+            clpReadRegister(&serial, cookie, 0x2004, buf, sizeof(buf), 1000);
+          } else {
+            plain_read(&serial, cookie, 0x2004, buf, sizeof(buf));
+          }
+        }
+      }));
+    }
+    for (size_t idx = 0; idx < workers.size(); ++idx) {
+      workers[idx].join();
+    }
+    const double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    const CLINT64 commands = bench_commands(&serial, cookie) - before;
+    std::printf("%-44s %10u commands %8.1f us/read\n",
+                coalesced ? "contention/4x100 reads, single flight" : "contention/4x100 reads, one command each",
+                static_cast<unsigned>(commands), us / (threads * reads));
+  }
+  clpCloseLib();
+}
+
+}  // namespace
+
+int main() {
+  bench_command_construction();
+  bench_number_parsing();
+  bench_reply_tokenizer();
+  bench_status_polling();
+  bench_read_contention();
+  std::printf("checksum %" PRIu64 "\n", static_cast<uint64_t>(g_bench_sink));
+  return 0;
+}
@@ -2,28 +2,85 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <clocale>
+#include <cmath>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <new>
 #include <queue>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <CLProtocol/ISerial.h>
 
+// Counts heap allocations made by the calling thread so the tests can check
+// that the steady-state register path does not allocate.
+static thread_local size_t g_thread_allocations = 0;
+
+void *operator new(std::size_t size) {
+  ++g_thread_allocations;
+  void *ptr = std::malloc(size ? size : 1);
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
+
 namespace {
 
+// Serial fake with scripted replies. A single setter written on its own is
+// acknowledged like the camera does, ahead of the scripted replies, with
+// ack_reply; a write found in answers gets that reply the same way. Other
+// batches and queries are answered from reads only. Reads that do not wait
+// (timeout 0) only see stale, the bytes already sitting in the input.
 class FakeSerial : public ISerial {
  public:
   std::string last_write;
   std::queue<std::string> reads;
+  std::string stale;
+  std::string acks;
+  std::string ack_reply = "\r\nfli-cli>";
+  std::map<std::string, std::string> answers;
   bool fail_writes = false;
   CLUINT32 supported_baudrates = CL_BAUDRATE_9600 | CL_BAUDRATE_115200;
   std::vector<CLUINT32> set_baud_calls;
 
-  CLINT32 CLPROTOCOL clSerialRead(CLINT8 *buffer, CLUINT32 *bufferSize, CLUINT32) override {
+  CLINT32 CLPROTOCOL clSerialRead(CLINT8 *buffer, CLUINT32 *bufferSize, CLUINT32 timeout) override {
     if (!buffer || !bufferSize) {
       return CL_ERR_INVALID_PTR;
     }
+    if (timeout == 0) {
+      if (stale.empty()) {
+        return CL_ERR_TIMEOUT;
+      }
+      const CLUINT32 to_copy = std::min(*bufferSize, static_cast<CLUINT32>(stale.size()));
+      memcpy(buffer, stale.data(), to_copy);
+      stale.erase(0, to_copy);
+      *bufferSize = to_copy;
+      return CL_ERR_NO_ERR;
+    }
+    if (!acks.empty()) {
+      const CLUINT32 to_copy = std::min(*bufferSize, static_cast<CLUINT32>(acks.size()));
+      memcpy(buffer, acks.data(), to_copy);
+      acks.erase(0, to_copy);
+      *bufferSize = to_copy;
+      return CL_ERR_NO_ERR;
+    }
     if (reads.empty()) {
       return CL_ERR_TIMEOUT;
     }
@@ -43,6 +100,15 @@ class FakeSerial : public ISerial {
       return CL_ERR_TIMEOUT;
     }
     last_write.assign(reinterpret_cast<char *>(buffer), reinterpret_cast<char *>(buffer) + *bufferSize);
+    if (last_write.find('\n') + 1 == last_write.size() &&
+        (last_write.compare(0, 4, "set ") == 0 || last_write == "shutdown\n" || last_write == "continue\n" ||
+         last_write == "restorefactory\n" || last_write == "save\n")) {
+      acks += ack_reply;
+    } else if (last_write == "\n") {
+      acks += "\r\nfli-cli>";
+    } else if (answers.count(last_write)) {
+      acks += answers[last_write];
+    }
     return CL_ERR_NO_ERR;
   }
 
@@ -63,6 +129,192 @@ class FakeSerial : public ISerial {
   }
 };
 
+// Serial fake that answers every read with a fixed reply and never allocates.
+class StaticSerial : public ISerial {
+ public:
+  const char *reply = "";
+
+  CLINT32 CLPROTOCOL clSerialRead(CLINT8 *buffer, CLUINT32 *bufferSize, CLUINT32 timeout) override {
+    if (timeout == 0) {
+      return CL_ERR_TIMEOUT;
+    }
+    const CLUINT32 to_copy = std::min(*bufferSize, static_cast<CLUINT32>(strlen(reply)));
+    memcpy(buffer, reply, to_copy);
+    *bufferSize = to_copy;
+    return CL_ERR_NO_ERR;
+  }
+
+  CLINT32 CLPROTOCOL clSerialWrite(CLINT8 *, CLUINT32 *, CLUINT32) override { return CL_ERR_NO_ERR; }
+
+  CLINT32 CLPROTOCOL clGetSupportedBaudRates(CLUINT32 *baudRates) override {
+    *baudRates = CL_BAUDRATE_115200;
+    return CL_ERR_NO_ERR;
+  }
+
+  CLINT32 CLPROTOCOL clSetBaudRate(CLUINT32) override { return CL_ERR_NO_ERR; }
+};
+
+// Serial fake whose reads time out until release(), so a request can be held
+// in progress while the test looks at the ones queued behind it.
+class BlockingSerial : public ISerial {
+ public:
+  const char *reply = "";
+
+  void wait_for_reader() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return reading_; });
+  }
+
+  void release() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    released_ = true;
+    cv_.notify_all();
+  }
+
+  // Reads still inside clSerialRead.
+  int busy() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return busy_;
+  }
+
+  CLINT32 CLPROTOCOL clSerialRead(CLINT8 *buffer, CLUINT32 *bufferSize, CLUINT32 timeout) override {
+    if (timeout == 0) {
+      return CL_ERR_TIMEOUT;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    reading_ = true;
+    cv_.notify_all();
+    ++busy_;
+    const bool released = cv_.wait_for(lock, std::chrono::milliseconds(timeout), [this] { return released_; });
+    --busy_;
+    if (!released) {
+      return CL_ERR_TIMEOUT;
+    }
+    const CLUINT32 to_copy = std::min(*bufferSize, static_cast<CLUINT32>(strlen(reply)));
+    memcpy(buffer, reply, to_copy);
+    *bufferSize = to_copy;
+    return CL_ERR_NO_ERR;
+  }
+
+  CLINT32 CLPROTOCOL clSerialWrite(CLINT8 *, CLUINT32 *, CLUINT32) override { return CL_ERR_NO_ERR; }
+
+  CLINT32 CLPROTOCOL clGetSupportedBaudRates(CLUINT32 *baudRates) override {
+    *baudRates = CL_BAUDRATE_115200;
+    return CL_ERR_NO_ERR;
+  }
+
+  CLINT32 CLPROTOCOL clSetBaudRate(CLUINT32) override { return CL_ERR_NO_ERR; }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool reading_ = false;
+  bool released_ = false;
+  int busy_ = 0;
+};
+
+// Serial fake that may be read from another thread: a write found in answers
+// queues that reply as input, inject() adds unsolicited input, and reads wait
+// up to their timeout for input to arrive.
+class StreamSerial : public ISerial {
+ public:
+  std::map<std::string, std::string> answers;  // changed only between register accesses
+  bool fail_writes = false;                     // likewise
+
+  void inject(const std::string &bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    input_ += bytes;
+    cv_.notify_all();
+  }
+
+  std::string last_write() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return last_write_;
+  }
+
+  CLINT32 CLPROTOCOL clSerialRead(CLINT8 *buffer, CLUINT32 *bufferSize, CLUINT32 timeout) override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!cv_.wait_for(lock, std::chrono::milliseconds(timeout), [this] { return !input_.empty(); })) {
+      *bufferSize = 0;
+      return CL_ERR_TIMEOUT;
+    }
+    const CLUINT32 to_copy = std::min(*bufferSize, static_cast<CLUINT32>(input_.size()));
+    memcpy(buffer, input_.data(), to_copy);
+    input_.erase(0, to_copy);
+    *bufferSize = to_copy;
+    return CL_ERR_NO_ERR;
+  }
+
+  CLINT32 CLPROTOCOL clSerialWrite(CLINT8 *buffer, CLUINT32 *bufferSize, CLUINT32) override {
+    if (fail_writes) {
+      return CL_ERR_TIMEOUT;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    last_write_.assign(reinterpret_cast<const char *>(buffer), *bufferSize);
+    const std::map<std::string, std::string>::const_iterator answer = answers.find(last_write_);
+    if (answer != answers.end()) {
+      input_ += answer->second;
+      cv_.notify_all();
+    }
+    return CL_ERR_NO_ERR;
+  }
+
+  CLINT32 CLPROTOCOL clGetSupportedBaudRates(CLUINT32 *baudRates) override {
+    *baudRates = CL_BAUDRATE_9600 | CL_BAUDRATE_115200;
+    return CL_ERR_NO_ERR;
+  }
+
+  CLINT32 CLPROTOCOL clSetBaudRate(CLUINT32) override { return CL_ERR_NO_ERR; }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::string input_;
+  std::string last_write_;
+};
+
+static std::mutex g_async_mutex;
+static std::vector<clp_cred2_completion_t> g_async_completions;
+
+static void CLPROTOCOL record_completion(const clp_cred2_completion_t *completion) {
+  std::lock_guard<std::mutex> lock(g_async_mutex);
+  g_async_completions.push_back(*completion);
+}
+
+// Disconnects the request's own connection from the worker thread and stores
+// the result in user_data.
+static void CLPROTOCOL disconnect_on_completion(const clp_cred2_completion_t *completion) {
+  *static_cast<CLINT32 *>(completion->user_data) = clpDisconnect(completion->cookie);
+  record_completion(completion);
+}
+
+static size_t async_completions_after(size_t count, int timeout_ms) {
+  for (int waited = 0;; ++waited) {
+    {
+      std::lock_guard<std::mutex> lock(g_async_mutex);
+      if (g_async_completions.size() >= count || waited >= timeout_ms) {
+        return g_async_completions.size();
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+static std::string last_error_text(CLUINT32 cookie) {
+  CLINT8 text[256] = {};
+  CLUINT32 size = sizeof(text);
+  clpGetErrorText(CL_ERR_GET_LAST_ERROR, text, &size, cookie);
+  return std::string(reinterpret_cast<char *>(text));
+}
+
+// Small deterministic generator so fuzz failures reproduce.
+static uint32_t fuzz_next(uint32_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
 static float read_float_from_buf(const CLINT8 *buf) {
   uint32_t bits = static_cast<uint8_t>(buf[0]) |
                   (static_cast<uint8_t>(buf[1]) << 8) |
@@ -88,12 +340,36 @@ static CLUINT32 read_u32_from_buf(const CLINT8 *buf) {
                                (static_cast<uint8_t>(buf[3]) << 24));
 }
 
+static std::mutex g_log_mutex;
+static std::vector<std::string> g_log_lines;
+
+static void CLPROTOCOL capture_logger(CLINT32, const char *fmt, va_list args) {
+  char line[512];
+  vsnprintf(line, sizeof(line), fmt, args);
+  std::lock_guard<std::mutex> lock(g_log_mutex);
+  g_log_lines.push_back(line);
+}
+
+static bool log_contains(const std::string &needle) {
+  std::lock_guard<std::mutex> lock(g_log_mutex);
+  for (size_t idx = 0; idx < g_log_lines.size(); ++idx) {
+    if (g_log_lines[idx].find(needle) != std::string::npos) {
+      return true;
+    }
+  }
+  return false;
+}
+
 }  // namespace
 
 int main() {
   FakeSerial serial;
   FakeSerial serial2;
 
+  CLINT32 init_rc = clpInitLib(capture_logger, CLP_LOG_DEBUG);
+  assert(init_rc == CL_ERR_NO_ERR);
+  assert(clpInitLib(capture_logger, CLP_LOG_DEBUG) == CL_ERR_IN_USE);
+
   CLINT8 buf[8] = {};
   CLINT8 str_buf[64] = {};
   CLUINT32 cookie = 0;
@@ -130,6 +406,17 @@ int main() {
   rc = clpDisconnect(reconnect_cookie);
   assert(rc == CL_ERR_NO_ERR);
 
+  CLUINT32 stop_probe = 1;
+  rc = clpSetParam(&serial, CLP_STOP_PROBE_DEVICE, 0, reinterpret_cast<CLINT8 *>(&stop_probe), sizeof(stop_probe), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  reconnect_device_id_size = sizeof(reconnect_device_id);
+  rc = clpProbeDevice(&serial, reinterpret_cast<const CLINT8 *>(device_id_str.c_str()), reconnect_device_id,
+                      &reconnect_device_id_size, &reconnect_cookie, 100);
+  assert(rc == CL_ERR_TIMEOUT);
+  rc = clpGetParam(&serial, CLP_STOP_PROBE_DEVICE, 0, reinterpret_cast<CLINT8 *>(&stop_probe), sizeof(stop_probe), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  assert(stop_probe == 0);
+
   CLINT8 xml_id_buf[512] = {};
   CLUINT32 xml_id_buf_size = sizeof(xml_id_buf);
   rc = clpGetXMLIDs(&serial, cookie, xml_id_buf, &xml_id_buf_size, 100);
@@ -206,6 +493,70 @@ int main() {
   assert(rc == CL_ERR_NO_ERR);
   assert(serial.last_write.find("set fps") == 0);
 
+  CLINT8 stats_selector[4] = {};
+  int fps_verb = 6;
+  memcpy(stats_selector, &fps_verb, sizeof(fps_verb));
+  rc = clpWriteRegister(&serial, cookie, 0x4000, stats_selector, sizeof(stats_selector), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  int prompt_phase = 2;
+  memcpy(stats_selector, &prompt_phase, sizeof(prompt_phase));
+  rc = clpWriteRegister(&serial, cookie, 0x4004, stats_selector, sizeof(stats_selector), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  rc = clpReadRegister(&serial, cookie, 0x4008, buf, sizeof(buf), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  assert(read_int_from_buf(buf) == 1);
+  rc = clpReadRegister(&serial, cookie, 0x4018, buf, sizeof(buf), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  const int fps_max_us = read_int_from_buf(buf);
+  rc = clpReadRegister(&serial, cookie, 0x4014, buf, sizeof(buf), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  assert(read_int_from_buf(buf) <= fps_max_us);
+  rc = clpReadRegister(&serial2, cookie2, 0x4008, buf, sizeof(buf), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  assert(read_int_from_buf(buf) == 0);
+
+  // Setters are tracked per setting: "set fps" has its own selector entry and
+  // the generic "set" entry stays empty.
+  int send_phase = 0;
+  memcpy(stats_selector, &send_phase, sizeof(send_phase));
+  rc = clpWriteRegister(&serial, cookie, 0x4004, stats_selector, sizeof(stats_selector), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  int set_fps_verb = 42;
+  memcpy(stats_selector, &set_fps_verb, sizeof(set_fps_verb));
+  rc = clpWriteRegister(&serial, cookie, 0x4000, stats_selector, sizeof(stats_selector), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  rc = clpReadRegister(&serial, cookie, 0x4008, buf, sizeof(buf), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  assert(read_int_from_buf(buf) == 1);
+  // Its acknowledgement is read with the next query and timed from the write.
+  memcpy(stats_selector, &prompt_phase, sizeof(prompt_phase));
+  rc = clpWriteRegister(&serial, cookie, 0x4004, stats_selector, sizeof(stats_selector), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  rc = clpReadRegister(&serial, cookie, 0x4008, buf, sizeof(buf), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  assert(read_int_from_buf(buf) == 0);
+  serial.reads.push("100.0\r\nfli-cli>");
+  rc = clpReadRegister(&serial, cookie, 0x1000, buf, sizeof(buf), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  for (int phase = 1; phase <= 2; ++phase) {
+    memcpy(stats_selector, &phase, sizeof(phase));
+    rc = clpWriteRegister(&serial, cookie, 0x4004, stats_selector, sizeof(stats_selector), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    rc = clpReadRegister(&serial, cookie, 0x4008, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(buf) == 1);
+    rc = clpReadRegister(&serial, cookie, 0x4014, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(buf) > 0);
+  }
+  int set_verb = 36;
+  memcpy(stats_selector, &set_verb, sizeof(set_verb));
+  rc = clpWriteRegister(&serial, cookie, 0x4000, stats_selector, sizeof(stats_selector), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  rc = clpReadRegister(&serial, cookie, 0x4008, buf, sizeof(buf), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  assert(read_int_from_buf(buf) == 0);
+
   serial.reads.push("on\r\nfli-cli>");
   rc = clpReadRegister(&serial, cookie, 0x1220, buf, sizeof(buf), 100);
   assert(rc == CL_ERR_NO_ERR);
@@ -323,6 +674,587 @@ int main() {
   invalid_read.reads.push("not-a-number\r\nfli-cli>");
   rc = clpReadRegister(&invalid_read, cookie, 0x1000, buf, sizeof(buf), 100);
   assert(rc == CL_ERR_INVALID_REFERENCE);
+  assert(last_error_text(cookie) == "failed to parse float at offset 0 of \"not-a-number\"");
+  invalid_read.reads.push("12.5x3\r\nfli-cli>");
+  rc = clpReadRegister(&invalid_read, cookie, 0x1000, buf, sizeof(buf), 100);
+  assert(rc == CL_ERR_INVALID_REFERENCE);
+  assert(last_error_text(cookie).find("at offset 5 ") != std::string::npos);
+  invalid_read.reads.push("640.5\r\nfli-cli>");
+  rc = clpReadRegister(&invalid_read, cookie, 0x1218, buf, sizeof(buf), 100);
+  assert(rc == CL_ERR_INVALID_REFERENCE);
+  assert(last_error_text(cookie).find("failed to parse int at offset 3 ") != std::string::npos);
+
+  const char *unit_replies[][2] = {{"-1.25e1 ms", "-12.5"}, {"+3E-2", "0.03"}, {"85 %", "85"}, {".5", "0.5"}};
+  for (size_t idx = 0; idx < sizeof(unit_replies) / sizeof(unit_replies[0]); ++idx) {
+    serial.reads.push(std::string(unit_replies[idx][0]) + "\r\nfli-cli>");
+    rc = clpReadRegister(&serial, cookie, 0x1000, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_float_from_buf(buf) == static_cast<float>(strtod(unit_replies[idx][1], NULL)));
+  }
+
+  // Units are for numbers only: a boolean reply must be a bare 0/1 or an on/off token.
+  const char *bool_replies[][2] = {{"1", "1"}, {"ON", "1"}, {"disable", "0"}, {"1 ms", ""}, {"2", ""}, {"on!", ""}};
+  for (size_t idx = 0; idx < sizeof(bool_replies) / sizeof(bool_replies[0]); ++idx) {
+    serial.reads.push(std::string(bool_replies[idx][0]) + "\r\nfli-cli>");
+    rc = clpReadRegister(&serial, cookie, 0x0314, buf, sizeof(buf), 100);
+    if (bool_replies[idx][1][0] == '\0') {
+      assert(rc == CL_ERR_INVALID_REFERENCE);
+    } else {
+      assert(rc == CL_ERR_NO_ERR);
+      assert(read_int_from_buf(buf) == atoi(bool_replies[idx][1]));
+    }
+  }
+  serial.reads.push("-40C\r\nfli-cli>");
+  rc = clpReadRegister(&serial, cookie, 0x1218, buf, sizeof(buf), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  assert(read_int_from_buf(buf) == -40);
+
+  // Fuzz (on the second connection to keep the first one's flight recorder intact):
+  // well-formed numbers must match strtod in the C locale bit for bit;
+  // arbitrary byte soup must either parse or fail cleanly with an offset.
+  {
+    uint32_t seed = 0x2545f491u;
+    const char *units[] = {"", " ms", "us", " C", "%", " fps"};
+    for (int iteration = 0; iteration < 4000; ++iteration) {
+      std::string number;
+      const uint32_t shape = fuzz_next(&seed);
+      if (shape & 1) number += (shape & 2) ? "-" : "+";
+      const size_t int_digits = fuzz_next(&seed) % 24;
+      for (size_t idx = 0; idx < int_digits; ++idx) number += static_cast<char>('0' + fuzz_next(&seed) % 10);
+      if (int_digits == 0 || (shape & 4)) {
+        number += ".";
+        const size_t frac_digits = 1 + fuzz_next(&seed) % 24;
+        for (size_t idx = 0; idx < frac_digits; ++idx) number += static_cast<char>('0' + fuzz_next(&seed) % 10);
+      }
+      if (shape & 8) {
+        number += (shape & 16) ? "e" : "E";
+        if (shape & 32) number += (shape & 64) ? "-" : "+";
+        const size_t exp_digits = 1 + fuzz_next(&seed) % 3;
+        for (size_t idx = 0; idx < exp_digits; ++idx) number += static_cast<char>('0' + fuzz_next(&seed) % 10);
+      }
+      const float expected = static_cast<float>(strtod(number.c_str(), NULL));
+      serial2.reads.push(number + units[fuzz_next(&seed) % 6] + "\r\nfli-cli>");
+      rc = clpReadRegister(&serial2, cookie2, 0x1000, buf, sizeof(buf), 100);
+      assert(rc == CL_ERR_NO_ERR);
+      const float parsed = read_float_from_buf(buf);
+      assert(memcmp(&parsed, &expected, sizeof(parsed)) == 0);
+    }
+    const char alphabet[] = "0123456789+-.eE ,%abcms\t";
+    for (int iteration = 0; iteration < 4000; ++iteration) {
+      std::string soup;
+      const size_t len = 1 + fuzz_next(&seed) % 12;
+      for (size_t idx = 0; idx < len; ++idx) soup += alphabet[fuzz_next(&seed) % (sizeof(alphabet) - 1)];
+      serial2.reads.push(soup + "\r\nfli-cli>");
+      rc = clpReadRegister(&serial2, cookie2, 0x1000, buf, sizeof(buf), 100);
+      assert(rc == CL_ERR_NO_ERR || rc == CL_ERR_INVALID_REFERENCE);
+      if (rc == CL_ERR_INVALID_REFERENCE) {
+        const std::string error = last_error_text(cookie2);
+        assert(error == "empty response" || error.find("failed to parse float at offset ") == 0);
+      } else {
+        char *end = NULL;
+        const std::string trimmed = soup.substr(soup.find_first_not_of(" \t"));
+        const double reference = strtod(trimmed.c_str(), &end);
+        assert(end != trimmed.c_str());
+        const float expected = static_cast<float>(reference);
+        const float parsed = read_float_from_buf(buf);
+        assert(memcmp(&parsed, &expected, sizeof(parsed)) == 0);
+      }
+    }
+  }
+
+  // Bool and enum replies decode the same way everywhere, whatever the case.
+  {
+    const struct {
+      CLUINT32 address;
+      const char *reply;
+      CLINT32 rc;
+      int value;
+    } tokens[] = {
+        {0x1038, "Cmos", CL_ERR_NO_ERR, 1},       {0x1038, "LVDS", CL_ERR_NO_ERR, 0},
+        {0x1108, "mEdIuM", CL_ERR_NO_ERR, 1},     {0x1108, "HIGH", CL_ERR_NO_ERR, 2},
+        {0x3010, "Automatic", CL_ERR_NO_ERR, 0},  {0x3010, "MANUAL", CL_ERR_NO_ERR, 1},
+        {0x1220, "Enable", CL_ERR_NO_ERR, 1},     {0x1220, "oFF", CL_ERR_NO_ERR, 0},
+        {0x3160, "DISABLE", CL_ERR_NO_ERR, 0},    {0x3164, "1", CL_ERR_NO_ERR, 1},
+        {0x1220, "onn", CL_ERR_INVALID_REFERENCE, 0}, {0x1038, "high", CL_ERR_INVALID_REFERENCE, 0},
+        {0x3010, "automatically", CL_ERR_INVALID_REFERENCE, 0},
+    };
+    for (size_t idx = 0; idx < sizeof(tokens) / sizeof(tokens[0]); ++idx) {
+      serial2.reads.push(std::string(tokens[idx].reply) + "\r\nfli-cli>");
+      rc = clpReadRegister(&serial2, cookie2, tokens[idx].address, buf, sizeof(buf), 100);
+      assert(rc == tokens[idx].rc);
+      if (rc == CL_ERR_NO_ERR) {
+        assert(read_int_from_buf(buf) == tokens[idx].value);
+      }
+    }
+  }
+
+  // One "status detailed" query feeds all DeviceStatus* registers.
+  {
+    clp_cred2_transport_counters_t before = {};
+    clp_cred2_transport_counters_t after = {};
+    rc = clpGetParam(&serial2, CLP_CRED2_TRANSPORT_COUNTERS, cookie2, reinterpret_cast<CLINT8 *>(&before),
+                     sizeof(before), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    serial2.reads.push("state: operational\r\nerror flags = 0x0014\r\ncooling state: Regulated\r\n"
+                       "uptime: 01:02:03\r\nfli-cli>");
+    const CLUINT32 status_addresses[] = {0x02C0, 0x02C4, 0x02C8, 0x02CC};
+    const int status_values[] = {7, 0x14, 3, 3723};
+    for (size_t idx = 0; idx < 4; ++idx) {
+      rc = clpReadRegister(&serial2, cookie2, status_addresses[idx], buf, sizeof(buf), 100);
+      assert(rc == CL_ERR_NO_ERR);
+      assert(read_int_from_buf(buf) == status_values[idx]);
+    }
+    rc = clpGetParam(&serial2, CLP_CRED2_TRANSPORT_COUNTERS, cookie2, reinterpret_cast<CLINT8 *>(&after),
+                     sizeof(after), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(after.commands == before.commands + 1);
+    assert(serial2.last_write == "status detailed raw\n");
+
+    // A write drops the cache; the next read refreshes it.
+    int zero_value = 0;
+    memcpy(write_buf, &zero_value, sizeof(zero_value));
+    rc = clpWriteRegister(&serial2, cookie2, 0x1220, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    serial2.reads.push("faulty\r\nerrors: 5\r\nuptime: 2.5 min\r\nfli-cli>");
+    rc = clpReadRegister(&serial2, cookie2, 0x02CC, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(buf) == 150);
+    rc = clpReadRegister(&serial2, cookie2, 0x02C0, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(buf) == 4);
+    rc = clpReadRegister(&serial2, cookie2, 0x02C8, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(buf) == 0);
+  }
+
+  // Fields that straddle the tokenizer's 16- and 32-byte blocks.
+  for (size_t pad = 0; pad < 40; ++pad) {
+    rc = clpWriteRegister(&serial2, cookie2, 0x1220, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    serial2.reads.push("\r\n" + std::string(pad, ' ') + "fw build" + std::string(pad, 'x') + " = 7\r\n\r\n" +
+                       std::string(pad % 33, ' ') + "uptime" + std::string(pad, ' ') + "=" + std::string(pad, ' ') +
+                       "00:00:" + std::to_string(pad % 60) + "\n" + std::string(pad, '-') + "\r\nfli-cli>");
+    rc = clpReadRegister(&serial2, cookie2, 0x02CC, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(buf) == static_cast<int>(pad % 60));
+  }
+
+  // Width/Height follow the cropping state and are cached until a cropping write.
+  {
+    serial2.reads.push("off\r\nfli-cli>");
+    rc = clpReadRegister(&serial2, cookie2, 0x120C, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(buf) == 640);
+    rc = clpReadRegister(&serial2, cookie2, 0x1210, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(buf) == 512);
+    assert(serial2.reads.empty());
+
+    int on = 1;
+    memcpy(write_buf, &on, sizeof(on));
+    rc = clpWriteRegister(&serial2, cookie2, 0x1200, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    serial2.reads.push("on\r\nfli-cli>");
+    serial2.reads.push("0-639\r\nfli-cli>");
+    serial2.reads.push("256-319\r\nfli-cli>");
+    rc = clpReadRegister(&serial2, cookie2, 0x1210, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(buf) == 64);
+    rc = clpReadRegister(&serial2, cookie2, 0x120C, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(buf) == 640);
+    assert(serial2.reads.empty());
+
+    int offset = 128;
+    memcpy(write_buf, &offset, sizeof(offset));
+    rc = clpWriteRegister(&serial2, cookie2, 0x1208, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    serial2.reads.push("on\r\nfli-cli>");
+    serial2.reads.push("64\r\nfli-cli>");
+    serial2.reads.push("128\r\nfli-cli>");
+    rc = clpReadRegister(&serial2, cookie2, 0x120C, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(buf) == 576);
+    rc = clpReadRegister(&serial2, cookie2, 0x1210, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(buf) == 384);
+
+    serial2.reads.push("256-319\r\nfli-cli>");
+    rc = clpReadRegister(&serial2, cookie2, 0x1208, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(buf) == 256);
+  }
+
+  // ROI commit: host-side step validation, then one pipelined write in a safe order.
+  {
+    const int staged[][2] = {{0x1240, 1}, {0x1244, 64}, {0x1248, 130}};
+    for (size_t idx = 0; idx < 3; ++idx) {
+      memcpy(write_buf, &staged[idx][1], sizeof(int));
+      rc = clpWriteRegister(&serial2, cookie2, staged[idx][0], write_buf, sizeof(write_buf), 100);
+      assert(rc == CL_ERR_NO_ERR);
+    }
+    rc = clpReadRegister(&serial2, cookie2, 0x1248, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(buf) == 130);
+    serial2.last_write.clear();
+    rc = clpWriteRegister(&serial2, cookie2, 0x124C, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_PARAM_DATA_VALUE);
+    assert(last_error_text(cookie2) == "ROI OffsetY 130 must be a multiple of 4 in 0-511");
+    assert(serial2.last_write.empty());
+
+    int row = 128;
+    memcpy(write_buf, &row, sizeof(row));
+    rc = clpWriteRegister(&serial2, cookie2, 0x1248, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    serial2.reads.push("\r\nfli-cli>\r\nfli-cli>\r\nfli-cli>");
+    rc = clpWriteRegister(&serial2, cookie2, 0x124C, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(serial2.last_write == "set cropping columns 64\nset cropping rows 128\nset cropping on\n");
+
+    serial2.reads.push("\r\nfli-cli>\r\nError: rows out of range\r\nfli-cli>\r\nfli-cli>");
+    rc = clpWriteRegister(&serial2, cookie2, 0x124C, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_PARAM_DATA_VALUE);
+    assert(last_error_text(cookie2) == "camera rejected \"set cropping rows 128\": Error: rows out of range");
+
+    int off = 0;
+    memcpy(write_buf, &off, sizeof(off));
+    rc = clpWriteRegister(&serial2, cookie2, 0x1240, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    serial2.reads.push("\r\nfli-cli>");
+    rc = clpWriteRegister(&serial2, cookie2, 0x124C, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_TIMEOUT);
+    assert(last_error_text(cookie2) == "no reply to \"set cropping columns 64\" (1 of 3 commands answered)");
+    assert(serial2.last_write == "set cropping off\nset cropping columns 64\nset cropping rows 128\n");
+  }
+
+  // Exposure timing commit: the order comes from the cached limits, both setters go in one write.
+  {
+    const float fps = 100.0f;
+    const float tint = 9000.0f;
+    memcpy(write_buf, &fps, sizeof(float));
+    rc = clpWriteRegister(&serial2, cookie2, 0x1040, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    memcpy(write_buf, &tint, sizeof(float));
+    rc = clpWriteRegister(&serial2, cookie2, 0x1044, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    rc = clpReadRegister(&serial2, cookie2, 0x1044, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_float_from_buf(buf) == tint);
+
+    // 900 us maxtint at 1000 fps leaves 100 us of readout, so 100 fps allows 9900 us.
+    serial2.reads.push("1\r\nfli-cli>\r\n1000\r\nfli-cli>\r\n1\r\nfli-cli>\r\n900\r\nfli-cli>");
+    serial2.reads.push("1000\r\nfli-cli>");
+    serial2.reads.push("\r\nfli-cli>\r\nfli-cli>");
+    rc = clpWriteRegister(&serial2, cookie2, 0x1048, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(serial2.last_write == "set fps 100\nset tint 9000\n");
+
+    const float fast_fps = 1000.0f;
+    const float short_tint = 500.0f;
+    memcpy(write_buf, &fast_fps, sizeof(float));
+    rc = clpWriteRegister(&serial2, cookie2, 0x1040, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    memcpy(write_buf, &short_tint, sizeof(float));
+    rc = clpWriteRegister(&serial2, cookie2, 0x1044, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    serial2.reads.push("1\r\nfli-cli>\r\n1000\r\nfli-cli>\r\n1\r\nfli-cli>\r\n9900\r\nfli-cli>");
+    serial2.reads.push("100\r\nfli-cli>");
+    serial2.reads.push("\r\nfli-cli>\r\nfli-cli>");
+    rc = clpWriteRegister(&serial2, cookie2, 0x1048, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(serial2.last_write == "set tint 500\nset fps 1000\n");
+
+    serial2.reads.push("1\r\nfli-cli>\r\n1000\r\nfli-cli>\r\nfast\r\nfli-cli>\r\n9900\r\nfli-cli>");
+    rc = clpWriteRegister(&serial2, cookie2, 0x1048, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_INVALID_REFERENCE);
+    assert(last_error_text(cookie2) == "failed to parse float at offset 0 of \"fast\"");
+
+    // An exposure the target frame period cannot hold is refused before either setter goes out.
+    const float long_tint = 5000.0f;
+    memcpy(write_buf, &long_tint, sizeof(float));
+    rc = clpWriteRegister(&serial2, cookie2, 0x1044, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    serial2.reads.push("1\r\nfli-cli>\r\n1000\r\nfli-cli>\r\n1\r\nfli-cli>\r\n900\r\nfli-cli>");
+    serial2.reads.push("1000\r\nfli-cli>");
+    rc = clpWriteRegister(&serial2, cookie2, 0x1048, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_PARAM_DATA_VALUE);
+    assert(last_error_text(cookie2) == "ExposureTimingExposureTime 5000 is above target maxtint 900");
+    assert(serial2.last_write == "fps raw\n");
+  }
+
+  // Setter replies are collected before the next read instead of being left in the stream.
+  {
+    serial2.reads.push("42\r\nfli-cli>");
+    int frames = 5;
+    memcpy(write_buf, &frames, sizeof(frames));
+    rc = clpWriteRegister(&serial2, cookie2, 0x1218, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    rc = clpWriteRegister(&serial2, cookie2, 0x1218, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    rc = clpReadRegister(&serial2, cookie2, 0x1218, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(buf) == 42);
+    assert(serial2.acks.empty());
+
+    // A refused setter fails the next call, once.
+    serial2.ack_reply = "Error: value out of range\r\nfli-cli>";
+    frames = 9999;
+    memcpy(write_buf, &frames, sizeof(frames));
+    rc = clpWriteRegister(&serial2, cookie2, 0x1218, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    serial2.ack_reply = "\r\nfli-cli>";
+    serial2.reads.push("7\r\nfli-cli>");
+    rc = clpReadRegister(&serial2, cookie2, 0x1218, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_PARAM_DATA_VALUE);
+    assert(last_error_text(cookie2) == "camera rejected \"set nbreadworeset 9999\": Error: value out of range");
+    rc = clpReadRegister(&serial2, cookie2, 0x1218, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(buf) == 7);
+
+    // Only a line that starts with "Error" is a refusal; benign acks that mention errors are not.
+    const char *benign_acks[] = {"no error\r\nfli-cli>", "errors: 0\r\nfli-cli>", "ok, error count 0\r\nfli-cli>"};
+    for (size_t idx = 0; idx < sizeof(benign_acks) / sizeof(benign_acks[0]); ++idx) {
+      serial2.ack_reply = benign_acks[idx];
+      rc = clpWriteRegister(&serial2, cookie2, 0x1218, write_buf, sizeof(write_buf), 100);
+      assert(rc == CL_ERR_NO_ERR);
+      serial2.ack_reply = "\r\nfli-cli>";
+      serial2.reads.push("7\r\nfli-cli>");
+      rc = clpReadRegister(&serial2, cookie2, 0x1218, buf, sizeof(buf), 100);
+      assert(rc == CL_ERR_NO_ERR);
+    }
+    serial2.ack_reply = "done\r\n  ERROR : busy\r\nfli-cli>";
+    rc = clpWriteRegister(&serial2, cookie2, 0x1218, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    serial2.ack_reply = "\r\nfli-cli>";
+    serial2.reads.push("7\r\nfli-cli>");
+    rc = clpReadRegister(&serial2, cookie2, 0x1218, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_PARAM_DATA_VALUE);
+    rc = clpReadRegister(&serial2, cookie2, 0x1218, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+
+    // TransportAcknowledgeFlush collects them on demand.
+    serial2.ack_reply = "Error: busy\r\nfli-cli>";
+    rc = clpWriteRegister(&serial2, cookie2, 0x1218, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    serial2.ack_reply = "\r\nfli-cli>";
+    rc = clpWriteRegister(&serial2, cookie2, 0x4144, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_PARAM_DATA_VALUE);
+    assert(last_error_text(cookie2) == "camera rejected \"set nbreadworeset 9999\": Error: busy");
+    rc = clpWriteRegister(&serial2, cookie2, 0x4144, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+  }
+
+  // Stale input is drained and the prompt resynced before the next command.
+  {
+    auto counters2 = [&]() {
+      clp_cred2_transport_counters_t snapshot = {};
+      rc = clpGetParam(&serial2, CLP_CRED2_TRANSPORT_COUNTERS, cookie2, reinterpret_cast<CLINT8 *>(&snapshot),
+                       sizeof(snapshot), 100);
+      assert(rc == CL_ERR_NO_ERR);
+      return snapshot;
+    };
+    rc = clpSetParam(&serial2, CLP_CRED2_TRANSPORT_COUNTERS_RESET, cookie2, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+
+    serial2.stale = "12.5\r\nfli-cli>\r\nREBOOT";
+    serial2.reads.push("30\r\nfli-cli>");
+    rc = clpReadRegister(&serial2, cookie2, 0x1000, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_float_from_buf(buf) == 30.0f);
+    assert(counters2().drained_bytes == 22);
+    assert(counters2().resyncs == 1);
+
+    // The camera's echo of the command itself is skipped.
+    serial2.reads.push("fps raw\r\n55\r\nfli-cli>");
+    rc = clpReadRegister(&serial2, cookie2, 0x1000, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_float_from_buf(buf) == 55.0f);
+    assert(counters2().resyncs == 1);
+
+    // The echo of another command means the reply is not ours: resync and ask again.
+    serial2.reads.push("tint raw\r\n20\r\nfli-cli>");
+    serial2.reads.push("60\r\nfli-cli>");
+    rc = clpReadRegister(&serial2, cookie2, 0x1000, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_float_from_buf(buf) == 60.0f);
+    assert(serial2.last_write == "fps raw\n");
+    assert(counters2().misaligned_replies == 1);
+    assert(counters2().resyncs == 2);
+
+    // A reply of the wrong type fails this read and resyncs before the next one.
+    serial2.reads.push("on\r\nfli-cli>");
+    rc = clpReadRegister(&serial2, cookie2, 0x1218, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_INVALID_REFERENCE);
+    serial2.reads.push("4\r\nfli-cli>");
+    rc = clpReadRegister(&serial2, cookie2, 0x1218, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(buf) == 4);
+    assert(counters2().resyncs == 3);
+    CLINT8 counter_buf[8] = {};
+    rc = clpReadRegister(&serial2, cookie2, 0x4150, counter_buf, sizeof(counter_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(counter_buf[0] == 3);
+  }
+
+  // Long-running writes report CL_ERR_PENDING_WRITE and finish through clpContinueWriteRegister.
+  {
+    serial2.ack_reply = "";
+    rc = clpWriteRegister(&serial2, cookie2, 0x2108, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_PENDING_WRITE);
+    assert(serial2.last_write == "save\n");
+    rc = clpReadRegister(&serial2, cookie2, 0x1218, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_IN_USE);
+    rc = clpContinueWriteRegister(&serial2, cookie2, 1, 100);
+    assert(rc == CL_ERR_PENDING_WRITE);
+    serial2.reads.push("Saving configuration... done\r\nfli-cli>");
+    rc = clpContinueWriteRegister(&serial2, cookie2, 1, 100);
+    assert(rc == CL_ERR_NO_ERR);
+    rc = clpContinueWriteRegister(&serial2, cookie2, 1, 100);
+    assert(rc == CL_ERR_INVALID_REFERENCE);
+
+    // A refusal that arrives within the first TimeOut is returned directly.
+    serial2.reads.push("Error: preset 3 is empty\r\nfli-cli>");
+    int preset = 3;
+    memcpy(write_buf, &preset, sizeof(preset));
+    rc = clpWriteRegister(&serial2, cookie2, 0x2100, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    rc = clpWriteRegister(&serial2, cookie2, 0x2104, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_PARAM_DATA_VALUE);
+    assert(last_error_text(cookie2) == "camera rejected \"set preset 3\": Error: preset 3 is empty");
+
+    // Giving up leaves the late reply to the drain in front of the next command.
+    rc = clpWriteRegister(&serial2, cookie2, 0x0308, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_PENDING_WRITE);
+    rc = clpContinueWriteRegister(&serial2, cookie2, 0, 100);
+    assert(rc == CL_ERR_NO_ERR);
+    serial2.ack_reply = "\r\nfli-cli>";
+    serial2.stale = "\r\nfli-cli>";
+    serial2.reads.push("8\r\nfli-cli>");
+    rc = clpReadRegister(&serial2, cookie2, 0x1218, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(buf) == 8);
+  }
+
+  // fps/tint writes are checked against the cached limits; rejected writes never reach the camera.
+  {
+    auto write_float = [&](CLINT64 address, float value) {
+      memcpy(write_buf, &value, sizeof(float));
+      return clpWriteRegister(&serial2, cookie2, address, write_buf, sizeof(write_buf), 100);
+    };
+    serial2.reads.push("1\r\nfli-cli>\r\n1000\r\nfli-cli>\r\n1\r\nfli-cli>\r\n9900\r\nfli-cli>");
+    rc = write_float(0x1000, 5000.0f);
+    assert(rc == CL_ERR_PARAM_DATA_VALUE);
+    assert(last_error_text(cookie2) == "AcquisitionFrameRate 5000 is above maxfps 1000");
+    assert(serial2.last_write == "minfps raw\nmaxfps raw\nmintint raw\nmaxtint raw\n");
+
+    serial2.last_write.clear();
+    rc = write_float(0x1000, 0.5f);
+    assert(rc == CL_ERR_PARAM_DATA_VALUE);
+    assert(last_error_text(cookie2) == "AcquisitionFrameRate 0.5 is below minfps 1");
+    assert(serial2.last_write.empty());
+    rc = write_float(0x1000, 500.0f);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(serial2.last_write == "set fps 500\n");
+    // Moving fps only makes the tint limits stale.
+    rc = write_float(0x1000, 400.0f);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(serial2.last_write == "set fps 400\n");
+    serial2.reads.push("1\r\nfli-cli>\r\n1000\r\nfli-cli>\r\n1\r\nfli-cli>\r\n2400\r\nfli-cli>");
+    rc = write_float(0x1010, 20000.0f);
+    assert(rc == CL_ERR_PARAM_DATA_VALUE);
+    assert(last_error_text(cookie2) == "ExposureTime 20000 is above maxtint 2400");
+
+    rc = write_float(0x1040, 5000.0f);
+    assert(rc == CL_ERR_NO_ERR);
+    serial2.last_write.clear();
+    rc = clpWriteRegister(&serial2, cookie2, 0x1048, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_PARAM_DATA_VALUE);
+    assert(last_error_text(cookie2) == "ExposureTimingFrameRate 5000 is above maxfps 1000");
+    assert(serial2.last_write.empty());
+
+    // Without readable limits the camera stays the judge.
+    int on = 1;
+    memcpy(write_buf, &on, sizeof(on));
+    rc = clpWriteRegister(&serial2, cookie2, 0x1200, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    rc = write_float(0x1000, 5000.0f);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(serial2.last_write == "set fps 5000\n");
+    // The failed query is not remembered: the next write asks again and is checked.
+    serial2.reads.push("1\r\nfli-cli>\r\n1000\r\nfli-cli>\r\n1\r\nfli-cli>\r\n900\r\nfli-cli>");
+    rc = write_float(0x1000, 5000.0f);
+    assert(rc == CL_ERR_PARAM_DATA_VALUE);
+    assert(last_error_text(cookie2) == "AcquisitionFrameRate 5000 is above maxfps 1000");
+    rc = clpWriteRegister(&serial2, cookie2, 0x1200, write_buf, sizeof(write_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+  }
+
+  // Float writes carry the shortest decimal that reads back exactly.
+  {
+    const float samples[] = {30.0f, 0.000123f, 1.0e-7f, 1234.5f};
+    const char *expected[] = {"set tint 30\n", "set tint 0.000123\n", "set tint 0.0000001\n", "set tint 1234.5\n"};
+    for (size_t idx = 0; idx < 4; ++idx) {
+      memcpy(write_buf, &samples[idx], sizeof(float));
+      rc = clpWriteRegister(&serial2, cookie2, 0x1010, write_buf, sizeof(write_buf), 100);
+      assert(rc == CL_ERR_NO_ERR);
+      assert(serial2.last_write == expected[idx]);
+    }
+    const float not_finite[] = {std::numeric_limits<float>::infinity(), std::numeric_limits<float>::quiet_NaN()};
+    for (size_t idx = 0; idx < 2; ++idx) {
+      memcpy(write_buf, &not_finite[idx], sizeof(float));
+      rc = clpWriteRegister(&serial2, cookie2, 0x1000, write_buf, sizeof(write_buf), 100);
+      assert(rc == CL_ERR_PARAM_DATA_VALUE);
+    }
+
+    const CLUINT32 float_addresses[] = {0x1000, 0x1010, 0x1034, 0x3024};
+    uint32_t seed = 0x9e3779b9u;
+    for (int iteration = 0; iteration < 20000; ++iteration) {
+      const uint32_t bits = fuzz_next(&seed);
+      float value = 0.0f;
+      memcpy(&value, &bits, sizeof(value));
+      if (!std::isfinite(value)) {
+        continue;
+      }
+      memcpy(write_buf, &value, sizeof(value));
+      rc = clpWriteRegister(&serial2, cookie2, float_addresses[iteration % 4], write_buf, sizeof(write_buf), 100);
+      assert(rc == CL_ERR_NO_ERR);
+      const std::string &line = serial2.last_write;
+      const std::string text = line.substr(line.rfind(' ') + 1, line.size() - line.rfind(' ') - 2);
+      assert(text.find_first_not_of("-0123456789.") == std::string::npos);
+      assert(strtof(text.c_str(), NULL) == value);
+      // One significant digit fewer must not round-trip.
+      std::string digits;
+      for (size_t idx = 0; idx < text.size(); ++idx) {
+        if (text[idx] >= '0' && text[idx] <= '9') digits += text[idx];
+      }
+      digits.erase(0, digits.find_first_not_of('0'));
+      digits.erase(digits.find_last_not_of('0') + 1);
+      if (digits.size() > 1) {
+        char shorter[64];
+        std::snprintf(shorter, sizeof(shorter), "%.*g", static_cast<int>(digits.size() - 1), value);
+        assert(strtof(shorter, NULL) != value);
+      }
+    }
+  }
+
+  // Mantissas longer than 19 digits take the slow path.
+  serial.reads.push("0.1234567890123456789012345 Hz\r\nfli-cli>");
+  rc = clpReadRegister(&serial, cookie, 0x1000, buf, sizeof(buf), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  assert(read_float_from_buf(buf) == 0.12345679f);
+
+  // A host locale with a decimal comma must not change how replies parse.
+  if (setlocale(LC_NUMERIC, "de_DE.UTF-8") || setlocale(LC_NUMERIC, "de_DE") || setlocale(LC_NUMERIC, "fr_FR.UTF-8")) {
+    serial.reads.push("123.5\r\nfli-cli>");
+    rc = clpReadRegister(&serial, cookie, 0x1000, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_float_from_buf(buf) == 123.5f);
+    serial.reads.push("1.00000000000000000000001e2\r\nfli-cli>");
+    rc = clpReadRegister(&serial, cookie, 0x1000, buf, sizeof(buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_float_from_buf(buf) == 100.0f);
+    setlocale(LC_NUMERIC, "C");
+  }
 
   rc = clpWriteRegister(&serial, cookie, 0x0308, write_buf, sizeof(write_buf), 100);
   assert(rc == CL_ERR_NO_ERR);
@@ -339,14 +1271,683 @@ int main() {
   rc = clpReadRegister(&serial, cookie, 0x3180, lic_buf, sizeof(lic_buf), 100);
   assert(rc == CL_ERR_NO_ERR);
   assert(std::string(reinterpret_cast<char *>(lic_buf)).find("licenseA.lic") != std::string::npos);
+  // Line noise: every byte is escaped to four characters in the flight recorder.
+  serial.reads.push(std::string(80, '\xA7') + "\r\nfli-cli>");
+  rc = clpReadRegister(&serial, cookie, 0x3180, lic_buf, sizeof(lic_buf), 100);
+  assert(rc == CL_ERR_NO_ERR);
 
-  rc = clpDisconnect(cookie2);
+  serial.reads.push("123.0\r\nfli-cli>");
+  rc = clpReadRegister(&serial, cookie, 0x1000, buf, sizeof(buf), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  rc = clpReadRegister(&serial, cookie, 0x1008, buf, sizeof(buf), 100);
+  assert(rc == CL_ERR_INVALID_REFERENCE);
+  std::vector<CLINT8> flight(CLP_CRED2_FLIGHT_RECORDER_DUMP_SIZE);
+  rc = clpGetParam(&serial, CLP_CRED2_FLIGHT_RECORDER, cookie, flight.data(), flight.size(), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  const std::string flight_dump(flight.data());
+  assert(flight_dump.find("rc=0 cmd=\"fps raw\" cmd_len=7 reply=\"123.0\\r\\nfli-cli>\" reply_len=15") !=
+         std::string::npos);
+  assert(flight_dump.find("rc=-10004 cmd=\"maxfps raw\"") != std::string::npos);
+  // Oldest first: the dump ends with the failed maxfps read.
+  assert(flight_dump.compare(0, 4, "seq=") == 0);
+  assert(flight_dump.find("rc=-10004 cmd=\"maxfps raw\"") > flight_dump.rfind("seq="));
+
+  clp_cred2_transport_counters_t counters = {};
+  rc = clpGetParam(&serial, CLP_CRED2_TRANSPORT_COUNTERS, cookie, reinterpret_cast<CLINT8 *>(&counters),
+                   sizeof(counters), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  assert(counters.commands > 0);
+  assert(counters.bytes_written > counters.commands);
+  assert(counters.bytes_read > 0);
+  assert(counters.reads >= counters.timeouts);
+  CLINT8 counter_buf[8] = {};
+  rc = clpReadRegister(&serial, cookie, 0x4130, counter_buf, sizeof(counter_buf), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  CLINT64 commands_reg = 0;
+  memcpy(&commands_reg, counter_buf, sizeof(commands_reg));
+  assert(commands_reg == counters.commands);
+  rc = clpSetParam(&serial, CLP_CRED2_TRANSPORT_COUNTERS_RESET, cookie, write_buf, sizeof(write_buf), 100);
   assert(rc == CL_ERR_NO_ERR);
+  rc = clpGetParam(&serial, CLP_CRED2_TRANSPORT_COUNTERS, cookie, reinterpret_cast<CLINT8 *>(&counters),
+                   sizeof(counters), 100);
+  assert(rc == CL_ERR_NO_ERR);
+  assert(counters.commands == 0 && counters.bytes_written == 0);
+  assert(clpIsParamSupported(CLP_CRED2_TRANSPORT_COUNTERS) == CL_ERR_NO_ERR);
+
+  {
+    StaticSerial quiet;
+    CLINT8 value_buf[4] = {0};
+    // Warm up once so any lazily sized state is in place, then measure.
+    quiet.reply = "60.0\r\nfli-cli>";
+    rc = clpReadRegister(&quiet, cookie, 0x1000, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    const size_t before = g_thread_allocations;
+    rc = clpReadRegister(&quiet, cookie, 0x1000, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_float_from_buf(value_buf) == 60.0f);
+    rc = clpWriteRegister(&quiet, cookie, 0x1000, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    quiet.reply = "on\r\nfli-cli>";
+    rc = clpReadRegister(&quiet, cookie, 0x1220, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(value_buf) == 1);
+    rc = clpWriteRegister(&quiet, cookie, 0x1220, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(g_thread_allocations == before);
+  }
+
+  {
+    // Poll mode: the completion carries the caller's buffer and user data.
+    CLINT8 async_buf[4] = {};
+    clp_cred2_request_t request = 0;
+    clp_cred2_completion_t completion = {};
+    serial2.reads.push("250.0\r\nfli-cli>");
+    rc = clpCred2SubmitRead(&serial2, cookie2, 0x1000, async_buf, sizeof(async_buf), 100, NULL, &serial2, &request);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(request != 0);
+    rc = clpCred2PollCompletion(&completion, 2000);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(completion.request == request && completion.cookie == cookie2);
+    assert(completion.status == CL_ERR_NO_ERR && completion.is_write == 0);
+    assert(completion.buffer == async_buf && completion.user_data == &serial2);
+    assert(read_float_from_buf(async_buf) == 250.0f);
+    rc = clpCred2PollCompletion(&completion, 0);
+    assert(rc == CL_ERR_TIMEOUT);
+
+    // Errors come back in the completion, with the worker's error text.
+    rc = clpCred2SubmitRead(&serial2, cookie2, 0x1008, async_buf, sizeof(async_buf), 100, NULL, NULL, &request);
+    assert(rc == CL_ERR_NO_ERR);
+    rc = clpCred2PollCompletion(&completion, 2000);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(completion.status == CL_ERR_INVALID_REFERENCE);
+    assert(completion.error_text[0] != '\0');
+
+    std::vector<CLINT8> oversized(CLP_CRED2_MAX_ASYNC_WRITE_SIZE + 1);
+    rc = clpCred2SubmitWrite(&serial2, cookie2, 0x3150, oversized.data(), oversized.size(), 100, NULL, NULL, NULL);
+    assert(rc == CL_ERR_PARAM_DATA_SIZE);
+    rc = clpCred2SubmitRead(&serial2, cookie2 + 1000, 0x1000, async_buf, sizeof(async_buf), 100, NULL, NULL, NULL);
+    assert(rc == CL_ERR_INVALID_COOKIE);
+    assert(clpCred2Cancel(0) == CL_ERR_INVALID_REFERENCE);
+
+    // Callback mode, and cancel: the first read holds the worker inside the
+    // serial port, so the second is still queued and can be canceled.
+    BlockingSerial blocking;
+    blocking.reply = "on\r\nfli-cli>";
+    CLINT8 first_buf[4] = {};
+    CLINT8 second_buf[4] = {};
+    clp_cred2_request_t first = 0;
+    clp_cred2_request_t second = 0;
+    rc = clpCred2SubmitRead(&blocking, cookie2, 0x1220, first_buf, sizeof(first_buf), 1000, record_completion, NULL,
+                            &first);
+    assert(rc == CL_ERR_NO_ERR);
+    blocking.wait_for_reader();
+    rc = clpCred2SubmitRead(&blocking, cookie2, 0x1220, second_buf, sizeof(second_buf), 1000, record_completion,
+                            NULL, &second);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(second != first);
+    rc = clpCred2Cancel(second);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(async_completions_after(1, 0) == 1);
+    assert(g_async_completions[0].request == second && g_async_completions[0].status == CLP_CRED2_ERR_CANCELED);
+    assert(clpCred2Cancel(second) == CL_ERR_INVALID_REFERENCE);
+    assert(clpCred2Cancel(first) == CL_ERR_IN_USE);
+    blocking.release();
+    assert(async_completions_after(2, 2000) == 2);
+    assert(g_async_completions[1].request == first && g_async_completions[1].status == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(first_buf) == 1);
+    assert(read_int_from_buf(second_buf) == 0);
+
+    // The synchronous calls share the connection with the worker.
+    serial2.reads.push("250.0\r\nfli-cli>");
+    rc = clpReadRegister(&serial2, cookie2, 0x1000, async_buf, sizeof(async_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_float_from_buf(async_buf) == 250.0f);
+
+    // A cancel from another thread ends a transaction stuck on a silent camera
+    // within a read quantum, not after its 10 s timeout.
+    BlockingSerial silent;
+    CLINT32 silent_rc = CL_ERR_NO_ERR;
+    const auto cancel_start = std::chrono::steady_clock::now();
+    std::thread reader([&] {
+      silent_rc = clpReadRegister(&silent, cookie2, 0x1220, first_buf, sizeof(first_buf), 10000);
+    });
+    silent.wait_for_reader();
+    CLUINT32 cancel = 1;
+    rc = clpSetParam(&serial2, CLP_CRED2_CANCEL_TRANSACTION, cookie2, reinterpret_cast<CLINT8 *>(&cancel),
+                     sizeof(cancel), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    reader.join();
+    assert(silent_rc == CLP_CRED2_ERR_CANCELED);
+    assert(std::chrono::steady_clock::now() - cancel_start < std::chrono::seconds(2));
+    assert(clpIsParamSupported(CLP_CRED2_CANCEL_TRANSACTION) == CL_ERR_NO_ERR);
+
+    // Whatever the camera says later belongs to the canceled command: resync first.
+    clp_cred2_transport_counters_t before = {};
+    rc = clpGetParam(&serial2, CLP_CRED2_TRANSPORT_COUNTERS, cookie2, reinterpret_cast<CLINT8 *>(&before),
+                     sizeof(before), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    serial2.reads.push("250.0\r\nfli-cli>");
+    rc = clpReadRegister(&serial2, cookie2, 0x1000, async_buf, sizeof(async_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    clp_cred2_transport_counters_t after = {};
+    rc = clpGetParam(&serial2, CLP_CRED2_TRANSPORT_COUNTERS, cookie2, reinterpret_cast<CLINT8 *>(&after),
+                     sizeof(after), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(after.resyncs == before.resyncs + 1);
+
+    // A cancel also ends a call still waiting for the connection behind the one
+    // in progress, but not a call made after it.
+    BlockingSerial running_port;
+    BlockingSerial queued_port;
+    CLINT32 running_rc = CL_ERR_NO_ERR;
+    CLINT32 queued_rc = CL_ERR_NO_ERR;
+    const auto queued_start = std::chrono::steady_clock::now();
+    std::thread running_call([&] {
+      running_rc = clpReadRegister(&running_port, cookie2, 0x1220, first_buf, sizeof(first_buf), 10000);
+    });
+    running_port.wait_for_reader();
+    std::thread queued_call([&] {
+      queued_rc = clpReadRegister(&queued_port, cookie2, 0x1220, second_buf, sizeof(second_buf), 10000);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    rc = clpSetParam(&serial2, CLP_CRED2_CANCEL_TRANSACTION, cookie2, reinterpret_cast<CLINT8 *>(&cancel),
+                     sizeof(cancel), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    running_call.join();
+    queued_call.join();
+    assert(running_rc == CLP_CRED2_ERR_CANCELED);
+    assert(queued_rc == CLP_CRED2_ERR_CANCELED);
+    assert(std::chrono::steady_clock::now() - queued_start < std::chrono::seconds(2));
+    serial2.reads.push("250.0\r\nfli-cli>");
+    rc = clpReadRegister(&serial2, cookie2, 0x1000, async_buf, sizeof(async_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_float_from_buf(async_buf) == 250.0f);
+
+    // Disconnecting cancels the asynchronous request in progress as well.
+    rc = clpCred2SubmitRead(&silent, cookie2, 0x1220, second_buf, sizeof(second_buf), 10000, record_completion,
+                            NULL, &second);
+    assert(rc == CL_ERR_NO_ERR);
+    const auto disconnect_start = std::chrono::steady_clock::now();
+    rc = clpDisconnect(cookie2);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(std::chrono::steady_clock::now() - disconnect_start < std::chrono::seconds(2));
+    assert(async_completions_after(3, 0) == 3);
+    assert(g_async_completions[2].request == second && g_async_completions[2].status == CLP_CRED2_ERR_CANCELED);
+
+    // A synchronous read in progress is canceled and waited for: once clpDisconnect
+    // returns nothing uses the connection or the serial port any more.
+    FakeSerial probe_serial;
+    CLUINT32 sync_cookie = 0;
+    CLINT8 sync_device_id[256] = {};
+    CLUINT32 sync_device_id_size = sizeof(sync_device_id);
+    rc = clpProbeDevice(&probe_serial, reinterpret_cast<const CLINT8 *>("FirstLightImaging#CRED2#CRED2"),
+                        sync_device_id, &sync_device_id_size, &sync_cookie, 100);
+    assert(rc == CL_ERR_NO_ERR);
+    BlockingSerial stuck;
+    CLINT32 sync_rc = CL_ERR_NO_ERR;
+    std::thread sync_reader([&] {
+      sync_rc = clpReadRegister(&stuck, sync_cookie, 0x1220, first_buf, sizeof(first_buf), 10000);
+    });
+    stuck.wait_for_reader();
+    const auto sync_start = std::chrono::steady_clock::now();
+    rc = clpDisconnect(sync_cookie);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(stuck.busy() == 0);
+    assert(std::chrono::steady_clock::now() - sync_start < std::chrono::seconds(2));
+    sync_reader.join();
+    assert(sync_rc == CLP_CRED2_ERR_CANCELED);
+    rc = clpReadRegister(&stuck, sync_cookie, 0x1220, first_buf, sizeof(first_buf), 100);
+    assert(rc == CL_ERR_INVALID_COOKIE);
+
+    // A callback may disconnect its own connection: the request queued behind
+    // it is canceled and the worker is left to exit rather than joined.
+    FakeSerial self_serial;
+    CLUINT32 self_cookie = 0;
+    sync_device_id_size = sizeof(sync_device_id);
+    rc = clpProbeDevice(&self_serial, reinterpret_cast<const CLINT8 *>("FirstLightImaging#CRED2#CRED2"),
+                        sync_device_id, &sync_device_id_size, &self_cookie, 100);
+    assert(rc == CL_ERR_NO_ERR);
+    const size_t self_base = async_completions_after(0, 0);
+    CLINT32 self_disconnect_rc = CL_ERR_TIMEOUT;
+    clp_cred2_request_t self_first = 0;
+    clp_cred2_request_t self_second = 0;
+    self_serial.reads.push("on\r\nfli-cli>");
+    rc = clpCred2SubmitRead(&self_serial, self_cookie, 0x1220, first_buf, sizeof(first_buf), 100,
+                            disconnect_on_completion, &self_disconnect_rc, &self_first);
+    assert(rc == CL_ERR_NO_ERR);
+    rc = clpCred2SubmitRead(&self_serial, self_cookie, 0x1220, second_buf, sizeof(second_buf), 100,
+                            record_completion, NULL, &self_second);
+    assert(rc == CL_ERR_NO_ERR || rc == CL_ERR_INVALID_COOKIE);
+    assert(async_completions_after(self_base + (rc == CL_ERR_NO_ERR ? 2 : 1), 2000) ==
+           self_base + (rc == CL_ERR_NO_ERR ? 2 : 1));
+    {
+      std::lock_guard<std::mutex> lock(g_async_mutex);
+      assert(self_disconnect_rc == CL_ERR_NO_ERR);
+      assert(g_async_completions.back().request == self_first &&
+             g_async_completions.back().status == CL_ERR_NO_ERR);
+      if (rc == CL_ERR_NO_ERR) {
+        assert(g_async_completions[self_base].request == self_second &&
+               g_async_completions[self_base].status == CLP_CRED2_ERR_CANCELED);
+      }
+    }
+    rc = clpReadRegister(&self_serial, self_cookie, 0x1220, first_buf, sizeof(first_buf), 100);
+    assert(rc == CL_ERR_INVALID_COOKIE);
+  }
+
+  {
+    // Watchdog: three replies in a row without a prompt start a recovery; the
+    // camera came back with a shorter uptime, so the shadowed setter is replayed.
+    FakeSerial camera;
+    CLUINT32 wd_cookie = 0;
+    CLINT8 wd_device_id[256] = {};
+    CLUINT32 wd_device_id_size = sizeof(wd_device_id);
+    rc = clpProbeDevice(&camera, reinterpret_cast<const CLINT8 *>("FirstLightImaging#CRED2#CRED2"), wd_device_id,
+                        &wd_device_id_size, &wd_cookie, 100);
+    assert(rc == CL_ERR_NO_ERR);
+    CLINT8 value_buf[4] = {};
+    const int enable = 1;
+    memcpy(value_buf, &enable, sizeof(enable));
+    rc = clpWriteRegister(&camera, wd_cookie, 0x4160, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    rc = clpReadRegister(&camera, wd_cookie, 0x4160, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(value_buf) == 1);
+
+    camera.reads.push("state: operational\r\nuptime: 01:02:03\r\nfli-cli>");
+    rc = clpReadRegister(&camera, wd_cookie, 0x02CC, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(value_buf) == 3723);
+    memcpy(value_buf, &enable, sizeof(enable));
+    rc = clpWriteRegister(&camera, wd_cookie, 0x3150, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    rc = clpWriteRegister(&camera, wd_cookie, 0x4144, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+
+    camera.answers["status detailed raw\n"] = "state: operational\r\nuptime: 00:00:05\r\nfli-cli>";
+    std::string silent_error;
+    for (int idx = 0; idx < 3; ++idx) {
+      rc = clpReadRegister(&camera, wd_cookie, 0x1000, value_buf, sizeof(value_buf), 100);
+      assert(rc != CL_ERR_NO_ERR);
+      if (idx == 0) {
+        silent_error = last_error_text(wd_cookie);
+      }
+    }
+    // The failed call keeps its own error text.
+    assert(last_error_text(wd_cookie) == silent_error);
+    assert(camera.last_write == "set ip mode automatic\n");
+    clp_cred2_transport_counters_t wd_counters = {};
+    rc = clpGetParam(&camera, CLP_CRED2_TRANSPORT_COUNTERS, wd_cookie, reinterpret_cast<CLINT8 *>(&wd_counters),
+                     sizeof(wd_counters), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(wd_counters.watchdog_recoveries == 1);
+    assert(wd_counters.watchdog_failures == 0);
+    assert(wd_counters.settings_replayed == 1);
+    CLINT8 counter_value[8] = {};
+    rc = clpReadRegister(&camera, wd_cookie, 0x4178, counter_value, sizeof(counter_value), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(counter_value[0] == 1);
+
+    // A camera still faulty after "continue" is a failed recovery.
+    camera.answers["status detailed raw\n"] = "state: faulty\r\nuptime: 00:00:10\r\nfli-cli>";
+    rc = clpReadRegister(&camera, wd_cookie, 0x0240, str_buf, sizeof(str_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    rc = clpGetParam(&camera, CLP_CRED2_TRANSPORT_COUNTERS, wd_cookie, reinterpret_cast<CLINT8 *>(&wd_counters),
+                     sizeof(wd_counters), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(wd_counters.watchdog_recoveries == 2);
+    assert(wd_counters.watchdog_failures == 1);
+    assert(camera.last_write == "status detailed raw\n");
+
+    // A setter still waiting for its reply when a recovery starts: the camera
+    // answers with a refusal, which the write reports instead of losing it.
+    camera.answers["status detailed raw\n"] = "state: operational\r\nuptime: 00:01:00\r\nfli-cli>";
+    for (int idx = 0; idx < 2; ++idx) {
+      rc = clpReadRegister(&camera, wd_cookie, 0x1000, value_buf, sizeof(value_buf), 100);
+      assert(rc != CL_ERR_NO_ERR);
+    }
+    // The limit query misses the third prompt, so the unchecked setter is pending when the watchdog runs.
+    camera.ack_reply = "Error: fps out of range\r\nfli-cli>";
+    const float wd_fps = 50.0f;
+    memcpy(value_buf, &wd_fps, sizeof(wd_fps));
+    rc = clpWriteRegister(&camera, wd_cookie, 0x1000, value_buf, sizeof(value_buf), 100);
+    camera.ack_reply = "\r\nfli-cli>";
+    assert(rc == CL_ERR_PARAM_DATA_VALUE);
+    assert(last_error_text(wd_cookie) == "camera rejected \"set fps 50\": Error: fps out of range");
+    rc = clpGetParam(&camera, CLP_CRED2_TRANSPORT_COUNTERS, wd_cookie, reinterpret_cast<CLINT8 *>(&wd_counters),
+                     sizeof(wd_counters), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(wd_counters.watchdog_recoveries == 3);
+    assert(wd_counters.watchdog_failures == 1);
+    rc = clpDisconnect(wd_cookie);
+    assert(rc == CL_ERR_NO_ERR);
+  }
+
+  {
+    // Camera events: unsolicited lines are queued while events are on and
+    // handed out oldest first with their arrival time.
+    FakeSerial camera;
+    CLUINT32 ev_cookie = 0;
+    CLINT8 ev_device_id[256] = {};
+    CLUINT32 ev_device_id_size = sizeof(ev_device_id);
+    rc = clpProbeDevice(&camera, reinterpret_cast<const CLINT8 *>("FirstLightImaging#CRED2#CRED2"), ev_device_id,
+                        &ev_device_id_size, &ev_cookie, 100);
+    assert(rc == CL_ERR_NO_ERR);
+    CLINT8 event_buf[256] = {};
+    CLUINT32 event_size = sizeof(event_buf);
+    assert(clpGetEventData(ev_cookie, event_buf, &event_size) == CL_ERR_TIMEOUT);
+    assert(event_size == 0);
+    assert(clpGetEventData(ev_cookie + 1000, event_buf, &event_size) == CL_ERR_INVALID_COOKIE);
+
+    CLINT8 value_buf[4] = {};
+    const int on = 1;
+    memcpy(value_buf, &on, sizeof(on));
+    rc = clpWriteRegister(&camera, ev_cookie, 0x2200, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(camera.last_write == "set events on\n");
+    camera.stale = "fli-cli>overtemperature warning\r\nframe drop 3\r\n";
+    camera.reads.push("100.0\r\nfli-cli>");
+    rc = clpReadRegister(&camera, ev_cookie, 0x1000, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_float_from_buf(value_buf) == 100.0f);
+
+    event_size = 8;
+    rc = clpGetEventData(ev_cookie, event_buf, &event_size);
+    assert(rc == CL_ERR_BUFFER_TOO_SMALL);
+    assert(event_size > 8);
+    const size_t before = g_thread_allocations;
+    event_size = sizeof(event_buf);
+    rc = clpGetEventData(ev_cookie, event_buf, &event_size);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(g_thread_allocations == before);
+    std::string first_event(reinterpret_cast<char *>(event_buf));
+    assert(event_size == first_event.size() + 1);
+    assert(first_event.compare(0, 6, "ts_us=") == 0);
+    assert(first_event.find(" overtemperature warning") + 24 == first_event.size());
+    event_size = sizeof(event_buf);
+    rc = clpGetEventData(ev_cookie, event_buf, &event_size);
+    assert(rc == CL_ERR_NO_ERR);
+    const std::string second_event(reinterpret_cast<char *>(event_buf));
+    assert(second_event.find(" frame drop 3") != std::string::npos);
+    assert(strtoull(second_event.c_str() + 6, NULL, 10) >= strtoull(first_event.c_str() + 6, NULL, 10));
+    event_size = sizeof(event_buf);
+    assert(clpGetEventData(ev_cookie, event_buf, &event_size) == CL_ERR_TIMEOUT);
+
+    // A full queue drops and counts new events instead of blocking.
+    for (int idx = 0; idx < 70; ++idx) {
+      camera.stale += "e" + std::to_string(idx) + "\r\n";
+    }
+    camera.reads.push("100.0\r\nfli-cli>");
+    rc = clpReadRegister(&camera, ev_cookie, 0x1000, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    clp_cred2_transport_counters_t ev_counters = {};
+    rc = clpGetParam(&camera, CLP_CRED2_TRANSPORT_COUNTERS, ev_cookie, reinterpret_cast<CLINT8 *>(&ev_counters),
+                     sizeof(ev_counters), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(ev_counters.events == 66);
+    assert(ev_counters.events_dropped == 6);
+    int queued = 0;
+    for (;;) {
+      event_size = sizeof(event_buf);
+      rc = clpGetEventData(ev_cookie, event_buf, &event_size);
+      if (rc != CL_ERR_NO_ERR) {
+        break;
+      }
+      if (queued == 0) {
+        first_event = reinterpret_cast<char *>(event_buf);
+      }
+      ++queued;
+    }
+    assert(rc == CL_ERR_TIMEOUT);
+    assert(queued == 64);
+    assert(first_event.find(" e0") + 3 == first_event.size());
+
+    // With events off, unsolicited input is only drained.
+    const int off = 0;
+    memcpy(value_buf, &off, sizeof(off));
+    rc = clpWriteRegister(&camera, ev_cookie, 0x2200, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    camera.stale = "late line\r\n";
+    camera.reads.push("100.0\r\nfli-cli>");
+    rc = clpReadRegister(&camera, ev_cookie, 0x1000, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    event_size = sizeof(event_buf);
+    assert(clpGetEventData(ev_cookie, event_buf, &event_size) == CL_ERR_TIMEOUT);
+    rc = clpDisconnect(ev_cookie);
+    assert(rc == CL_ERR_NO_ERR);
+  }
+
+  {
+    // A TimeOut of 0 still reads what the camera has already sent, for replies
+    // and for the acknowledgement of a long write.
+    StreamSerial camera;
+    camera.answers["\n"] = "\r\nfli-cli>";
+    camera.answers["fps raw\n"] = "123.0\r\nfli-cli>";
+    camera.answers["save\n"] = "Saving configuration... done\r\nfli-cli>";
+    CLUINT32 zt_cookie = 0;
+    CLINT8 zt_device_id[256] = {};
+    CLUINT32 zt_device_id_size = sizeof(zt_device_id);
+    rc = clpProbeDevice(&camera, reinterpret_cast<const CLINT8 *>("FirstLightImaging#CRED2#CRED2"), zt_device_id,
+                        &zt_device_id_size, &zt_cookie, 100);
+    assert(rc == CL_ERR_NO_ERR);
+    CLINT8 value_buf[4] = {};
+    rc = clpReadRegister(&camera, zt_cookie, 0x1000, value_buf, sizeof(value_buf), 0);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_float_from_buf(value_buf) == 123.0f);
+    rc = clpWriteRegister(&camera, zt_cookie, 0x2108, value_buf, sizeof(value_buf), 0);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(camera.last_write() == "save\n");
+    rc = clpDisconnect(zt_cookie);
+    assert(rc == CL_ERR_NO_ERR);
+  }
+
+  {
+    // Background reader: an event in the middle of a reply is queued instead
+    // of ending up in it, and events between commands are queued as they come.
+    StreamSerial camera;
+    camera.answers["\n"] = "\r\nfli-cli>";
+    camera.answers["set events on\n"] = "\r\nfli-cli>";
+    camera.answers["fps raw\n"] = "123.0\r\nevent: frame drop 7\r\nfli-cli>";
+    CLUINT32 rd_cookie = 0;
+    CLINT8 rd_device_id[256] = {};
+    CLUINT32 rd_device_id_size = sizeof(rd_device_id);
+    rc = clpProbeDevice(&camera, reinterpret_cast<const CLINT8 *>("FirstLightImaging#CRED2#CRED2"), rd_device_id,
+                        &rd_device_id_size, &rd_cookie, 100);
+    assert(rc == CL_ERR_NO_ERR);
+    CLINT8 value_buf[4] = {};
+    const int on = 1;
+    const int off = 0;
+    memcpy(value_buf, &on, sizeof(on));
+    rc = clpWriteRegister(&camera, rd_cookie, 0x4164, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    memset(value_buf, 0, sizeof(value_buf));
+    rc = clpReadRegister(&camera, rd_cookie, 0x4164, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(value_buf) == 1);
+
+    // A setter's acknowledgement comes through the reader as well.
+    memcpy(value_buf, &on, sizeof(on));
+    rc = clpWriteRegister(&camera, rd_cookie, 0x2200, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    rc = clpWriteRegister(&camera, rd_cookie, 0x4144, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(camera.last_write() == "set events on\n");
+
+    rc = clpReadRegister(&camera, rd_cookie, 0x1000, value_buf, sizeof(value_buf), 1000);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_float_from_buf(value_buf) == 123.0f);
+    CLINT8 event_buf[256] = {};
+    CLUINT32 event_size = sizeof(event_buf);
+    rc = clpGetEventData(rd_cookie, event_buf, &event_size);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(std::string(reinterpret_cast<char *>(event_buf)).find(" event: frame drop 7") != std::string::npos);
+
+    camera.inject("link up\r\n");
+    for (int attempt = 0; attempt < 200; ++attempt) {
+      event_size = sizeof(event_buf);
+      rc = clpGetEventData(rd_cookie, event_buf, &event_size);
+      if (rc != CL_ERR_TIMEOUT) {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    assert(rc == CL_ERR_NO_ERR);
+    assert(std::string(reinterpret_cast<char *>(event_buf)).find(" link up") != std::string::npos);
+
+    // A command that was never written owes no reply: a prompted line that
+    // arrives afterwards is an event, not the answer to the next command.
+    camera.fail_writes = true;
+    rc = clpReadRegister(&camera, rd_cookie, 0x1000, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_TIMEOUT);
+    assert(last_error_text(rd_cookie) == "serial write failed");
+    camera.fail_writes = false;
+    camera.inject("link down\r\nfli-cli>");
+    for (int attempt = 0; attempt < 200; ++attempt) {
+      event_size = sizeof(event_buf);
+      rc = clpGetEventData(rd_cookie, event_buf, &event_size);
+      if (rc != CL_ERR_TIMEOUT) {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    assert(rc == CL_ERR_NO_ERR);
+    assert(std::string(reinterpret_cast<char *>(event_buf)).find(" link down") != std::string::npos);
+
+    // A reply longer than the response buffer fails instead of being cut short.
+    std::string flood;
+    for (int line = 0; line < 100; ++line) {
+      flood += "0123456789012345678901234567890123456789012345678901234567890123\r\n";
+    }
+    camera.answers["fps raw\n"] = flood + "fli-cli>";
+    rc = clpReadRegister(&camera, rd_cookie, 0x1000, value_buf, sizeof(value_buf), 1000);
+    assert(rc == CL_ERR_BUFFER_TOO_SMALL);
+    assert(last_error_text(rd_cookie) == "reply does not fit the response buffer");
+    camera.answers["fps raw\n"] = "123.0\r\nfli-cli>";
+    rc = clpReadRegister(&camera, rd_cookie, 0x1000, value_buf, sizeof(value_buf), 1000);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_float_from_buf(value_buf) == 123.0f);
+
+    // With the event cache on, the status is kept past its TTL until an event
+    // changes it.
+    camera.answers["status detailed raw\n"] = "state: operational\r\nuptime: 00:00:05\r\nfli-cli>";
+    memcpy(value_buf, &on, sizeof(on));
+    rc = clpWriteRegister(&camera, rd_cookie, 0x4190, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    rc = clpReadRegister(&camera, rd_cookie, 0x02C0, value_buf, sizeof(value_buf), 1000);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(value_buf) == 7);
+    clp_cred2_transport_counters_t rd_counters = {};
+    rc = clpGetParam(&camera, CLP_CRED2_TRANSPORT_COUNTERS, rd_cookie, reinterpret_cast<CLINT8 *>(&rd_counters),
+                     sizeof(rd_counters), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    const CLINT64 commands_before = rd_counters.commands;
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    rc = clpReadRegister(&camera, rd_cookie, 0x02C0, value_buf, sizeof(value_buf), 1000);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(value_buf) == 7);
+    rc = clpReadRegister(&camera, rd_cookie, 0x02CC, value_buf, sizeof(value_buf), 1000);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(value_buf) >= 5);
+    rc = clpGetParam(&camera, CLP_CRED2_TRANSPORT_COUNTERS, rd_cookie, reinterpret_cast<CLINT8 *>(&rd_counters),
+                     sizeof(rd_counters), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(rd_counters.commands == commands_before);
+    assert(rd_counters.cache_invalidations == 0);
+
+    camera.answers["status detailed raw\n"] = "state: ready\r\nuptime: 00:00:06\r\nfli-cli>";
+    camera.inject("event: status ready\r\n");
+    for (int attempt = 0; attempt < 200; ++attempt) {
+      event_size = sizeof(event_buf);
+      rc = clpGetEventData(rd_cookie, event_buf, &event_size);
+      if (rc != CL_ERR_TIMEOUT) {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    assert(rc == CL_ERR_NO_ERR);
+    rc = clpReadRegister(&camera, rd_cookie, 0x02C0, value_buf, sizeof(value_buf), 1000);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(value_buf) == 8);
+    rc = clpGetParam(&camera, CLP_CRED2_TRANSPORT_COUNTERS, rd_cookie, reinterpret_cast<CLINT8 *>(&rd_counters),
+                     sizeof(rd_counters), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(rd_counters.commands == commands_before + 1);
+    assert(rd_counters.cache_invalidations == 1);
+
+    memcpy(value_buf, &off, sizeof(off));
+    rc = clpWriteRegister(&camera, rd_cookie, 0x4164, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    rc = clpReadRegister(&camera, rd_cookie, 0x4164, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(read_int_from_buf(value_buf) == 0);
+    // Disconnecting joins a reader that is still running.
+    memcpy(value_buf, &on, sizeof(on));
+    rc = clpWriteRegister(&camera, rd_cookie, 0x4164, value_buf, sizeof(value_buf), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    rc = clpDisconnect(rd_cookie);
+    assert(rc == CL_ERR_NO_ERR);
+  }
+
+  {
+    // Single flight: while one read of the frame rate is on the wire, three
+    // more wait for the connection; they share one command.
+    FakeSerial probe_serial;
+    CLUINT32 sf_cookie = 0;
+    CLINT8 sf_device_id[256] = {};
+    CLUINT32 sf_device_id_size = sizeof(sf_device_id);
+    rc = clpProbeDevice(&probe_serial, reinterpret_cast<const CLINT8 *>("FirstLightImaging#CRED2#CRED2"), sf_device_id,
+                        &sf_device_id_size, &sf_cookie, 100);
+    assert(rc == CL_ERR_NO_ERR);
+    BlockingSerial camera;
+    camera.reply = "123.0\r\nfli-cli>";
+    CLINT8 bufs[4][4] = {};
+    CLINT32 rcs[4] = {-1, -1, -1, -1};
+    std::vector<std::thread> readers;
+    readers.push_back(std::thread([&] { rcs[0] = clpReadRegister(&camera, sf_cookie, 0x1000, bufs[0], 4, 2000); }));
+    camera.wait_for_reader();
+    for (int idx = 1; idx < 4; ++idx) {
+      readers.push_back(
+          std::thread([&, idx] { rcs[idx] = clpReadRegister(&camera, sf_cookie, 0x1000, bufs[idx], 4, 2000); }));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    camera.release();
+    for (size_t idx = 0; idx < readers.size(); ++idx) {
+      readers[idx].join();
+    }
+    for (int idx = 0; idx < 4; ++idx) {
+      assert(rcs[idx] == CL_ERR_NO_ERR);
+      assert(read_float_from_buf(bufs[idx]) == 123.0f);
+    }
+    clp_cred2_transport_counters_t sf_counters = {};
+    rc = clpGetParam(&camera, CLP_CRED2_TRANSPORT_COUNTERS, sf_cookie, reinterpret_cast<CLINT8 *>(&sf_counters),
+                     sizeof(sf_counters), 100);
+    assert(rc == CL_ERR_NO_ERR);
+    assert(sf_counters.commands == 2);
+    assert(sf_counters.coalesced_reads == 2);
+    rc = clpDisconnect(sf_cookie);
+    assert(rc == CL_ERR_NO_ERR);
+  }
+
   rc = clpDisconnect(cookie);
   assert(rc == CL_ERR_NO_ERR);
   rc = clpDisconnect(cookie);
   assert(rc == CL_ERR_INVALID_COOKIE);
 
+  rc = clpCloseLib();
+  assert(rc == CL_ERR_NO_ERR);
+  assert(log_contains("event=init"));
+  assert(log_contains("level=warn cookie=" + std::to_string(cookie) + " event=flight"));
+  // Long flight lines reach the logger whole, up to the lengths at the end.
+  assert(log_contains("cmd=\"licenses\" cmd_len=8 reply=\"\\xA7\\xA7"));
+  assert(log_contains("\\xA7...\" reply_len=90"));
+  assert(log_contains("level=debug cookie=" + std::to_string(cookie) + " event=send cmd=\"fps raw\""));
+  assert(log_contains("event=recv bytes=15 prompt=1 reply=\"123.0\""));
+  assert(log_contains("event=watchdog reason=timeouts"));
+  assert(log_contains("event=watchdog recovered=1 rebooted=1 replayed=1"));
+  assert(log_contains("event=watchdog reason=faulty"));
+  assert(log_contains("event=watchdog acks=1 rc=" + std::to_string(CL_ERR_PARAM_DATA_VALUE)));
+  assert(log_contains("event=reader running=1"));
+  assert(log_contains("event=limits unchecked=AcquisitionFrameRate error="));
+
   std::cout << "clprotocol_cred2_test OK\n";
   return 0;
 }